@@ -21,6 +21,7 @@
 #include <lttoolbox/deserialiser.h>
 #include <lttoolbox/symbol_iter.h>
 
+#include <algorithm>
 #include <cctype>
 #include <cstdlib>
 #include <set>
@@ -29,10 +30,65 @@
 
 using namespace icu;
 
+namespace {
+
+size_t
+hashTag(UStringView s)
+{
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (auto c : s) {
+    hash = (hash ^ c) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+size_t
+hashPair(std::pair<int32_t, int32_t> const &p)
+{
+  uint64_t key = (uint64_t(uint32_t(p.first)) << 32) | uint32_t(p.second);
+  key *= 0x9e3779b97f4a7c15ull;
+  return key ^ (key >> 32);
+}
+
+template<typename HashAt>
+void
+place(std::vector<int32_t> &table, size_t pos, HashAt hashAt)
+{
+  size_t mask = table.size() - 1;
+  size_t i = hashAt(pos) & mask;
+  while (table[i] != 0) {
+    i = (i + 1) & mask;
+  }
+  table[i] = pos + 1;
+}
+
+/**
+ * Index the last of count keys, rehashing everything if that takes
+ * the table past half full
+ */
+template<typename HashAt>
+void
+indexLast(std::vector<int32_t> &table, size_t count, HashAt hashAt)
+{
+  if (count * 2 <= table.size()) {
+    place(table, count - 1, hashAt);
+    return;
+  }
+  size_t size = 16;
+  while (size < count * 2) {
+    size *= 2;
+  }
+  table.assign(size, 0);
+  for (size_t pos = 0; pos < count; pos++) {
+    place(table, pos, hashAt);
+  }
+}
+
+}
+
 Alphabet::Alphabet()
 {
-  spair[std::pair<int32_t, int32_t>(0,0)] = 0;
-  spairinv.push_back(std::pair<int32_t, int32_t>(0,0));
+  addPair(0, 0);
 }
 
 Alphabet::~Alphabet()
@@ -65,68 +121,125 @@ void
 Alphabet::copy(Alphabet const &a)
 {
   slexic = a.slexic;
+  slexickeys = a.slexickeys;
   slexicinv = a.slexicinv;
   spair = a.spair;
   spairinv = a.spairinv;
 }
 
+int32_t
+Alphabet::findTag(UStringView s) const
+{
+  if (slexic.empty()) {
+    return -1;
+  }
+  size_t mask = slexic.size() - 1;
+  for (size_t i = hashTag(s) & mask; slexic[i] != 0; i = (i + 1) & mask) {
+    if (slexickeys[slexic[i] - 1] == s) {
+      return slexic[i] - 1;
+    }
+  }
+  return -1;
+}
+
+int32_t
+Alphabet::findPair(int32_t c1, int32_t c2) const
+{
+  if (spair.empty()) {
+    return -1;
+  }
+  auto p = std::make_pair(c1, c2);
+  size_t mask = spair.size() - 1;
+  for (size_t i = hashPair(p) & mask; spair[i] != 0; i = (i + 1) & mask) {
+    if (spairinv[spair[i] - 1] == p) {
+      return spair[i] - 1;
+    }
+  }
+  return -1;
+}
+
+void
+Alphabet::addTag(UStringView s)
+{
+  slexickeys.emplace_back(s);
+  slexicinv.emplace_back(s);
+  indexLast(slexic, slexickeys.size(),
+        [this](size_t pos) { return hashTag(slexickeys[pos]); });
+}
+
+void
+Alphabet::addPair(int32_t c1, int32_t c2)
+{
+  spairinv.emplace_back(c1, c2);
+  indexLast(spair, spairinv.size(),
+        [this](size_t pos) { return hashPair(spairinv[pos]); });
+}
+
+void
+Alphabet::reindex()
+{
+  slexic.clear();
+  for (size_t i = 1; i <= slexickeys.size(); i++) {
+    indexLast(slexic, i, [this](size_t pos) { return hashTag(slexickeys[pos]); });
+  }
+  spair.clear();
+  for (size_t i = 1; i <= spairinv.size(); i++) {
+    indexLast(spair, i, [this](size_t pos) { return hashPair(spairinv[pos]); });
+  }
+}
+
 void
 Alphabet::includeSymbol(UStringView s)
 {
-  if(slexic.find(s) == slexic.end())
+  if(findTag(s) == -1)
   {
-    int32_t slexic_size = slexic.size();
-    UString st{s};
-    slexic[st] = -(slexic_size+1);
-    slexicinv.push_back(st);
+    addTag(s);
   }
 }
 
 int32_t
 Alphabet::operator()(int32_t const c1, int32_t const c2)
 {
-  auto tmp = std::make_pair(c1, c2);
-  if(spair.find(tmp) == spair.end())
+  int32_t code = findPair(c1, c2);
+  if(code == -1)
   {
-    int32_t spair_size = spair.size();
-    spair[tmp] = spair_size;
-    spairinv.push_back(tmp);
+    code = spairinv.size();
+    addPair(c1, c2);
   }
-
-  return spair[tmp];
+  return code;
 }
 
 int32_t
 Alphabet::operator()(UStringView s)
 {
   // While the documentation says this assumes existence, there are clearly code paths that call it with an unknown symbol and thus get 0 back AND create an entry for that 0. Changing it to just return 0 still passes all tests.
-  auto it = slexic.find(s);
-  if (it == slexic.end()) {
+  int32_t pos = findTag(s);
+  if (pos == -1) {
     return 0;
   }
-  return it->second;
+  return -(pos+1);
 }
 
 int32_t
 Alphabet::operator()(UStringView s) const
 {
-  auto it = slexic.find(s);
-  if (it == slexic.end()) {
+  int32_t pos = findTag(s);
+  if (pos == -1) {
     return -1;
   }
-  return it->second;
+  return -(pos+1);
 }
 
 bool
 Alphabet::isSymbolDefined(UStringView s) const
 {
-  return slexic.find(s) != slexic.end();
+  return findTag(s) != -1;
 }
 
 int32_t
 Alphabet::size() const
 {
-  return slexic.size();
+  return slexickeys.size();
 }
 
 void
@@ -155,19 +268,17 @@ Alphabet::read(FILE *input)
 {
   Alphabet a_new;
   a_new.spairinv.clear();
-  a_new.spair.clear();
 
   // Reading of taglist
   int32_t tam = Compression::multibyte_read(input);
-  std::map<int32_t, std::string> tmp;
   while(tam > 0)
   {
     tam--;
     UString mytag = "<"_u;
     mytag += Compression::string_read(input);
     mytag += ">"_u;
+    a_new.slexickeys.push_back(mytag);
     a_new.slexicinv.push_back(mytag);
-    a_new.slexic[mytag]= -a_new.slexicinv.size(); // ToDo: This does not turn the result negative due to unsigned semantics
   }
 
   // Reading of pairlist
@@ -178,12 +289,10 @@ Alphabet::read(FILE *input)
     tam--;
     int32_t first = Compression::multibyte_read(input);
     int32_t second = Compression::multibyte_read(input);
-    std::pair<int32_t, int32_t> tmp(first - bias, second - bias);
-    int32_t spair_size = a_new.spair.size();
-    a_new.spair[tmp] = spair_size;
-    a_new.spairinv.push_back(tmp);
+    a_new.spairinv.emplace_back(first - bias, second - bias);
   }
 
+  a_new.reindex();
   *this = a_new;
 }
 
@@ -197,18 +306,10 @@ Alphabet::serialise(std::ostream &serialised) const
 void
 Alphabet::deserialise(std::istream &serialised)
 {
-  slexicinv.clear();
-  slexic.clear();
-  spairinv.clear();
-  spair.clear();
   slexicinv = Deserialiser<std::vector<UString> >::deserialise(serialised);
-  for (size_t i = 0; i < slexicinv.size(); i++) {
-    slexic[slexicinv[i]] = -i - 1; // ToDo: This does not turn the result negative due to unsigned semantics
-  }
+  slexickeys = slexicinv;
   spairinv = Deserialiser<std::vector<std::pair<int32_t, int32_t> > >::deserialise(serialised);
-  for (size_t i = 0; i < slexicinv.size(); i++) {
-    spair[spairinv[i]] = i;
-  }
+  reindex();
 }
 
 void
@@ -254,9 +355,9 @@ Alphabet::decode(int32_t code) const
 std::set<int32_t>
 Alphabet::symbolsWhereLeftIs(UChar32 l) const {
   std::set<int32_t> eps;
-  for(const auto& sp: spair) {  // [(l, r) : tag]
-    if(sp.first.first == l) {
-      eps.insert(sp.second);
+  for(size_t i = 0; i < spairinv.size(); i++) {
+    if(spairinv[i].first == l) {
+      eps.insert(i);
     }
   }
   return eps;
@@ -296,7 +397,14 @@ Alphabet::createLoopbackSymbols(std::set<int32_t> &symbols, const Alphabet &basi
       }
     }
   }
-  for(auto& it : basis.slexic)
+  // in order of name, which decides the numbers the new tags get
+  std::vector<std::pair<UStringView, int32_t>> sorted;
+  for(size_t i = 0; i < basis.slexickeys.size(); i++)
+  {
+    sorted.emplace_back(basis.slexickeys[i], -int32_t(i+1));
+  }
+  std::sort(sorted.begin(), sorted.end());
+  for(auto& it : sorted)
   {
     // Only include tags that were actually seen on the correct side
     if(tags.find(it.second) != tags.end())
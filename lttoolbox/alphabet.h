@@ -35,10 +35,19 @@ class Alphabet
 {
 private:
   /**
-   * Symbol-identifier relationship. Only contains <tags>.
+   * Symbol-identifier relationship. Only contains <tags>. An
+   * open-addressing hash table of positions in slexickeys, 0 for an
+   * empty slot and i+1 for tag -(i+1), so that a lookup hashes the
+   * string it is given and compares it in place.
    * @see slexicinv
    */
-  std::map<UString, int32_t, std::less<>> slexic;
+  std::vector<int32_t> slexic;
+
+  /**
+   * The tags as they were first included, which is what slexic looks
+   * up even after setSymbol() has changed how one is printed.
+   */
+  std::vector<UString> slexickeys;
 
   /**
    * Identifier-symbol relationship. Only contains <tags>.
@@ -49,10 +58,11 @@ private:
 
   /**
    * Map from symbol-pairs to symbols; tags get negative numbers,
-   * other characters are UChar32's casted to ints.
+   * other characters are UChar32's casted to ints. Hash table like
+   * slexic, holding positions in spairinv.
    * @see spairinv
    */
-  std::map<std::pair<int32_t, int32_t>, int32_t> spair;
+  std::vector<int32_t> spair;
 
   /**
    * All symbol-pairs (both <tags> and letters).
@@ -64,6 +74,31 @@ private:
   void copy(Alphabet const &a);
   void destroy();
 
+  /**
+   * @return the position of a tag in slexickeys, or -1
+   */
+  int32_t findTag(UStringView s) const;
+
+  /**
+   * @return the code of a pair, or -1
+   */
+  int32_t findPair(int32_t c1, int32_t c2) const;
+
+  /**
+   * Add a tag to slexickeys and slexicinv, assuming it isn't there
+   */
+  void addTag(UStringView s);
+
+  /**
+   * Add a pair to spairinv, assuming it isn't there
+   */
+  void addPair(int32_t c1, int32_t c2);
+
+  /**
+   * Rebuild both hash tables from slexickeys and spairinv
+   */
+  void reindex();
+
 public:
 
   /**
@@ -519,7 +519,7 @@ AttCompiler::classify_backwards(int state, std::set<int>& path)
 
 /** Writes the transducer to @p file_name in lt binary format. */
 void
-AttCompiler::write(FILE *output)
+AttCompiler::write(FILE *output, bool flat, bool index)
 {
   std::map<UString, Transducer> temp;
   if (splitting) {
@@ -532,7 +532,7 @@ AttCompiler::write(FILE *output)
     temp["main@standard"_u] = extract_transducer(UNDECIDED);
   }
   writeTransducerSet(output, UString(letters.begin(), letters.end()),
-                     alphabet, temp);
+                     alphabet, temp, flat, index);
 }
 
 void
@@ -79,9 +79,11 @@ public:
    */
   void parse(std::string const &file_name, bool read_rl);
 
-  /** Writes the transducer to @p file_name in lt binary format. */
-
-  void write(FILE *fd) ;
+  /**
+   * Writes the transducer to @p file_name in lt binary format,
+   * memory-mappable if @p flat, with a section table if @p index.
+   */
+  void write(FILE *fd, bool flat = false, bool index = false);
 
   void setHfstSymbols(bool b);
   void setSplitting(bool b);
@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2024 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+#include <lttoolbox/binary_stream.h>
+
+#include <unicode/utf16.h>
+#include <utf8.h>
+
+BinaryStreamWriter::BinaryStreamWriter(OutputFile* o) : out(o) {}
+
+void
+BinaryStreamWriter::begin()
+{
+  if (!started) {
+    started = true;
+    out->write(BinaryStream::MAGIC, 4);
+    char version = static_cast<char>(BinaryStream::VERSION);
+    out->write(&version, 1);
+  }
+}
+
+void
+BinaryStreamWriter::number(uint64_t n)
+{
+  while (n >= 0x80) {
+    record += static_cast<char>((n & 0x7F) | 0x80);
+    n >>= 7;
+  }
+  record += static_cast<char>(n);
+}
+
+void
+BinaryStreamWriter::text(char type, UStringView s)
+{
+  std::string bytes;
+  utf8::utf16to8(s.begin(), s.end(), std::back_inserter(bytes));
+  record += type;
+  number(bytes.size());
+  record += bytes;
+}
+
+uint32_t
+BinaryStreamWriter::tag(UStringView name)
+{
+  key.assign(name.data(), name.size());
+  auto it = tags_by_name.find(key);
+  if (it != tags_by_name.end()) {
+    return it->second;
+  }
+  text('t', name);
+  tags_by_name.emplace(key, tag_count);
+  return tag_count++;
+}
+
+void
+BinaryStreamWriter::send()
+{
+  begin();
+  out->write(record.data(), record.size());
+  record.clear();
+}
+
+void
+BinaryStreamWriter::blank(UStringView s)
+{
+  if (!s.empty()) {
+    text('b', s);
+    send();
+  }
+}
+
+void
+BinaryStreamWriter::wblank(UStringView s)
+{
+  if (!s.empty()) {
+    text('w', s);
+    send();
+  }
+}
+
+void
+BinaryStreamWriter::chunk(UStringView s)
+{
+  if (!s.empty()) {
+    text('k', s);
+    send();
+  }
+}
+
+void
+BinaryStreamWriter::unit(std::vector<StreamReader::Reading> const &readings,
+                         Alphabet const &alpha)
+{
+  // the records of new tags go before the unit
+  UString name;
+  for (auto& rd : readings) {
+    for (auto sym : rd.symbols) {
+      if (sym < 0 && tags_by_symbol.find(sym) == tags_by_symbol.end()) {
+        name.clear();
+        alpha.getSymbol(name, sym);
+        tags_by_symbol[sym] = tag(name);
+      }
+    }
+  }
+  record += 'u';
+  number(readings.size());
+  for (auto& rd : readings) {
+    record += static_cast<char>(rd.mark);
+    number(rd.symbols.size());
+    for (auto sym : rd.symbols) {
+      if (sym < 0) {
+        record += '\0';
+        number(tags_by_symbol[sym]);
+      }
+      else {
+        number(sym);
+      }
+    }
+  }
+  send();
+}
+
+void
+BinaryStreamWriter::unit(UStringView s)
+{
+  struct Parsed {
+    char mark = 0;
+    // characters, and tags as ~n
+    std::vector<int64_t> symbols;
+  };
+  std::vector<Parsed> readings(1);
+  UString chunk_text;
+  size_t i = 0, n = s.size();
+  bool start = true;
+  while (i < n) {
+    UChar32 c;
+    U16_NEXT(s.data(), i, n, c);
+    if (start && (c == '*' || c == '@' || c == '#' || c == '=' || c == '%')) {
+      readings.back().mark = static_cast<char>(c);
+    }
+    else if (c == '/') {
+      readings.emplace_back();
+      start = true;
+      continue;
+    }
+    else if (c == '\\' && i < n) {
+      U16_NEXT(s.data(), i, n, c);
+      readings.back().symbols.push_back(c);
+    }
+    else if (c == '<' || c == '{') {
+      // up to the matching bracket, minding escapes
+      UChar32 end = (c == '<' ? '>' : '}');
+      size_t from = i - 1;
+      while (i < n && s[i] != end) {
+        i += (s[i] == '\\' && i + 1 < n) ? 2 : 1;
+      }
+      i = (i < n) ? i + 1 : n;
+      if (c == '<') {
+        readings.back().symbols.push_back(~int64_t(tag(s.substr(from, i - from))));
+      }
+      else {
+        chunk_text.append(s.substr(from, i - from));
+      }
+    }
+    else {
+      readings.back().symbols.push_back(c);
+    }
+    start = false;
+  }
+  if (!chunk_text.empty()) {
+    text('k', chunk_text);
+  }
+  record += 'u';
+  number(readings.size());
+  for (auto& rd : readings) {
+    record += rd.mark;
+    number(rd.symbols.size());
+    for (auto sym : rd.symbols) {
+      if (sym < 0) {
+        record += '\0';
+        sym = ~sym;
+      }
+      number(sym);
+    }
+  }
+  send();
+}
+
+void
+BinaryStreamWriter::null()
+{
+  record += 'z';
+  send();
+  out->flush();
+}
+
+void
+BinaryStreamWriter::finish()
+{
+  begin();
+}
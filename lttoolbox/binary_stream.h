@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2024 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LT_BINARY_STREAM_H__
+#define __LT_BINARY_STREAM_H__
+
+#include <lttoolbox/alphabet.h>
+#include <lttoolbox/output_file.h>
+#include <lttoolbox/stream_reader.h>
+
+#include <string>
+#include <unordered_map>
+
+/*
+ * The binary form of the stream, which StreamReader reads when
+ * setBinary() is called, starts with the bytes "LTSB" and a version
+ * byte, and goes on with records of a type byte followed by:
+ *
+ *   'b' a blank, as a length and that many bytes of UTF-8 text
+ *   'w' the wordbound blank of the next lexical unit, likewise
+ *   'k' the chunk of the next lexical unit, likewise
+ *   't' a tag, likewise; the tags are numbered from 0 as they come
+ *   'u' a lexical unit, as the number of readings and, for each, its
+ *       mark (0 if none), the number of its symbols and the symbols,
+ *       each either a character or 0 and the number of a tag
+ *   'z' a null flush point, with nothing after it
+ *
+ * All the numbers are unsigned LEB128. The text of readings needs no
+ * escapes and tags are looked up once however often they turn up.
+ */
+namespace BinaryStream {
+  constexpr char MAGIC[4] = {'L', 'T', 'S', 'B'};
+  constexpr unsigned char VERSION = 1;
+}
+
+class BinaryStreamWriter
+{
+private:
+  OutputFile* out;
+  bool started = false;
+  std::string record;
+
+  /**
+   * Numbers of the tags written so far, by text and by symbol of the
+   * alphabet of the readings they came in
+   */
+  std::unordered_map<UString, uint32_t> tags_by_name;
+  std::unordered_map<int32_t, uint32_t> tags_by_symbol;
+  uint32_t tag_count = 0;
+  UString key;
+
+  void begin();
+  void number(uint64_t n);
+  void text(char type, UStringView s);
+  uint32_t tag(UStringView name);
+  void send();
+
+public:
+  BinaryStreamWriter(OutputFile* o);
+
+  void blank(UStringView s);
+  void wblank(UStringView s);
+  void chunk(UStringView s);
+
+  /**
+   * Write a lexical unit read by a StreamReader with an alphabet
+   * @param alpha the alphabet of the symbols of the readings
+   */
+  void unit(std::vector<StreamReader::Reading> const &readings,
+            Alphabet const &alpha);
+
+  /**
+   * Write a lexical unit given as text, without the ^ and $
+   */
+  void unit(UStringView s);
+
+  /**
+   * Write a null flush point and flush the output
+   */
+  void null();
+
+  /**
+   * Write the header even if nothing else comes
+   */
+  void finish();
+};
+
+#endif
@@ -122,6 +122,12 @@ void CLI::print_usage(std::ostream& out)
 void CLI::parse_args(int argc, char* argv[])
 {
   prog_name = basename(argv[0]);
+  // start getopt afresh in case other arguments were parsed before
+#ifdef __GLIBC__
+  optind = 0;
+#else
+  optind = 1;
+#endif
   std::string arg_str;
 #if HAVE_GETOPT_LONG
   std::vector<struct option> long_options(options.size());
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2022 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _LT_CLOCK_CACHE_H_
+#define _LT_CLOCK_CACHE_H_
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * A map of bounded size which, once full, evicts with the CLOCK
+ * algorithm: every entry has a bit that is set when it is used, and
+ * the hand sweeps round the slots clearing bits until it finds one
+ * that has not been used since its last visit.
+ */
+template<typename K, typename V, typename Hash = std::hash<K>>
+class ClockCache
+{
+private:
+  struct Slot
+  {
+    K key;
+    V value;
+    bool used;
+  };
+
+  std::vector<Slot> slots;
+  std::unordered_map<K, size_t, Hash> index;
+  size_t capacity = 0;
+  size_t hand = 0;
+
+public:
+  size_t hits = 0;
+  size_t misses = 0;
+
+  /**
+   * Set the maximum number of entries, emptying the cache
+   * @param n the new capacity, 0 disables the cache
+   */
+  void setCapacity(size_t n)
+  {
+    capacity = n;
+    clear();
+  }
+
+  bool enabled() const
+  {
+    return capacity > 0;
+  }
+
+  void clear()
+  {
+    slots.clear();
+    index.clear();
+    hand = 0;
+  }
+
+  /**
+   * @return the value stored for key, or nullptr if there is none
+   */
+  V const * find(K const &key)
+  {
+    auto it = index.find(key);
+    if (it == index.end()) {
+      misses++;
+      return nullptr;
+    }
+    hits++;
+    slots[it->second].used = true;
+    return &slots[it->second].value;
+  }
+
+  void insert(K const &key, V const &value)
+  {
+    if (capacity == 0 || index.find(key) != index.end()) {
+      return;
+    }
+    if (slots.size() < capacity) {
+      index.emplace(key, slots.size());
+      slots.push_back({key, value, false});
+      return;
+    }
+    while (slots[hand].used) {
+      slots[hand].used = false;
+      hand = (hand + 1) % capacity;
+    }
+    index.erase(slots[hand].key);
+    index.emplace(key, hand);
+    slots[hand].key = key;
+    slots[hand].value = value;
+    hand = (hand + 1) % capacity;
+  }
+};
+
+#endif
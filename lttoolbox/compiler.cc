@@ -15,12 +15,16 @@
  * along with this program; if not, see <https://www.gnu.org/licenses/>.
  */
 #include <lttoolbox/compiler.h>
+#include <lttoolbox/compression.h>
 #include <lttoolbox/xml_parse_util.h>
 #include <lttoolbox/string_utils.h>
 #include <lttoolbox/file_utils.h>
 #include <lttoolbox/acx.h>
 #include <lttoolbox/regexp_compiler.h>
 
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
 #include <iostream>
 #include <thread>
 
@@ -67,25 +71,93 @@ Compiler::parse(std::string const &file, UStringView dir)
   xmlFreeTextReader(reader);
   xmlCleanupParser();
 
+  // Sections whose entries are all as they were in an earlier run are
+  // taken from the cache instead of being minimised again
+  std::set<UString> cached;
+  if(!cache_dir.empty())
+  {
+    for(auto& it : incremental_entries)
+    {
+      sections[it.first];
+    }
+    for(auto& it : sections)
+    {
+      if(readCache(section_digests[it.first], it.second))
+      {
+        cached.insert(it.first);
+      }
+    }
+  }
+
+  // The entries held back are built into minimal transducers, which
+  // are then joined with whatever went into the trie. A section made
+  // only of these is already minimal, so minimize() below just gives
+  // its states their usual numbers.
+  for(auto& it : incremental_entries)
+  {
+    if(cached.find(it.first) != cached.end())
+    {
+      continue;
+    }
+    Transducer &t = sections[it.first];
+    if(t.isEmpty())
+    {
+      t = it.second.build(default_weight);
+    }
+    else
+    {
+      Transducer built = it.second.build(default_weight);
+      t.setFinal(t.insertTransducer(t.getInitial(), built, alphabet(0, 0)),
+                 default_weight);
+    }
+  }
+  incremental_entries.clear();
 
   // Minimize transducers: For each section, call transducer.minimize() in
   // its own thread. This is the major bottleneck of lt-comp and sections
-  // are completely independent transducers.
+  // are completely independent transducers. Each determinization is
+  // threaded too, with the cores shared out between the sections, so
+  // that a single large section still uses every core.
   std::vector<std::thread> minimisations;
+  unsigned int pending = 0;
   for(auto& it : sections)
   {
+    if(cached.find(it.first) == cached.end())
+    {
+      pending++;
+    }
+  }
+  unsigned int cores = threads ? threads : std::thread::hardware_concurrency();
+  unsigned int section_threads = std::max(1u, cores / std::max(1u, pending));
+  for(auto& it : sections)
+  {
+    if(cached.find(it.first) != cached.end()) {
+      continue;
+    }
     if(jobs) {
       minimisations.push_back(
-        std::thread([](Transducer &t) { t.minimize(); },
+        std::thread([section_threads, this](Transducer &t) {
+                      t.minimize(0, section_threads, minimisation);
+                    },
                     std::ref(it.second)));
     }
     else {
-      it.second.minimize();
+      it.second.minimize(0, 1, minimisation);
     }
   }
   for (auto &thr : minimisations) {
     thr.join();
   }
+  if(!cache_dir.empty())
+  {
+    for(auto& it : sections)
+    {
+      if(cached.find(it.first) == cached.end())
+      {
+        writeCache(section_digests[it.first], it.second);
+      }
+    }
+  }
 
   if (is_separable) {
     // ensure that all paths end in <$>, in case the user forgot to include
@@ -189,9 +261,18 @@ Compiler::procParDef()
   }
   else
   {
+    paradigm_tails.erase(current_paradigm);
     if(!paradigms[current_paradigm].isEmpty())
     {
-      paradigms[current_paradigm].minimize();
+      if(cache_dir.empty())
+      {
+        paradigms[current_paradigm].minimize(0, 1, minimisation);
+      }
+      else if(!readCache(paradigm_digests[current_paradigm], paradigms[current_paradigm]))
+      {
+        paradigms[current_paradigm].minimize(0, 1, minimisation);
+        writeCache(paradigm_digests[current_paradigm], paradigms[current_paradigm]);
+      }
       paradigms[current_paradigm].joinFinals();
       current_paradigm.clear();
     }
@@ -564,15 +645,26 @@ Compiler::procPar()
 void
 Compiler::insertEntryTokens(std::vector<EntryToken> const &elements)
 {
+  if(!cache_dir.empty())
+  {
+    digestEntry(elements);
+  }
+
   if(!current_paradigm.empty())
   {
     // compilation of paradigms
     Transducer &t = paradigms[current_paradigm];
     int e = t.getInitial();
 
-    for(auto& element : elements)
+    for(size_t i = 0, limit = elements.size(); i < limit; i++)
     {
-      if(element.isParadigm())
+      auto& element = elements[i];
+      if(element.isParadigm() && share_paradigms)
+      {
+        e = insertSharedTail(t, e, elements, i, paradigm_tails[current_paradigm]);
+        break;
+      }
+      else if(element.isParadigm())
       {
         e = t.insertTransducer(e, paradigms[element.paradigmName()]);
       }
@@ -599,6 +691,11 @@ Compiler::insertEntryTokens(std::vector<EntryToken> const &elements)
   {
     // dictionary compilation
 
+    if(incremental && insertIncremental(elements))
+    {
+      return;
+    }
+
     Transducer &t = sections[current_section];
     int e = t.getInitial();
 
@@ -635,6 +732,12 @@ Compiler::insertEntryTokens(std::vector<EntryToken> const &elements)
             prefix_paradigms[current_section][elements[i].paradigmName()] = e;
           }
         }
+        else if(share_paradigms)
+        {
+          // intermediate paradigm, along with the rest of the entry
+          e = insertSharedTail(t, e, elements, i, section_tails[current_section]);
+          break;
+        }
         else
         {
           // intermediate paradigm
@@ -657,6 +760,292 @@ Compiler::insertEntryTokens(std::vector<EntryToken> const &elements)
   }
 }
 
+int
+Compiler::insertSharedTail(Transducer &t, int state,
+                           std::vector<EntryToken> const &elements, size_t first,
+                           std::map<std::vector<int32_t>, std::pair<int, int>> &tails)
+{
+  // the ending, spelled out with the kind and length of each element
+  std::vector<int32_t> key;
+  for(size_t i = first; i < elements.size(); i++)
+  {
+    auto& element = elements[i];
+    if(element.isParadigm())
+    {
+      auto& name = element.paradigmName();
+      key.push_back(0);
+      key.push_back(name.size());
+      key.insert(key.end(), name.begin(), name.end());
+    }
+    else if(element.isRegexp())
+    {
+      auto& re = element.regExp();
+      key.push_back(1);
+      key.push_back(re.size());
+      key.insert(key.end(), re.begin(), re.end());
+    }
+    else
+    {
+      double weight = element.entryWeight();
+      int32_t bits[2];
+      memcpy(bits, &weight, sizeof(bits));
+      key.push_back(2);
+      key.push_back(element.left().size());
+      key.insert(key.end(), element.left().begin(), element.left().end());
+      key.push_back(element.right().size());
+      key.insert(key.end(), element.right().begin(), element.right().end());
+      key.insert(key.end(), bits, bits + 2);
+    }
+  }
+
+  auto it = tails.find(key);
+  if(it != tails.end())
+  {
+    t.linkStates(state, it->second.first, alphabet(0, 0));
+    return it->second.second;
+  }
+
+  int start = t.insertNewSingleTransduction(alphabet(0, 0), state, default_weight);
+  int e = start;
+  for(size_t i = first; i < elements.size(); i++)
+  {
+    if(elements[i].isParadigm())
+    {
+      e = t.insertTransducer(e, paradigms[elements[i].paradigmName()]);
+    }
+    else if(elements[i].isRegexp())
+    {
+      RegexpCompiler analyzer;
+      analyzer.initialize(&alphabet);
+      analyzer.compile(elements[i].regExp());
+      e = t.insertTransducer(e, analyzer.getTransducer(), alphabet(0,0));
+    }
+    else
+    {
+      e = matchTransduction(elements[i].left(), elements[i].right(), e, t, elements[i].entryWeight());
+    }
+  }
+  tails[key] = {start, e};
+  return e;
+}
+
+void
+Compiler::Digest::add(uint64_t value)
+{
+  for(int i = 0; i < 8; i++)
+  {
+    h1 = (h1 ^ ((value >> (8 * i)) & 0xff)) * 0x100000001b3ULL;
+  }
+  h2 = (h2 ^ value) * 0xff51afd7ed558ccdULL;
+  h2 ^= h2 >> 32;
+}
+
+void
+Compiler::Digest::add(UStringView value)
+{
+  add(value.size());
+  for(auto c : value)
+  {
+    add(uint64_t(c));
+  }
+}
+
+void
+Compiler::digestSymbol(Digest &digest, int32_t symbol)
+{
+  if(symbol < 0)
+  {
+    UString name;
+    alphabet.getSymbol(name, symbol);
+    digest.add(name);
+  }
+  else
+  {
+    digest.add(uint64_t(symbol));
+  }
+}
+
+void
+Compiler::digestEntry(std::vector<EntryToken> const &elements)
+{
+  Digest &digest = current_paradigm.empty() ? section_digests[current_section]
+                                            : paradigm_digests[current_paradigm];
+  digest.add(elements.size());
+  for(auto& element : elements)
+  {
+    if(element.isParadigm())
+    {
+      // a paradigm stands for everything that went into it
+      Digest &inner = paradigm_digests[element.paradigmName()];
+      digest.add(0);
+      digest.add(element.paradigmName());
+      digest.add(inner.h1);
+      digest.add(inner.h2);
+    }
+    else if(element.isRegexp())
+    {
+      digest.add(1);
+      digest.add(element.regExp().size());
+      for(auto c : element.regExp())
+      {
+        digestSymbol(digest, c);
+      }
+    }
+    else
+    {
+      uint64_t weight;
+      memcpy(&weight, &element.entryWeight(), sizeof(weight));
+      digest.add(2);
+      digest.add(weight);
+      digest.add(element.left().size());
+      for(auto c : element.left())
+      {
+        digestSymbol(digest, c);
+      }
+      digest.add(element.right().size());
+      for(auto c : element.right())
+      {
+        digestSymbol(digest, c);
+      }
+    }
+  }
+}
+
+std::string
+Compiler::cachePath(Digest const &digest) const
+{
+  // everything besides the entries that changes what gets built
+  Digest key = digest;
+  key.add(direction);
+  key.add(unified_compilation);
+  key.add(is_separable);
+  for(auto& it : acx_map)
+  {
+    key.add(uint64_t(it.first));
+    key.add(it.second.size());
+    for(auto c : it.second)
+    {
+      key.add(uint64_t(c));
+    }
+  }
+  char name[40];
+  snprintf(name, sizeof(name), "%016llx%016llx.bin",
+           (unsigned long long) key.h1, (unsigned long long) key.h2);
+  return cache_dir + "/" + name;
+}
+
+bool
+Compiler::readCache(Digest const &digest, Transducer &t)
+{
+  FILE *input = fopen(cachePath(digest).c_str(), "rb");
+  if(!input)
+  {
+    return false;
+  }
+  char header[4]{};
+  if(fread(header, 1, 4, input) != 4 || strncmp(header, HEADER_CACHE, 4) != 0)
+  {
+    fclose(input);
+    return false;
+  }
+  Alphabet cache_alphabet;
+  Transducer cached;
+  cache_alphabet.read(input);
+  cached.read(input);
+  fclose(input);
+
+  // the same entries have just given every pair the transducer uses a
+  // code, so this only renames them; minimize() then numbers the
+  // states as it would have numbered them under these codes
+  cached.updateAlphabet(cache_alphabet, alphabet, true);
+  cached.minimize();
+  t = std::move(cached);
+  return true;
+}
+
+void
+Compiler::writeCache(Digest const &digest, Transducer const &t)
+{
+  // only the pairs this transducer uses are kept with it, so that it
+  // can be read back whatever codes the rest of the dictionary gives
+  // them next time
+  Alphabet cache_alphabet;
+  Transducer copy = t;
+  copy.updateAlphabet(alphabet, cache_alphabet, true);
+
+  std::string path = cachePath(digest);
+  std::string temp = path + ".tmp";
+  FILE *output = fopen(temp.c_str(), "wb");
+  if(!output)
+  {
+    std::cerr << "Warning: cannot write to the cache '" << temp << "'." << std::endl;
+    return;
+  }
+  fwrite(HEADER_CACHE, 1, 4, output);
+  cache_alphabet.write(output);
+  copy.write(output);
+  fclose(output);
+  std::rename(temp.c_str(), path.c_str());
+}
+
+bool
+Compiler::insertIncremental(std::vector<EntryToken> const &elements)
+{
+  if(!acx_map.empty() || is_separable ||
+     weighted_sections.find(current_section) != weighted_sections.end())
+  {
+    return false;
+  }
+
+  bool plain = true;
+  for(auto& element : elements)
+  {
+    if(!element.isSingleTransduction())
+    {
+      plain = false;
+    }
+    else if(element.entryWeight() != default_weight)
+    {
+      // entries that came later would take this weight along with the
+      // transitions they share, so the ones held back go into the
+      // trie now and the rest of the section follows them in order
+      weighted_sections.insert(current_section);
+      auto it = incremental_entries.find(current_section);
+      if(it != incremental_entries.end())
+      {
+        it->second.replay(sections[current_section], alphabet(0, 0),
+                          default_weight);
+        incremental_entries.erase(it);
+      }
+      return false;
+    }
+  }
+  if(!plain)
+  {
+    return false;
+  }
+
+  // the same pairs matchTransduction() would insert
+  std::vector<int32_t> labels;
+  for(auto& element : elements)
+  {
+    bool lr = (direction == COMPILER_RESTRICTION_LR_VAL);
+    auto& left = lr ? element.left() : element.right();
+    auto& right = lr ? element.right() : element.left();
+    size_t limit = std::max(left.size(), right.size());
+    if(limit == 0)
+    {
+      labels.push_back(alphabet(0, 0));
+    }
+    for(size_t i = 0; i < limit; i++)
+    {
+      labels.push_back(alphabet(i < left.size() ? left[i] : 0,
+                                i < right.size() ? right[i] : 0));
+    }
+  }
+  incremental_entries[current_section].add(labels);
+  return true;
+}
 
 void
 Compiler::requireAttribute(UStringView value, UStringView attrname, UStringView elemname)
@@ -1009,9 +1398,9 @@ Compiler::procRegexp()
 }
 
 void
-Compiler::write(FILE *output)
+Compiler::write(FILE *output, bool flat, bool index)
 {
-  writeTransducerSet(output, letters, alphabet, sections);
+  writeTransducerSet(output, letters, alphabet, sections, flat, index);
 }
 
 void
@@ -1050,6 +1439,43 @@ Compiler::setJobs(bool j)
   jobs = j;
 }
 
+void
+Compiler::setThreads(unsigned int t)
+{
+  threads = t;
+}
+
+void
+Compiler::setMinimisation(MinimisationMode mode)
+{
+  minimisation = mode;
+}
+
+void
+Compiler::setIncremental(bool value)
+{
+  incremental = value;
+}
+
+void
+Compiler::setShareParadigms(bool value)
+{
+  share_paradigms = value;
+}
+
+void
+Compiler::setCacheDir(std::string const &dir)
+{
+  std::error_code err;
+  std::filesystem::create_directories(dir, err);
+  if(err)
+  {
+    std::cerr << "Error: cannot create the cache directory '" << dir << "': " << err.message() << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  cache_dir = dir;
+}
+
 void
 Compiler::setMaxSectionEntries(size_t m)
 {
@@ -19,10 +19,12 @@
 
 #include <lttoolbox/alphabet.h>
 #include <lttoolbox/entry_token.h>
+#include <lttoolbox/incremental_builder.h>
 #include <lttoolbox/transducer.h>
 #include <lttoolbox/ustring.h>
 #include <lttoolbox/sorted_vector.hpp>
 
+#include <cstdint>
 #include <map>
 #include <set>
 #include <libxml/xmlreader.h>
@@ -122,6 +124,29 @@ private:
    */
   bool jobs = false;
 
+  /**
+   * Threads shared out between the parallel minimisation jobs, 0 for
+   * one per core
+   */
+  unsigned int threads = 0;
+
+  /**
+   * Minimisation algorithm
+   */
+  MinimisationMode minimisation = mm_auto;
+
+  /**
+   * Build the plain entries of each section straight into a minimal
+   * transducer instead of a trie
+   */
+  bool incremental = false;
+
+  /**
+   * Share one copy of every entry ending that starts with a paradigm
+   * among all the entries that end that way
+   */
+  bool share_paradigms = false;
+
   /**
    * Are we compiling an LSX dictionary
    */
@@ -148,6 +173,46 @@ private:
    */
   std::map<UString, Transducer> sections;
 
+  /**
+   * Plain entries of each section waiting for the incremental
+   * construction
+   */
+  std::map<UString, IncrementalBuilder> incremental_entries;
+
+  /**
+   * Sections with weighted entries. Entries share the transitions of
+   * the trie in the order they come, weights included, so these
+   * sections are built the usual way
+   */
+  std::set<UString> weighted_sections;
+
+  /**
+   * Directory where minimised paradigms and sections are kept between
+   * runs; empty if there is no cache
+   */
+  std::string cache_dir;
+
+  /**
+   * Hash of everything that went into a paradigm or a section, which
+   * names its minimised transducer in the cache
+   */
+  struct Digest
+  {
+    uint64_t h1 = 0xcbf29ce484222325ULL;
+    uint64_t h2 = 0x9e3779b97f4a7c15ULL;
+    void add(uint64_t value);
+    void add(UStringView value);
+  };
+  std::map<UString, Digest> paradigm_digests;
+  std::map<UString, Digest> section_digests;
+
+  /**
+   * Shared entry endings, with their first and last states, for each
+   * section and for each paradigm while it is being built
+   */
+  std::map<UString, std::map<std::vector<int32_t>, std::pair<int, int>>> section_tails;
+  std::map<UString, std::map<std::vector<int32_t>, std::pair<int, int>>> paradigm_tails;
+
   /**
    * List of named prefix copy of a paradigm
    */
@@ -263,6 +328,60 @@ private:
    */
   void insertEntryTokens(std::vector<EntryToken> const &elements);
 
+  /**
+   * Hold back an entry of the current section for the incremental
+   * construction
+   * @param elements the list
+   * @return false if the entry has to go into the trie instead
+   */
+  bool insertIncremental(std::vector<EntryToken> const &elements);
+
+  /**
+   * Add an entry to the digest of the paradigm or section it goes into
+   * @param elements the entry
+   */
+  void digestEntry(std::vector<EntryToken> const &elements);
+
+  /**
+   * Add a symbol to a digest, by name if it is a tag, since tags are
+   * numbered in the order they are first seen
+   */
+  void digestSymbol(Digest &digest, int32_t symbol);
+
+  /**
+   * @return the file of the cache for a digest
+   */
+  std::string cachePath(Digest const &digest) const;
+
+  /**
+   * Load a minimised transducer from the cache
+   * @param digest what went into it
+   * @param t where to put it, untouched if it isn't in the cache
+   * @return true if it was in the cache
+   */
+  bool readCache(Digest const &digest, Transducer &t);
+
+  /**
+   * Keep a minimised transducer in the cache
+   * @param digest what went into it
+   * @param t the transducer
+   */
+  void writeCache(Digest const &digest, Transducer const &t);
+
+  /**
+   * Link a state to the shared copy of an entry ending, making the
+   * copy if this is the first entry that ends that way
+   * @param t the transducer
+   * @param state the state to link from
+   * @param elements the entry
+   * @param first the element where the ending starts
+   * @param tails the shared endings of t
+   * @return the last state of the ending
+   */
+  int insertSharedTail(Transducer &t, int state,
+                       std::vector<EntryToken> const &elements, size_t first,
+                       std::map<std::vector<int32_t>, std::pair<int, int>> &tails);
+
   /**
    * Skip all document #text nodes before "elem"
    * @param name the name of the node
@@ -385,8 +504,10 @@ public:
   /**
    * Write the result of compilation
    * @param fd the stream where write the result
+   * @param flat write the memory-mappable layout
+   * @param index write a table of the sections before them
    */
-  void write(FILE *fd);
+  void write(FILE *fd, bool flat = false, bool index = false);
 
   /**
    * Set keep morpheme boundaries
@@ -398,6 +519,36 @@ public:
    */
   void setJobs(bool jobs);
 
+  /**
+   * Set how many threads the parallel minimisation jobs share, 0 for
+   * one per core
+   */
+  void setThreads(unsigned int threads);
+
+  /**
+   * Set the minimisation algorithm
+   */
+  void setMinimisation(MinimisationMode mode);
+
+  /**
+   * Set whether to build sections incrementally from their sorted
+   * entries
+   */
+  void setIncremental(bool value);
+
+  /**
+   * Set whether entries that end the same way from a paradigm onwards
+   * share a single copy of that ending
+   */
+  void setShareParadigms(bool value);
+
+  /**
+   * Keep minimised paradigms and sections in a directory and reuse
+   * the ones whose entries haven't changed since the last run
+   * @param dir the directory, created if it doesn't exist
+   */
+  void setCacheDir(std::string const &dir);
+
   /**
    * Set how many top-level entries to allow in a section before starting a new one automatically
    */
@@ -28,7 +28,8 @@
 // Global lttoolbox features
 constexpr char HEADER_LTTOOLBOX[4]{'L', 'T', 'T', 'B'};
 enum LT_FEATURES : uint64_t {
-  LTF_UNKNOWN = (1ull << 0), // Features >= this are unknown, so throw an error; Inc this if more features are added
+  LTF_INDEX = (1ull << 0), // Section table (name, type, offset, length, checksum) before the section data, see writeTransducerSet()
+  LTF_UNKNOWN = (1ull << 1), // Features >= this are unknown, so throw an error; Inc this if more features are added
   LTF_RESERVED = (1ull << 63), // If we ever reach this many feature flags, we need a flag to know how to extend beyond 64 bits
 };
 
@@ -36,10 +37,14 @@ enum LT_FEATURES : uint64_t {
 constexpr char HEADER_TRANSDUCER[4]{'L', 'T', 'T', 'D'};
 enum TD_FEATURES : uint64_t {
   TDF_WEIGHTS = (1ull << 0),
-  TDF_UNKNOWN = (1ull << 1), // Features >= this are unknown, so throw an error; Inc this if more features are added
+  TDF_FLAT = (1ull << 1), // Fixed-width node/transition arrays that can be memory-mapped, see TransExe
+  TDF_UNKNOWN = (1ull << 2), // Features >= this are unknown, so throw an error; Inc this if more features are added
   TDF_RESERVED = (1ull << 63), // If we ever reach this many feature flags, we need a flag to know how to extend beyond 64 bits
 };
 
+// A minimised paradigm or section kept by lt-comp --cache, see Compiler::writeCache()
+constexpr char HEADER_CACHE[4]{'L', 'T', 'C', 'C'};
+
 
 inline auto write_u64(FILE *out, uint64_t value) {
   auto rv = fwrite_unlocked(reinterpret_cast<const char*>(&value), 1, sizeof(value), out);
@@ -18,7 +18,8 @@
 
 
 EntryToken::EntryToken() :
-type(paradigm)
+type(paradigm),
+weight(0)
 {
 }
 
@@ -18,7 +18,9 @@
 #include <lttoolbox/file_utils.h>
 #include <lttoolbox/compression.h>
 
+#include <algorithm>
 #include <cstring>
+#include <sstream>
 
 UFILE*
 openOutTextFile(const std::string& fname)
@@ -65,21 +67,145 @@ openInBinFile(const std::string& fname)
   }
 }
 
+namespace {
+
+/**
+ * Entry of the LTF_INDEX section table. Offsets are relative to the
+ * start of the section data, which follows the table.
+ */
+struct SectionEntry
+{
+  UString name;
+  uint64_t type;
+  uint64_t offset;
+  uint64_t length;
+  uint64_t checksum;
+};
+
+/**
+ * FNV-1a over the next @p length bytes of @p input
+ */
+uint64_t
+sectionChecksum(FILE* input, uint64_t length)
+{
+  uint64_t hash = 0xcbf29ce484222325ull;
+  char buffer[1 << 16];
+  while (length > 0) {
+    size_t n = fread_unlocked(buffer, 1, std::min<uint64_t>(length, sizeof(buffer)), input);
+    if (n == 0) {
+      throw std::runtime_error("Failed to read FST section");
+    }
+    for (size_t i = 0; i < n; i++) {
+      hash = (hash ^ static_cast<unsigned char>(buffer[i])) * 0x100000001b3ull;
+    }
+    length -= n;
+  }
+  return hash;
+}
+
+void
+skipBytes(FILE* input, uint64_t length)
+{
+  char buffer[1 << 16];
+  while (length > 0) {
+    size_t n = fread_unlocked(buffer, 1, std::min<uint64_t>(length, sizeof(buffer)), input);
+    if (n == 0) {
+      throw std::runtime_error("Failed to read FST section");
+    }
+    length -= n;
+  }
+}
+
+void
+writeSection(FILE* output, UStringView name, Transducer& t, Alphabet& alpha,
+             bool flat)
+{
+  if (flat) {
+    TransExe exe;
+    exe.build(t, alpha, TransExe::sectionFlags(name));
+    exe.write(output);
+  } else {
+    t.write(output);
+  }
+}
+
+void
+writeIndexed(FILE* output, Alphabet& alpha,
+             std::map<UString, Transducer>& trans, bool flat)
+{
+  // the table needs the section lengths, so the sections are written
+  // to a scratch file first; they are laid out there exactly as they
+  // will be after the table, which keeps flat images aligned
+  FILE* body = tmpfile();
+  if (!body) {
+    throw std::runtime_error("Failed to create temporary file");
+  }
+  std::vector<SectionEntry> index;
+  for (auto& it : trans) {
+    long start = ftell(body);
+    writeSection(body, it.first, it.second, alpha, flat);
+    index.push_back({it.first, 0, uint64_t(start), uint64_t(ftell(body) - start), 0});
+    std::cout << it.first << " " << it.second.size();
+    std::cout << " " << it.second.numberOfTransitions() << std::endl;
+  }
+  for (auto& entry : index) {
+    fseek(body, entry.offset + 4, SEEK_SET);
+    entry.type = read_u64_be(body);
+    fseek(body, entry.offset, SEEK_SET);
+    entry.checksum = sectionChecksum(body, entry.length);
+  }
+
+  for (auto& entry : index) {
+    Compression::string_write(entry.name, output);
+    write_be(output, entry.type);
+    write_be(output, entry.offset);
+    write_be(output, entry.length);
+    write_be(output, entry.checksum);
+  }
+  long offset = ftell(output);
+  int padding = (offset < 0) ? 0 : (8 - (offset + 1) % 8) % 8;
+  fputc_unlocked(padding, output);
+  for (int i = 0; i != padding; i++) {
+    fputc_unlocked(0, output);
+  }
+
+  rewind(body);
+  char buffer[1 << 16];
+  size_t n;
+  while ((n = fread_unlocked(buffer, 1, sizeof(buffer), body)) > 0) {
+    if (fwrite_unlocked(buffer, 1, n, output) != n) {
+      fclose(body);
+      throw std::runtime_error("Failed to write FST section");
+    }
+  }
+  fclose(body);
+}
+
+}
+
 void
 writeTransducerSet(FILE* output, UStringView letters,
                    Alphabet& alpha,
-                   std::map<UString, Transducer>& trans)
+                   std::map<UString, Transducer>& trans,
+                   bool flat, bool index)
 {
   fwrite_unlocked(HEADER_LTTOOLBOX, 1, 4, output);
   uint64_t features = 0;
+  if (index) {
+    features |= LTF_INDEX;
+  }
   write_be(output, features);
 
   Compression::string_write(letters, output);
   alpha.write(output);
   Compression::multibyte_write(trans.size(), output);
+  if (index) {
+    writeIndexed(output, alpha, trans, flat);
+    return;
+  }
   for (auto& it : trans) {
     Compression::string_write(it.first, output);
-    it.second.write(output);
+    writeSection(output, it.first, it.second, alpha, flat);
     std::cout << it.first << " " << it.second.size();
     std::cout << " " << it.second.numberOfTransitions() << std::endl;
   }
@@ -88,20 +214,22 @@ writeTransducerSet(FILE* output, UStringView letters,
 void
 writeTransducerSet(FILE* output, const std::set<UChar32>& letters,
                    Alphabet& alpha,
-                   std::map<UString, Transducer>& trans)
+                   std::map<UString, Transducer>& trans,
+                   bool flat, bool index)
 {
-  writeTransducerSet(output, UString(letters.begin(), letters.end()), alpha, trans);
+  writeTransducerSet(output, UString(letters.begin(), letters.end()), alpha, trans, flat, index);
 }
 
-void
+uint64_t
 readShared(FILE* input, std::set<UChar32>& letters, Alphabet& alpha)
 {
+  uint64_t features = 0;
   fpos_t pos;
   if (fgetpos(input, &pos) == 0) {
     char header[4]{};
     fread_unlocked(header, 1, 4, input);
     if (strncmp(header, HEADER_LTTOOLBOX, 4) == 0) {
-      auto features = read_be<uint64_t>(input);
+      features = read_be<uint64_t>(input);
       if (features >= LTF_UNKNOWN) {
         throw std::runtime_error("FST has features that are unknown to this version of lttoolbox - upgrade!");
       }
@@ -116,30 +244,101 @@ readShared(FILE* input, std::set<UChar32>& letters, Alphabet& alpha)
   }
 
   alpha.read(input);
+  return features;
 }
 
+/**
+ * Call load(name, keep) for each section with the stream at its start;
+ * load() must consume the section, and is only called for unwanted
+ * sections when there is no way to step over them
+ */
+template<typename Load>
 void
-readTransducerSet(FILE* input, std::set<UChar32>& letters,
-                  Alphabet& alpha,
-                  std::map<UString, Transducer>& trans)
+readSections(FILE* input, uint64_t features, SectionFilter const& wanted, Load load)
 {
-  readShared(input, letters, alpha);
+  int count = Compression::multibyte_read(input);
+  if (!(features & LTF_INDEX)) {
+    for (; count > 0; count--) {
+      UString name = Compression::string_read(input);
+      load(name, !wanted || wanted(name));
+    }
+    return;
+  }
 
-  for (int len = Compression::multibyte_read(input); len > 0; len--) {
-    UString name = Compression::string_read(input);
-    trans[name].read(input);
+  std::vector<SectionEntry> index(count);
+  for (auto& entry : index) {
+    entry.name = Compression::string_read(input);
+    entry.type = read_u64_be(input);
+    entry.offset = read_u64_be(input);
+    entry.length = read_u64_be(input);
+    entry.checksum = read_u64_be(input);
+  }
+  int padding = fgetc_unlocked(input);
+  if (padding < 0 || padding > 7) {
+    throw std::runtime_error("Malformed FST section index");
+  }
+  skipBytes(input, padding);
+
+  long start = ftell(input);
+  uint64_t pos = 0;
+  for (auto& entry : index) {
+    if (wanted && !wanted(entry.name)) {
+      continue;
+    }
+    if (start < 0) {
+      // a pipe: read up to the section
+      skipBytes(input, entry.offset - pos);
+    } else {
+      fseek(input, start + entry.offset, SEEK_SET);
+      // flat sections are mapped rather than read, so only check the
+      // ones that are decoded anyway
+      if (!(entry.type & TDF_FLAT)) {
+        if (sectionChecksum(input, entry.length) != entry.checksum) {
+          std::ostringstream msg;
+          msg << "FST section " << entry.name << " is corrupt";
+          throw std::runtime_error(msg.str());
+        }
+        fseek(input, start + entry.offset, SEEK_SET);
+      }
+    }
+    load(entry.name, true);
+    pos = entry.offset + entry.length;
+  }
+  if (start >= 0 && !index.empty()) {
+    fseek(input, start + index.back().offset + index.back().length, SEEK_SET);
+  } else if (!index.empty()) {
+    skipBytes(input, index.back().offset + index.back().length - pos);
   }
 }
 
 void
 readTransducerSet(FILE* input, std::set<UChar32>& letters,
                   Alphabet& alpha,
-                  std::map<UString, TransExe>& trans)
+                  std::map<UString, Transducer>& trans,
+                  SectionFilter const& wanted)
 {
-  readShared(input, letters, alpha);
+  uint64_t features = readShared(input, letters, alpha);
+  readSections(input, features, wanted, [&](UString const& name, bool keep) {
+    if (keep) {
+      trans[name].read(input);
+    } else {
+      Transducer().read(input);
+    }
+  });
+}
 
-  for (int len = Compression::multibyte_read(input); len > 0; len--) {
-    UString name = Compression::string_read(input);
-    trans[name].read(input, alpha);
-  }
+void
+readTransducerSet(FILE* input, std::set<UChar32>& letters,
+                  Alphabet& alpha,
+                  std::map<UString, TransExe>& trans,
+                  SectionFilter const& wanted)
+{
+  uint64_t features = readShared(input, letters, alpha);
+  readSections(input, features, wanted, [&](UString const& name, bool keep) {
+    if (keep) {
+      trans[name].read(input, alpha, TransExe::sectionFlags(name));
+    } else {
+      TransExe().read(input, alpha, TransExe::sectionFlags(name));
+    }
+  });
 }
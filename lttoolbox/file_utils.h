@@ -22,22 +22,46 @@
 #include <lttoolbox/trans_exe.h>
 
 #include <cstdio>
+#include <functional>
 
 UFILE* openOutTextFile(const std::string& fname);
 FILE* openOutBinFile(const std::string& fname);
 FILE* openInBinFile(const std::string& fname);
 
+/**
+ * Decides by name which sections of a transducer set get loaded;
+ * an empty filter loads all of them
+ */
+using SectionFilter = std::function<bool(UString const&)>;
+
+/**
+ * Write a set of transducers
+ * @param flat write them in the memory-mappable TDF_FLAT layout
+ * @param index precede the sections with a table of their offsets
+ *              (LTF_INDEX), so that readers can seek past the ones
+ *              they don't want
+ */
 void writeTransducerSet(FILE* output, UStringView letters,
                         Alphabet& alpha,
-                        std::map<UString, Transducer>& trans);
+                        std::map<UString, Transducer>& trans,
+                        bool flat = false, bool index = false);
 void writeTransducerSet(FILE* output, const std::set<UChar32>& letters,
                         Alphabet& alpha,
-                        std::map<UString, Transducer>& trans);
+                        std::map<UString, Transducer>& trans,
+                        bool flat = false, bool index = false);
+
+/**
+ * Read a set of transducers
+ * @param wanted the sections to load; the others are skipped, without
+ *               being decoded if the file has an index and is seekable
+ */
 void readTransducerSet(FILE* input, std::set<UChar32>& letters,
                        Alphabet& alpha,
-                       std::map<UString, Transducer>& trans);
+                       std::map<UString, Transducer>& trans,
+                       SectionFilter const& wanted = nullptr);
 void readTransducerSet(FILE* input, std::set<UChar32>& letters,
                        Alphabet& alpha,
-                       std::map<UString, TransExe>& trans);
+                       std::map<UString, TransExe>& trans,
+                       SectionFilter const& wanted = nullptr);
 
 #endif // __FILE_UTILS_H__
@@ -15,6 +15,7 @@
  * along with this program; if not, see <https://www.gnu.org/licenses/>.
  */
 #include <lttoolbox/fst_processor.h>
+#include <lttoolbox/binary_stream.h>
 #include <lttoolbox/compression.h>
 #include <lttoolbox/exception.h>
 #include <lttoolbox/xml_parse_util.h>
@@ -26,6 +27,13 @@
 #include <iostream>
 #include <cerrno>
 #include <climits>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utf8.h>
 
 
 FSTProcessor::FSTProcessor()
@@ -56,11 +64,11 @@ FSTProcessor::streamError()
 }
 
 void
-FSTProcessor::maybeFlush(UFILE* output, bool at_null)
+FSTProcessor::maybeFlush(OutputFile& output, bool at_null)
 {
   if (at_null) {
-    u_fputc('\0', output);
-    u_fflush(output);
+    output.put('\0');
+    output.flush();
   }
 }
 
@@ -86,6 +94,7 @@ FSTProcessor::parseICX(std::string const &file)
     {
       useIgnoredChars = false;
     }
+    clearCaches();
   }
 }
 
@@ -106,6 +115,7 @@ FSTProcessor::parseRCX(std::string const &file)
       procNodeRCX();
       ret = xmlTextReaderRead(reader);
     }
+    clearCaches();
   }
 }
 
@@ -194,12 +204,12 @@ FSTProcessor::readAnalysis(InputFile& input)
     val = 0;
   }
 
-  while ((useIgnoredChars || useDefaultIgnoredChars) && ignored_chars.find(val) != ignored_chars.end())
+  while ((useIgnoredChars || useDefaultIgnoredChars) && (charInfo(val).classes & CC_IGNORED))
   {
     val = input.get();
   }
 
-  if(escaped_chars.find(val) != escaped_chars.end())
+  if(isEscaped(val))
   {
     switch(val)
     {
@@ -257,7 +267,7 @@ FSTProcessor::readTMAnalysis(InputFile& input)
     return 0;
   }
 
-  if(escaped_chars.find(val) != escaped_chars.end() || u_isdigit(val))
+  if(isEscaped(val) || u_isdigit(val))
   {
     switch(val)
     {
@@ -410,11 +420,11 @@ FSTProcessor::readTransliterationWord(InputFile& input)
 }
 
 void
-FSTProcessor::flushBlanks(UFILE *output)
+FSTProcessor::flushBlanks(OutputFile& output)
 {
   for(size_t i = blankqueue.size(); i > 0; i--)
   {
-    write(blankqueue.front(), output);
+    output.write(blankqueue.front());
     blankqueue.pop();
   }
 }
@@ -422,11 +432,13 @@ FSTProcessor::flushBlanks(UFILE *output)
 void
 FSTProcessor::calcInitial()
 {
+  std::vector<Node const *> initials;
   for(auto& it : transducers) {
-    root.addTransition(0, 0, it.second.getInitial(), default_weight);
+    initials.push_back(it.second.getInitial());
   }
 
-  initial_state.init(&root);
+  initial_state.init(initials);
+  clearCaches();
 }
 
 void
@@ -471,34 +483,55 @@ FSTProcessor::filterFinals(const State& state, UStringView casefrom)
     uppercase = (casefrom.size() > 1 &&
                  firstupper && u_isupper(casefrom[casefrom.size()-1]));
   }
+  if(collect_stats)
+  {
+    stats.filter_finals++;
+  }
   return state.filterFinals(all_finals, alphabet, escaped_chars,
                             displayWeightsMode, maxAnalyses, maxWeightClasses,
                             uppercase, firstupper, 0);
 }
 
+UString
+FSTProcessor::filterFinalsCached(const State& state, UString const &sf)
+{
+  // A surface form without tags spells out the input symbols exactly,
+  // and so determines the state reached. With tags "<n>" could come
+  // from either a tag or three characters, so those are not cached.
+  if (!analysis_cache.enabled() || sf.find('<') != UString::npos) {
+    return filterFinals(state, sf);
+  }
+  if (auto hit = analysis_cache.find(sf)) {
+    return *hit;
+  }
+  UString lf = filterFinals(state, sf);
+  analysis_cache.insert(sf, lf);
+  return lf;
+}
+
 void
-FSTProcessor::writeEscaped(UStringView str, UFILE *output)
+FSTProcessor::writeEscaped(UStringView str, OutputFile& output)
 {
   for(unsigned int i = 0, limit = str.size(); i < limit; i++)
   {
-    if(escaped_chars.find(str[i]) != escaped_chars.end())
+    if(isEscaped(str[i]))
     {
-      u_fputc('\\', output);
+      output.put('\\');
     }
-    u_fputc(str[i], output);
+    output.put(str[i]);
   }
 }
 
 size_t
-FSTProcessor::writeEscapedPopBlanks(UStringView str, UFILE *output)
+FSTProcessor::writeEscapedPopBlanks(UStringView str, OutputFile& output)
 {
   size_t postpop = 0;
   for (unsigned int i = 0, limit = str.size(); i < limit; i++)
   {
-    if (escaped_chars.find(str[i]) != escaped_chars.end()) {
-      u_fputc('\\', output);
+    if (isEscaped(str[i])) {
+      output.put('\\');
     }
-    u_fputc(str[i], output);
+    output.put(str[i]);
     if (str[i] == ' ') {
       if (blankqueue.front() == " "_u) {
         blankqueue.pop();
@@ -511,57 +544,70 @@ FSTProcessor::writeEscapedPopBlanks(UStringView str, UFILE *output)
 }
 
 void
-FSTProcessor::writeEscapedWithTags(UStringView str, UFILE *output)
+FSTProcessor::writeEscapedWithTags(UStringView str, OutputFile& output)
 {
   for(unsigned int i = 0, limit = str.size(); i < limit; i++)
   {
     if(str[i] == '<' && i >=1 && str[i-1] != '\\')
     {
-      write(str.substr(i), output);
+      output.write(str.substr(i));
       return;
     }
 
-    if(escaped_chars.find(str[i]) != escaped_chars.end())
+    if(isEscaped(str[i]))
     {
-      u_fputc('\\', output);
+      output.put('\\');
     }
-    u_fputc(str[i], output);
+    output.put(str[i]);
   }
 }
 
 
 
 void
-FSTProcessor::printWord(UStringView sf, UStringView lf, UFILE *output)
+FSTProcessor::printWord(UStringView sf, UStringView lf, OutputFile& output)
 {
-  u_fputc('^', output);
+  if(collect_stats)
+  {
+    statsToken(true);
+  }
+  output.put('^');
   writeEscaped(sf, output);
-  write(lf, output);
-  u_fputc('$', output);
+  output.write(lf);
+  output.put('$');
 }
 
 void
-FSTProcessor::printWordPopBlank(UStringView sf, UStringView lf, UFILE *output)
+FSTProcessor::printWordPopBlank(UStringView sf, UStringView lf, OutputFile& output)
 {
-  u_fputc('^', output);
+  if(collect_stats)
+  {
+    statsToken(true);
+  }
+  output.put('^');
   size_t postpop = writeEscapedPopBlanks(sf, output);
-  u_fprintf(output, "%.*S$", lf.size(), lf.data());
+  output.write(lf);
+  output.put('$');
   while (postpop-- && blankqueue.size() > 0)
   {
-    write(blankqueue.front(), output);
+    output.write(blankqueue.front());
     blankqueue.pop();
   }
 }
 
 void
-FSTProcessor::printUnknownWord(UStringView sf, UFILE *output)
+FSTProcessor::printUnknownWord(UStringView sf, OutputFile& output)
 {
-  u_fputc('^', output);
+  if(collect_stats)
+  {
+    statsToken(false);
+  }
+  output.put('^');
   writeEscaped(sf, output);
-  u_fputc('/', output);
-  u_fputc('*', output);
+  output.put('/');
+  output.put('*');
   writeEscaped(sf, output);
-  u_fputc('$', output);
+  output.put('$');
 }
 
 unsigned int
@@ -579,7 +625,7 @@ FSTProcessor::lastBlank(UStringView str)
 }
 
 void
-FSTProcessor::printSpace(UChar32 val, UFILE *output)
+FSTProcessor::printSpace(UChar32 val, OutputFile& output)
 {
   if(blankqueue.size() > 0)
   {
@@ -587,26 +633,26 @@ FSTProcessor::printSpace(UChar32 val, UFILE *output)
   }
   else
   {
-    u_fputc(val, output);
+    output.put(val);
   }
 }
 
 void
-FSTProcessor::printChar(UChar32 val, UFILE* output)
+FSTProcessor::printChar(UChar32 val, OutputFile& output)
 {
   if (u_isspace(val)) {
     if (blankqueue.size() > 0) {
-      write(blankqueue.front(), output);
+      output.write(blankqueue.front());
       blankqueue.pop();
     } else {
-      u_fputc(val, output);
+      output.put(val);
     }
   } else {
     if (isEscaped(val)) {
-      u_fputc('\\', output);
+      output.put('\\');
     }
     if (val) {
-      u_fputc(val, output);
+      output.put(val);
     }
   }
 }
@@ -614,19 +660,49 @@ FSTProcessor::printChar(UChar32 val, UFILE* output)
 bool
 FSTProcessor::isEscaped(UChar32 c) const
 {
-  return escaped_chars.find(c) != escaped_chars.end();
+  return charInfo(c).classes & CC_ESCAPED;
 }
 
 bool
 FSTProcessor::isAlphabetic(UChar32 c) const
 {
-  return u_isalnum(c) || alphabetic_chars.find(c) != alphabetic_chars.end();
+  return charInfo(c).classes & CC_ALPHABETIC;
+}
+
+void
+FSTProcessor::buildCharBlock(size_t block) const
+{
+  auto infos = std::make_shared<CharBlock>();
+  UChar32 first = static_cast<UChar32>(block << 8);
+  for (UChar32 i = 0; i < 256; i++) {
+    UChar32 c = first + i;
+    uint8_t classes = 0;
+    if (u_isalnum(c) || alphabetic_chars.find(c) != alphabetic_chars.end()) {
+      classes |= CC_ALPHABETIC;
+    }
+    if (escaped_chars.find(c) != escaped_chars.end()) {
+      classes |= CC_ESCAPED;
+    }
+    if (ignored_chars.find(c) != ignored_chars.end()) {
+      classes |= CC_IGNORED;
+    }
+    if (u_isupper(c)) {
+      classes |= CC_UPPER;
+    }
+    if (rcx_map.find(c) != rcx_map.end()) {
+      classes |= CC_RESTORE;
+    }
+    (*infos)[i] = {u_tolower(c), classes};
+  }
+  char_blocks[block] = infos;
 }
 
 void
 FSTProcessor::load(FILE *input)
 {
+  ProcessorStats::Timer timer(getStats(), "load");
   readTransducerSet(input, alphabetic_chars, alphabet, transducers);
+  clearCaches();
   alphabet.includeSymbol("<ANY_CHAR>"_u);
   any_char = alphabet("<ANY_CHAR>"_u);
 }
@@ -683,12 +759,20 @@ FSTProcessor::compoundAnalysis(UString input_word)
   const int MAX_COMBINATIONS = 32767;
 
   State current_state = initial_state;
+  if(collect_stats)
+  {
+    stats.compound_attempts++;
+  }
 
   for(unsigned int i=0; i<input_word.size(); i++)
   {
     UChar val=input_word[i];
 
     current_state.step_case(val, beCaseSensitive(current_state));
+    if(collect_stats)
+    {
+      stats.step(current_state.size());
+    }
 
     if(current_state.size() > MAX_COMBINATIONS)
     {
@@ -729,6 +813,9 @@ FSTProcessor::compoundAnalysisOrLowering(UString input_cased) {
   State current_state = initial_state;
   for(unsigned int i=0; i<input_lowered.size(); i++) {
     current_state.step_case(input_lowered[i], beCaseSensitive(current_state));
+    if(collect_stats) {
+      stats.step(current_state.size());
+    }
     if(current_state.size()==0) {
       break;
     }
@@ -793,7 +880,7 @@ FSTProcessor::initDecomposition()
 }
 
 void
-FSTProcessor::analysis(InputFile& input, UFILE *output)
+FSTProcessor::analysis(InputFile& input, OutputFile& output)
 {
   if(getNullFlush())
   {
@@ -818,37 +905,37 @@ FSTProcessor::analysis(InputFile& input, UFILE *output)
   {
     val = readAnalysis(input);
     // test for final states
-    if(current_state.isFinal(all_finals))
+    if(current_state.isFinal(Node::final_flag))
     {
-      if(current_state.isFinal(inconditional))
+      if(current_state.isFinal(Node::final_flag | Node::inconditional_flag))
       {
         if(do_decomposition && compoundOnlyLSymbol != 0)
         {
           current_state.pruneStatesWithForbiddenSymbol(compoundOnlyLSymbol);
         }
-        lf = filterFinals(current_state, sf);
+        lf = filterFinalsCached(current_state, sf);
         last_incond = true;
         last = input_buffer.getPos();
         last_size = sf.size();
       }
-      else if(current_state.isFinal(postblank))
+      else if(current_state.isFinal(Node::final_flag | Node::postblank_flag))
       {
         if(do_decomposition && compoundOnlyLSymbol != 0)
         {
           current_state.pruneStatesWithForbiddenSymbol(compoundOnlyLSymbol);
         }
-        lf = filterFinals(current_state, sf);
+        lf = filterFinalsCached(current_state, sf);
         last_postblank = true;
         last = input_buffer.getPos();
         last_size = sf.size();
       }
-      else if(current_state.isFinal(preblank))
+      else if(current_state.isFinal(Node::final_flag | Node::preblank_flag))
       {
         if(do_decomposition && compoundOnlyLSymbol != 0)
         {
           current_state.pruneStatesWithForbiddenSymbol(compoundOnlyLSymbol);
         }
-        lf = filterFinals(current_state, sf);
+        lf = filterFinalsCached(current_state, sf);
         last_preblank = true;
         last = input_buffer.getPos();
         last_size = sf.size();
@@ -859,7 +946,7 @@ FSTProcessor::analysis(InputFile& input, UFILE *output)
         {
           current_state.pruneStatesWithForbiddenSymbol(compoundOnlyLSymbol);
         }
-        lf = filterFinals(current_state, sf);
+        lf = filterFinalsCached(current_state, sf);
         last_postblank = false;
         last_preblank = false;
         last_incond = false;
@@ -885,24 +972,25 @@ FSTProcessor::analysis(InputFile& input, UFILE *output)
       last_size = sf.size();
     }
 
-    if(useRestoreChars && rcx_map.find(val) != rcx_map.end())
+    CharInfo info = charInfo(val);
+    if(useRestoreChars && (info.classes & CC_RESTORE))
     {
       rcx_map_ptr = rcx_map.find(val);
       std::set<int> tmpset = rcx_map_ptr->second;
-      if(!u_isupper(val) || beCaseSensitive(current_state))
+      if(!(info.classes & CC_UPPER) || beCaseSensitive(current_state))
       {
         current_state.step(val, tmpset);
       }
-      else if(rcx_map.find(u_tolower(val)) != rcx_map.end())
+      else if(charInfo(info.lower).classes & CC_RESTORE)
       {
-        rcx_map_ptr = rcx_map.find(tolower(val));
-        tmpset.insert(tolower(val));
+        rcx_map_ptr = rcx_map.find(info.lower);
+        tmpset.insert(info.lower);
         tmpset.insert(rcx_map_ptr->second.begin(), rcx_map_ptr->second.end());
         current_state.step(val, tmpset);
       }
       else
       {
-        tmpset.insert(tolower(val));
+        tmpset.insert(info.lower);
         current_state.step(val, tmpset);
       }
     }
@@ -910,6 +998,11 @@ FSTProcessor::analysis(InputFile& input, UFILE *output)
     {
        	    current_state.step_case(val, beCaseSensitive(current_state));
     }
+    pruneToBest(current_state);
+    if(collect_stats)
+    {
+      stats.step(current_state.size());
+    }
 
     if(current_state.size() != 0)
     {
@@ -956,13 +1049,13 @@ FSTProcessor::analysis(InputFile& input, UFILE *output)
       {
         printWordPopBlank(sf.substr(0, last_size),
                           lf, output);
-        u_fputc(' ', output);
+        output.put(' ');
         input_buffer.setPos(last);
         input_buffer.back(1);
       }
       else if(last_preblank)
       {
-        u_fputc(' ', output);
+        output.put(' ');
         printWordPopBlank(sf.substr(0, last_size),
                           lf, output);
         input_buffer.setPos(last);
@@ -1044,6 +1137,10 @@ FSTProcessor::analysis(InputFile& input, UFILE *output)
         }
       }
 
+      if(collect_stats)
+      {
+        statsBoundary(current_state);
+      }
       current_state = initial_state;
       lf.clear();
       sf.clear();
@@ -1060,14 +1157,14 @@ FSTProcessor::analysis(InputFile& input, UFILE *output)
 }
 
 void
-FSTProcessor::analysis_wrapper_null_flush(InputFile& input, UFILE *output)
+FSTProcessor::analysis_wrapper_null_flush(InputFile& input, OutputFile& output)
 {
   setNullFlush(false);
   while(!input.eof())
   {
     analysis(input, output);
-    u_fputc('\0', output);
-    u_fflush(output);
+    output.put('\0');
+    output.flush();
     // analysis() doesn't always leave input_buffer empty
     // which results in repeatedly analyzing the same string
     // so clear it here
@@ -1076,7 +1173,308 @@ FSTProcessor::analysis_wrapper_null_flush(InputFile& input, UFILE *output)
 }
 
 void
-FSTProcessor::generation_wrapper_null_flush(InputFile& input, UFILE *output,
+FSTProcessor::resetStream()
+{
+  while (!input_buffer.isEmpty()) input_buffer.next();
+  blankqueue = std::queue<UString>();
+  wblankqueue.clear();
+  transliteration_queue.clear();
+  outOfWord = false;
+}
+
+#if HAVE_DECL_FMEMOPEN
+namespace {
+
+struct AnalysisChunk
+{
+  std::string text;
+  std::string result;
+  bool flush = false;
+  bool done = false;
+  std::exception_ptr error;
+};
+
+void
+analyseChunk(FSTProcessor& fstp, AnalysisChunk& chunk)
+{
+  if (chunk.text.empty()) {
+    return;
+  }
+  OutputFile out;
+  out.open_in_memory();
+  InputFile in;
+  in.open_in_memory(chunk.text.data(), chunk.text.size());
+  // whatever was written before an error still goes out, as it
+  // would have without threads
+  try {
+    fstp.analysis(in, out);
+  } catch (...) {
+    chunk.error = std::current_exception();
+  }
+  chunk.result = out.str();
+}
+
+}
+#endif
+
+void
+FSTProcessor::parallelAnalysis(InputFile& input, OutputFile& output, size_t threads)
+{
+#if HAVE_DECL_FMEMOPEN
+  if (threads < 2) {
+    analysis(input, output);
+    return;
+  }
+
+  // Pieces smaller than this are not worth a trip through the queue,
+  // so blank lines only end a chunk once it has grown past it.
+  // Null-flush points always do, since the caller waits for them.
+  constexpr size_t min_chunk = 1 << 16;
+  size_t const max_in_flight = 4 * threads;
+
+  std::mutex mtx;
+  std::condition_variable work_cv, done_cv, space_cv;
+  std::deque<std::unique_ptr<AnalysisChunk>> in_flight;
+  std::deque<AnalysisChunk*> todo;
+  bool reading = true;
+  bool failed = false;
+  std::exception_ptr failure;
+  // the workers' counts, which can't go straight into stats while
+  // other workers may still be copying *this
+  ProcessorStats worker_stats;
+
+  bool nullFlush = getNullFlush();
+  setNullFlush(false);  // as analysis_wrapper_null_flush() does
+
+  // the workers' copies are made here, before any thread runs, and
+  // their cache counts only come back once they have all been joined
+  std::vector<std::unique_ptr<FSTProcessor>> copies;
+  for (size_t i = 0; i < threads; i++) {
+    copies.push_back(std::make_unique<FSTProcessor>(*this));
+    FSTProcessor& fstp = *copies.back();
+    fstp.analysis_cache.hits = fstp.analysis_cache.misses = 0;
+    fstp.stats = ProcessorStats();
+    fstp.stats.reporting = false;
+  }
+
+  auto worker = [&](FSTProcessor& fstp) {
+    std::unique_lock<std::mutex> lock(mtx);
+    while (true) {
+      work_cv.wait(lock, [&]{ return !todo.empty() || !reading; });
+      if (todo.empty()) {
+        return;
+      }
+      AnalysisChunk* chunk = todo.front();
+      todo.pop_front();
+      lock.unlock();
+      try {
+        analyseChunk(fstp, *chunk);
+      } catch (...) {
+        chunk->error = std::current_exception();
+      }
+      fstp.resetStream();
+      lock.lock();
+      if (collect_stats) {
+        // hand the counts over chunk by chunk, so that a report asked
+        // for in the middle of the input is up to date
+        worker_stats.merge(fstp.stats);
+        fstp.stats = ProcessorStats();
+        fstp.stats.reporting = false;
+      }
+      chunk->done = true;
+      done_cv.notify_all();
+    }
+  };
+
+  auto writer = [&]() {
+    std::unique_lock<std::mutex> lock(mtx);
+    while (true) {
+      done_cv.wait(lock, [&]{
+        return (!in_flight.empty() && in_flight.front()->done) ||
+               (in_flight.empty() && !reading);
+      });
+      if (in_flight.empty()) {
+        break;
+      }
+      std::unique_ptr<AnalysisChunk> chunk = std::move(in_flight.front());
+      in_flight.pop_front();
+      space_cv.notify_all();
+      if (chunk->error && !failed) {
+        // keep going until every chunk is back from the workers, but
+        // stop taking input and drop everything after the failure
+        failure = chunk->error;
+        failed = true;
+        for (auto c : todo) {
+          c->done = true;
+        }
+        todo.clear();
+      }
+      else if (failed) {
+        continue;
+      }
+      lock.unlock();
+      output.write(chunk->result.data(), chunk->result.size());
+      if (chunk->flush && !chunk->error) {
+        output.put('\0');
+        output.flush();
+      }
+      lock.lock();
+    }
+    output.flush();
+  };
+
+  output.flush();
+  std::vector<std::thread> pool;
+  for (auto& fstp : copies) {
+    pool.emplace_back(worker, std::ref(*fstp));
+  }
+  std::thread writer_thread(writer);
+
+  UString text;
+  auto submit = [&](bool flush) {
+    auto chunk = std::make_unique<AnalysisChunk>();
+    utf8::utf16to8(text.begin(), text.end(), std::back_inserter(chunk->text));
+    chunk->flush = flush;
+    text.clear();
+    std::unique_lock<std::mutex> lock(mtx);
+    if (collect_stats && ProcessorStats::takeReportRequest()) {
+      ProcessorStats sum = stats;
+      sum.merge(worker_stats);
+      sum.report();
+    }
+    space_cv.wait(lock, [&]{ return in_flight.size() < max_in_flight || failed; });
+    if (failed) {
+      return false;
+    }
+    todo.push_back(chunk.get());
+    in_flight.push_back(std::move(chunk));
+    work_cv.notify_one();
+    return true;
+  };
+
+  // A chunk may only end where analysis() is sure to be between words
+  // with nothing pending: outside [superblanks], [[wordbound blanks]]
+  // and <tags>, and not right after a backslash.
+  enum { TEXT, BLOCK, WBLOCK, TAG } where = TEXT;
+  bool escaped = false;
+  int newlines = 0;
+  bool ok = true;
+  // a read error must not leave the threads running; what was read
+  // before it is still analysed, as analysis() would have done
+  std::exception_ptr read_error;
+  try {
+    while (ok) {
+      UChar32 val = input.get();
+      if (input.eof()) {
+        break;
+      } else if (val == U_EOF) {
+        val = 0;
+      }
+      if (val == '\0' && where != TEXT) {
+        // readBlock() and finishWBlank() swallow a NUL and just end
+        // the block there
+        where = TEXT;
+        text += val;
+        newlines = 0;
+        continue;
+      } else if (val == '\0') {
+        if (!nullFlush) {
+          break;
+        }
+        ok = submit(true);
+        where = TEXT;
+        escaped = false;
+        newlines = 0;
+        continue;
+      }
+      text += val;
+      if (escaped) {
+        escaped = false;
+        newlines = 0;
+        continue;
+      }
+      if (val == '\\') {
+        escaped = true;
+        newlines = 0;
+        continue;
+      }
+      switch (where) {
+        case TEXT:
+          if (val == '\n') {
+            if (++newlines >= 2 && text.size() >= min_chunk) {
+              ok = submit(false);
+              newlines = 0;
+            }
+            continue;
+          } else if (val == '[') {
+            where = (input.peek() == '[') ? WBLOCK : BLOCK;
+          } else if (val == '<') {
+            where = TAG;
+          }
+          break;
+        case BLOCK:
+          if (val == ']') where = TEXT;
+          break;
+        case WBLOCK:
+          if (val == ']' && input.peek() == ']') {
+            text += input.get();
+            where = TEXT;
+          }
+          break;
+        case TAG:
+          if (val == '>') where = TEXT;
+          break;
+      }
+      newlines = 0;
+    }
+  } catch (...) {
+    read_error = std::current_exception();
+  }
+  try {
+    if (read_error) {
+      if (ok && !text.empty()) {
+        submit(false);
+      }
+    }
+    // analysis_wrapper_null_flush() always finishes with one last
+    // (possibly empty) flushed piece
+    else if (ok && (nullFlush || !text.empty())) {
+      submit(nullFlush);
+    }
+  } catch (...) {
+    if (!read_error) {
+      read_error = std::current_exception();
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    reading = false;
+  }
+  work_cv.notify_all();
+  done_cv.notify_all();
+  for (auto& t : pool) {
+    t.join();
+  }
+  writer_thread.join();
+  stats.merge(worker_stats);
+  for (auto& fstp : copies) {
+    analysis_cache.hits += fstp->analysis_cache.hits;
+    analysis_cache.misses += fstp->analysis_cache.misses;
+  }
+  if (failure) {
+    std::rethrow_exception(failure);
+  }
+  if (read_error) {
+    std::rethrow_exception(read_error);
+  }
+#else
+  analysis(input, output);
+#endif
+}
+
+void
+FSTProcessor::generation_wrapper_null_flush(InputFile& input, OutputFile& output,
                                             GenerationMode mode)
 {
   setNullFlush(false);
@@ -1085,13 +1483,13 @@ FSTProcessor::generation_wrapper_null_flush(InputFile& input, UFILE *output,
   while(!input.eof())
   {
     generation(input, output, mode);
-    u_fputc('\0', output);
-    u_fflush(output);
+    output.put('\0');
+    output.flush();
   }
 }
 
 void
-FSTProcessor::tm_wrapper_null_flush(InputFile& input, UFILE *output,
+FSTProcessor::tm_wrapper_null_flush(InputFile& input, OutputFile& output,
                                     TranslationMemoryMode tm_mode)
 {
   setNullFlush(false);
@@ -1100,14 +1498,14 @@ FSTProcessor::tm_wrapper_null_flush(InputFile& input, UFILE *output,
   while(!input.eof())
   {
     tm_analysis(input, output, tm_mode);
-    u_fputc('\0', output);
-    u_fflush(output);
+    output.put('\0');
+    output.flush();
   }
 }
 
 
 void
-FSTProcessor::tm_analysis(InputFile& input, UFILE *output, TranslationMemoryMode tm_mode)
+FSTProcessor::tm_analysis(InputFile& input, OutputFile& output, TranslationMemoryMode tm_mode)
 {
   if(getNullFlush())
   {
@@ -1122,7 +1520,7 @@ FSTProcessor::tm_analysis(InputFile& input, UFILE *output, TranslationMemoryMode
   while(int32_t val = readTMAnalysis(input))
   {
     // test for final states
-    if(current_state.isFinal(all_finals))
+    if(current_state.isFinal(Node::final_flag))
     {
       if(u_ispunct(val) || (tm_mode == tm_space && u_isspace(val)))
       {
@@ -1168,9 +1566,9 @@ FSTProcessor::tm_analysis(InputFile& input, UFILE *output, TranslationMemoryMode
         {
           if(isEscaped(val))
           {
-            u_fputc('\\', output);
+            output.put('\\');
           }
-          u_fputc(val, output);
+          output.put(val);
         }
       }
       else if(!u_isspace(val) && !u_ispunct(val) &&
@@ -1197,12 +1595,12 @@ FSTProcessor::tm_analysis(InputFile& input, UFILE *output, TranslationMemoryMode
 
         if(val == 0)
         {
-          write(sf, output);
+          output.write(sf);
           return;
         }
 
         input_buffer.back(1);
-        write(sf, output);
+        output.write(sf);
 
         while(blankqueue.size() > 0)
         {
@@ -1218,7 +1616,7 @@ FSTProcessor::tm_analysis(InputFile& input, UFILE *output, TranslationMemoryMode
         unsigned int size = sf.size();
         limit = (limit == static_cast<unsigned int>(UString::npos)?size:limit);
         input_buffer.back(1+(size-limit));
-        write(sf.substr(0, limit), output);
+        output.write(sf.substr(0, limit));
 */      }
       else if(lf.empty())
       {
@@ -1226,10 +1624,10 @@ FSTProcessor::tm_analysis(InputFile& input, UFILE *output, TranslationMemoryMode
         unsigned int size = sf.size();
         limit = (limit == static_cast<unsigned int >(UString::npos)?size:limit);
         input_buffer.back(1+(size-limit));
-        write(sf.substr(0, limit), output);
+        output.write(sf.substr(0, limit));
 */
         input_buffer.back(1);
-        write(sf, output);
+        output.write(sf);
 
         while(blankqueue.size() > 0)
         {
@@ -1243,7 +1641,9 @@ FSTProcessor::tm_analysis(InputFile& input, UFILE *output, TranslationMemoryMode
       }
       else
       {
-        u_fprintf(output, "[%S]", lf.c_str());
+        output.put('[');
+        output.write(lf);
+        output.put(']');
         input_buffer.setPos(last);
         input_buffer.back(1);
       }
@@ -1261,35 +1661,38 @@ FSTProcessor::tm_analysis(InputFile& input, UFILE *output, TranslationMemoryMode
 
 
 void
-FSTProcessor::generation(InputFile& input, UFILE *output, GenerationMode mode)
+FSTProcessor::generation(InputFile& input, OutputFile& output, GenerationMode mode)
 {
   StreamReader reader(&input);
   reader.alpha = &alphabet;
+  if (binaryInput) {
+    reader.setBinary();
+  }
   State current_state;
 
   while (!reader.at_eof) {
     reader.next();
-    write(reader.blank, output);
-    write(reader.wblank, output);
+    output.write(reader.blank);
+    output.write(reader.wblank);
     if (!reader.readings.empty()) {
       auto& rd = reader.readings[0];
       bool skip = false;
       switch (rd.mark) {
       case '=':
-        u_fputc('=', output);
+        output.put('=');
         break;
       case '*':
       case '%':
         skip = true;
         if (mode == gm_tagged_nm) {
-          u_fputc('^', output);
+          output.put('^');
           writeEscaped(removeTags(rd.content), output);
-          u_fputc('/', output);
-          u_fputc(rd.mark, output);
+          output.put('/');
+          output.put(rd.mark);
           writeEscapedWithTags(rd.content, output);
-          u_fputc('$', output);
+          output.put('$');
         } else {
-          if (mode != gm_clean) u_fputc(rd.mark, output);
+          if (mode != gm_clean) output.put(rd.mark);
           writeEscaped(rd.content, output);
         }
         break;
@@ -1297,24 +1700,24 @@ FSTProcessor::generation(InputFile& input, UFILE *output, GenerationMode mode)
         skip = true;
         switch (mode) {
         case gm_all:
-          u_fputc(rd.mark, output);
+          output.put(rd.mark);
           writeEscaped(rd.content, output);
           break;
         case gm_unknown:
         case gm_tagged:
-          u_fputc(rd.mark, output);
+          output.put(rd.mark);
           [[fallthrough]];
         case gm_bilgen:
         case gm_clean:
           writeEscaped(removeTags(rd.content), output);
           break;
         case gm_tagged_nm:
-          u_fputc('^', output);
+          output.put('^');
           writeEscaped(removeTags(rd.content), output);
-          u_fputc('/', output);
-          u_fputc(rd.mark, output);
+          output.put('/');
+          output.put(rd.mark);
           writeEscapedWithTags(rd.content, output);
-          u_fputc('$', output);
+          output.put('$');
           break;
         default:
           break;
@@ -1324,18 +1727,30 @@ FSTProcessor::generation(InputFile& input, UFILE *output, GenerationMode mode)
       if (!skip) {
         current_state = initial_state;
         for (auto& sym : reader.readings[0].symbols) {
-          if (!alphabet.isTag(sym) && u_isupper(sym) &&
-              !beCaseSensitive(current_state)) {
+          CharInfo info = charInfo(sym);
+          if ((info.classes & CC_UPPER) && !beCaseSensitive(current_state)) {
             if (mode == gm_carefulcase) {
-              current_state.step_careful(sym, u_tolower(sym));
+              current_state.step_careful(sym, info.lower);
             }
             else {
-              current_state.step(sym, u_tolower(sym));
+              current_state.step(sym, info.lower);
             }
           }
           else current_state.step(sym);
+          pruneToBest(current_state);
+          if (collect_stats) {
+            stats.step(current_state.size());
+          }
+        }
+        bool known = current_state.isFinal(Node::final_flag);
+        if (collect_stats) {
+          statsToken(known);
+          statsBoundary(current_state);
+          if (known) {
+            stats.filter_finals++;
+          }
         }
-        if (current_state.isFinal(all_finals)) {
+        if (known) {
           bool firstupper = false, uppercase = false;
           if (!dictionaryCase) {
             uppercase = rd.content.size() > 1 && u_isupper(rd.content[1]);
@@ -1343,68 +1758,68 @@ FSTProcessor::generation(InputFile& input, UFILE *output, GenerationMode mode)
           }
 
           if (mode == gm_tagged || mode == gm_tagged_nm) {
-            u_fputc('^', output);
+            output.put('^');
           }
 
-          write(current_state.filterFinals(all_finals, alphabet, escaped_chars,
-                                           displayWeightsMode, maxAnalyses,
-                                           maxWeightClasses,
-                                           uppercase, firstupper).substr(1), output);
+          output.write(current_state.filterFinals(all_finals, alphabet, escaped_chars,
+                                                  displayWeightsMode, maxAnalyses,
+                                                  maxWeightClasses,
+                                                  uppercase, firstupper).substr(1));
           if (mode == gm_tagged || mode == gm_tagged_nm) {
-            u_fputc('/', output);
+            output.put('/');
             writeEscapedWithTags(rd.content, output);
-            u_fputc('$', output);
+            output.put('$');
           }
         } else {
           switch (mode) {
           case gm_all:
-            u_fputc('#', output);
+            output.put('#');
             writeEscaped(rd.content, output);
             break;
           case gm_carefulcase:
           case gm_unknown:
           case gm_tagged:
-            if (!rd.content.empty()) u_fputc('#', output);
+            if (!rd.content.empty()) output.put('#');
             [[fallthrough]];
           case gm_bilgen:
           case gm_clean:
             writeEscaped(removeTags(rd.content), output);
             break;
           case gm_tagged_nm:
-            u_fputc('^', output);
+            output.put('^');
             writeEscaped(removeTags(rd.content), output);
-            u_fputc('/', output);
-            u_fputc('#', output);
+            output.put('/');
+            output.put('#');
             writeEscapedWithTags(rd.content, output);
-            u_fputc('$', output);
+            output.put('$');
             break;
           }
         }
       }
     }
     if (reader.at_null) {
-      u_fputc('\0', output);
-      u_fflush(output);
+      output.put('\0');
+      output.flush();
     }
   }
 }
 
 void
-FSTProcessor::postgeneration(InputFile& input, UFILE *output)
+FSTProcessor::postgeneration(InputFile& input, OutputFile& output)
 {
   transliteration_drop_tilde = true;
   transliteration(input, output);
 }
 
 void
-FSTProcessor::intergeneration(InputFile& input, UFILE *output)
+FSTProcessor::intergeneration(InputFile& input, OutputFile& output)
 {
   transliteration_drop_tilde = false;
   transliteration(input, output);
 }
 
 void
-FSTProcessor::transliteration(InputFile& input, UFILE *output)
+FSTProcessor::transliteration(InputFile& input, OutputFile& output)
 {
   size_t start_pos = 0;
   size_t cur_word = 0;
@@ -1429,14 +1844,14 @@ FSTProcessor::transliteration(InputFile& input, UFILE *output)
         if (input.eof()) {
           break;
         } else {
-          u_fputc(input.get(), output);
-          u_fflush(output);
+          output.put(input.get());
+          output.flush();
           continue;
         }
       }
     }
 
-    if (current_state.isFinal(all_finals)) {
+    if (current_state.isFinal(Node::final_flag)) {
       last_match = current_state.filterFinals(all_finals, alphabet,
                                               escaped_chars, displayWeightsMode,
                                               1, maxWeightClasses,
@@ -1538,10 +1953,10 @@ FSTProcessor::transliteration(InputFile& input, UFILE *output)
         cur_word = 0;
       }
       if (start_pos >= transliteration_queue.front().size()) {
-        write(blankqueue.front(), output);
+        output.write(blankqueue.front());
         blankqueue.pop();
         bool has_wblank = !wblankqueue.front().empty();
-        write(wblankqueue.front(), output);
+        output.write(wblankqueue.front());
         wblankqueue.pop_front();
         auto word = transliteration_queue.front();
         transliteration_queue.pop_front();
@@ -1569,13 +1984,13 @@ FSTProcessor::transliteration(InputFile& input, UFILE *output)
             alphabet.getSymbol(out, c);
           }
         }
-        write(out, output);
+        output.write(out);
         if (has_wblank) {
-          write(WBLANK_FINAL, output);
+          output.write(WBLANK_FINAL);
         }
         while (space_diff < 0) {
           if (blankqueue.front() != " "_u) {
-            write(blankqueue.front(), output);
+            output.write(blankqueue.front());
           }
           blankqueue.pop();
           space_diff++;
@@ -1595,18 +2010,48 @@ FSTProcessor::transliteration(InputFile& input, UFILE *output)
   }
 }
 
+namespace {
+
+// the number of a symbol from symbol_iter: a tag goes through the
+// alphabet, anything else is a single character, which may take a
+// surrogate pair
+int32_t
+symbolValue(Alphabet const &alphabet, UStringView symbol)
+{
+  if (symbol.size() > 1 && symbol[0] == '<') {
+    return alphabet(symbol);
+  }
+  UChar32 c;
+  size_t i = 0;
+  U16_NEXT(symbol.data(), i, symbol.size(), c);
+  return c;
+}
+
+}
+
 bool
 FSTProcessor::step_biltrans(UStringView word, std::vector<UString>& result, UString& queue)
 {
-  State current_state = initial_state;
+  State current_state;
+  return step_biltrans(word, current_state, result, queue);
+}
+
+bool
+FSTProcessor::step_biltrans(UStringView word, State& current_state,
+                            std::vector<UString>& result, UString& queue)
+{
+  current_state = initial_state;
+  if (word.empty()) {
+    return false;
+  }
   bool firstupper = u_isupper(word[0]);
-  bool uppercase = firstupper && u_isupper(word[1]);
+  bool uppercase = firstupper && word.size() > 1 && u_isupper(word[1]);
   for (auto symbol : symbol_iter(word)) {
-    int32_t val = (symbol.size() == 1 ? symbol[0] : alphabet(symbol));
+    int32_t val = symbolValue(alphabet, symbol);
     if (current_state.size() != 0) {
-      current_state.step(val, beCaseSensitive(current_state));
+      current_state.step_case(val, beCaseSensitive(current_state));
     }
-    if (current_state.isFinal(all_finals)) {
+    if (current_state.isFinal(Node::final_flag)) {
       current_state.filterFinalsArray(result,
                                       all_finals, alphabet,
                                       escaped_chars,
@@ -1668,8 +2113,25 @@ FSTProcessor::biltransfull(UStringView input_word, bool with_delim)
 UString
 FSTProcessor::biltrans(UStringView input_word, bool with_delim)
 {
-  State current_state = initial_state;
+  State current_state;
   std::vector<UString> result;
+  UString out;
+  biltransWith(input_word, current_state, result, out, with_delim);
+  return out;
+}
+
+void
+FSTProcessor::biltransWith(UStringView input_word, State& current_state,
+                           std::vector<UString>& result, UString& out,
+                           bool with_delim)
+{
+  result.clear();
+  // nothing to translate, and too short for the indices below
+  if(input_word.size() < (with_delim ? 2 : 1))
+  {
+    return;
+  }
+
   unsigned int start_point = 1;
   unsigned int end_point = input_word.size()-2;
   UString queue;
@@ -1683,7 +2145,8 @@ FSTProcessor::biltrans(UStringView input_word, bool with_delim)
 
   if(input_word[start_point] == '*')
   {
-    return US(input_word);
+    out += input_word;
+    return;
   }
 
   if(input_word[start_point] == '=')
@@ -1692,16 +2155,22 @@ FSTProcessor::biltrans(UStringView input_word, bool with_delim)
     mark = true;
   }
 
-  UStringView word = input_word.substr(start_point, end_point-start_point);
-  bool exists = step_biltrans(word, result, queue);
+  UStringView word = input_word.substr(start_point, end_point-start_point+1);
+  bool exists = step_biltrans(word, current_state, result, queue);
   if (!exists) {
-    if (with_delim) return "^@"_u + US(input_word.substr(1));
-    else return "@"_u + US(input_word);
+    if (with_delim) {
+      out += "^@"_u;
+      out += input_word.substr(1);
+    } else {
+      out += '@';
+      out += input_word;
+    }
+    return;
   }
 
   // attach unmatched queue automatically
 
-  return compose(result, queue, with_delim, mark);
+  compose(result, queue, with_delim, mark, out);
 }
 
 UString
@@ -1709,6 +2178,14 @@ FSTProcessor::compose(const std::vector<UString>& lexforms, UStringView queue,
                       bool delim, bool mark) const
 {
   UString result;
+  compose(lexforms, queue, delim, mark, result);
+  return result;
+}
+
+void
+FSTProcessor::compose(const std::vector<UString>& lexforms, UStringView queue,
+                      bool delim, bool mark, UString& result) const
+{
   if (delim) result += '^';
   if (mark) result += '=';
   bool first = true;
@@ -1719,145 +2196,206 @@ FSTProcessor::compose(const std::vector<UString>& lexforms, UStringView queue,
     result += queue;
   }
   if (delim) result += '$';
-  return result;
 }
 
-void
-FSTProcessor::bilingual(InputFile& input, UFILE *output, GenerationMode mode)
+UString
+FSTProcessor::biltransReading(StreamReader::Reading const &reading, GenerationMode mode)
 {
-  StreamReader reader(&input);
-  reader.alpha = &alphabet;
-  reader.add_unknowns = true;
-
-  size_t index = (biltransSurfaceForms || biltransSurfaceFormsKeep ? 1 : 0);
-
-  while (!reader.at_eof) {
-    reader.next();
+  auto& symbols = reading.symbols;
+  State current_state = initial_state;
 
-    write(reader.blank, output);
-    write(reader.wblank, output);
+  bool firstupper = (symbols[0] > 0 && u_isupper(symbols[0]));
+  bool uppercase = (firstupper && symbols.size() > 1 &&
+                    symbols[1] > 0 && u_isupper(symbols[1]));
 
-    if (biltransSurfaceFormsKeep && !reader.readings.empty()) {
-      u_fputc('^', output);
-      write(reader.readings[0].content, output);
-      u_fputc((reader.readings.size() > 1 ? '/' : '$'), output);
+  bool seenTags = false;
+  size_t queue_start = 0;
+  std::vector<UString> result;
+  if (reading.mark == '#') current_state.step('#');
+  for (size_t i = 0; i < symbols.size(); i++) {
+    seenTags = seenTags || alphabet.isTag(symbols[i]);
+    UString source;
+    alphabet.getSymbol(source, symbols[i]);
+    if(beCaseSensitive(current_state)) { // allow any_char
+      current_state.step_override(symbols[i], any_char, symbols[i]);
     }
-
-    if (index >= reader.readings.size()) {
-      maybeFlush(output, reader.at_null);
-      continue;
+    else {                    // include lower alt
+      current_state.step_override(symbols[i], u_tolower(symbols[i]), any_char, symbols[i]);
     }
-
-    if (!biltransSurfaceFormsKeep) u_fputc('^', output);
-
-    if (reader.readings[index].mark == '*') {
-      u_fputc('*', output);
-      write(reader.readings[index].content, output);
-      u_fputc('/', output);
-      if (mode != gm_clean) u_fputc('*', output);
-      write(reader.readings[index].content, output);
-      u_fputc('$', output);
-      maybeFlush(output, reader.at_null);
-      continue;
+    if (collect_stats) {
+      stats.step(current_state.size());
     }
-
-    auto& symbols = reader.readings[index].symbols;
-
-    if (symbols.empty()) {
-      u_fputc('$', output);
-      maybeFlush(output, reader.at_null);
-      continue;
+    if (current_state.isFinal(Node::final_flag)) {
+      if (collect_stats) {
+        stats.filter_finals++;
+      }
+      queue_start = i;
+      current_state.filterFinalsArray(result,
+                                      all_finals, alphabet, escaped_chars,
+                                      displayWeightsMode, maxAnalyses,
+                                      maxWeightClasses, uppercase,
+                                      firstupper, 0);
     }
+  }
+  // if there are no tags, we only return complete matches
+  if ((!seenTags || mode == gm_all || mode == gm_bilgen) && queue_start + 1 < symbols.size()) {
+    result.clear();
+  }
 
+  if(result.empty() && (mode == gm_bilgen || mode == gm_all)) {
+    // Retry looking up lower-cased version, this time not using alt-override (which leads to state explosions)
     State current_state = initial_state;
-
-    bool firstupper = (symbols[0] > 0 && u_isupper(symbols[0]));
-    bool uppercase = (firstupper && symbols.size() > 1 &&
-                      symbols[1] > 0 && u_isupper(symbols[1]));
-
+    if (reading.mark == '#') current_state.step('#');
     bool seenTags = false;
-    size_t queue_start = 0;
-    std::vector<UString> result;
-    if (reader.readings[index].mark == '#') current_state.step('#');
     for (size_t i = 0; i < symbols.size(); i++) {
       seenTags = seenTags || alphabet.isTag(symbols[i]);
-      UString source;
-      alphabet.getSymbol(source, symbols[i]);
-      if(beCaseSensitive(current_state)) { // allow any_char
+      if(alphabet.isTag(symbols[i]) || beCaseSensitive(current_state)) {
         current_state.step_override(symbols[i], any_char, symbols[i]);
       }
-      else {                    // include lower alt
-        current_state.step_override(symbols[i], u_tolower(symbols[i]), any_char, symbols[i]);
+      else {
+        int32_t symbol_low = u_tolower(symbols[i]);
+        current_state.step_override(symbol_low, any_char, symbol_low);
+      }
+      if (collect_stats) {
+        stats.step(current_state.size());
       }
-      if (current_state.isFinal(all_finals)) {
+      if (current_state.isFinal(Node::final_flag)) {
+        if (collect_stats) {
+          stats.filter_finals++;
+        }
         queue_start = i;
         current_state.filterFinalsArray(result,
                                         all_finals, alphabet, escaped_chars,
                                         displayWeightsMode, maxAnalyses,
-                                        maxWeightClasses, uppercase,
-                                        firstupper, 0);
+                                        maxWeightClasses);
       }
     }
     // if there are no tags, we only return complete matches
     if ((!seenTags || mode == gm_all || mode == gm_bilgen) && queue_start + 1 < symbols.size()) {
       result.clear();
     }
+  }
 
-    if(result.empty() && (mode == gm_bilgen || mode == gm_all)) {
-      // Retry looking up lower-cased version, this time not using alt-override (which leads to state explosions)
-      State current_state = initial_state;
-      if (reader.readings[index].mark == '#') current_state.step('#');
-      bool seenTags = false;
-      for (size_t i = 0; i < symbols.size(); i++) {
-        seenTags = seenTags || alphabet.isTag(symbols[i]);
-        if(alphabet.isTag(symbols[i]) || beCaseSensitive(current_state)) {
-          current_state.step_override(symbols[i], any_char, symbols[i]);
-        }
-        else {
-          int32_t symbol_low = u_tolower(symbols[i]);
-          current_state.step_override(symbol_low, any_char, symbol_low);
-        }
-        if (current_state.isFinal(all_finals)) {
-          queue_start = i;
-          current_state.filterFinalsArray(result,
-                                          all_finals, alphabet, escaped_chars,
-                                          displayWeightsMode, maxAnalyses,
-                                          maxWeightClasses);
-        }
-      }
-      // if there are no tags, we only return complete matches
-      if ((!seenTags || mode == gm_all || mode == gm_bilgen) && queue_start + 1 < symbols.size()) {
-        result.clear();
-      }
-    }
+  UString source;
+  size_t queue_pos = 0;
+  if (reading.mark == '#') {
+    source += '#';
+    queue_pos = 1;
+  }
+  for (size_t i = 0; i < symbols.size(); i++) {
+    if (isEscaped(symbols[i]) || (i == 0 && symbols[i] == '*')) source += '\\';
+    alphabet.getSymbol(source, symbols[i]);
+    if (i == queue_start) queue_pos = source.size();
+  }
 
-    UString source;
-    size_t queue_pos = 0;
-    if (reader.readings[index].mark == '#') {
-      source += '#';
-      queue_pos = 1;
+  if (collect_stats) {
+    statsToken(!result.empty());
+    statsBoundary(current_state);
+  }
+
+  UString unit = source;
+  unit += '/';
+  if (!result.empty()) {
+    unit += compose(result, source.substr(queue_pos));
+  } else {
+    unit += (mode == gm_all ? '#' : '@');
+    unit += source;
+  }
+  return unit;
+}
+
+void
+FSTProcessor::bilingual(InputFile& input, OutputFile& output, GenerationMode mode)
+{
+  StreamReader reader(&input);
+  reader.alpha = &alphabet;
+  reader.add_unknowns = true;
+  if (binaryInput) {
+    reader.setBinary();
+  }
+  BinaryStreamWriter writer(&output);
+  if (binaryOutput) {
+    writer.finish();
+  }
+
+  size_t index = (biltransSurfaceForms || biltransSurfaceFormsKeep ? 1 : 0);
+
+  // the lexical unit being written, without the ^ and $
+  UString lu;
+  auto put = [&]() {
+    if (binaryOutput) {
+      writer.unit(lu);
+    } else {
+      output.put('^');
+      output.write(lu);
+      output.put('$');
     }
-    for (size_t i = 0; i < symbols.size(); i++) {
-      if (isEscaped(symbols[i]) || (i == 0 && symbols[i] == '*')) source += '\\';
-      alphabet.getSymbol(source, symbols[i]);
-      if (i == queue_start) queue_pos = source.size();
+  };
+  auto flush = [&]() {
+    if (!binaryOutput) {
+      maybeFlush(output, reader.at_null);
+    } else if (reader.at_null) {
+      writer.null();
     }
+  };
 
-    write(source, output);
-    u_fputc('/', output);
+  while (!reader.at_eof) {
+    reader.next();
 
-    if (!result.empty()) {
-      write(compose(result, source.substr(queue_pos)), output);
+    if (binaryOutput) {
+      writer.blank(reader.blank);
+      writer.wblank(reader.wblank);
     } else {
-      u_fputc((mode == gm_all ? '#' : '@'), output);
-      write(source, output);
+      output.write(reader.blank);
+      output.write(reader.wblank);
     }
-    u_fputc('$', output);
 
-    if (reader.at_null) {
-      u_fputc('\0', output);
-      u_fflush(output);
+    lu.clear();
+    if (biltransSurfaceFormsKeep && !reader.readings.empty()) {
+      lu += reader.readings[0].content;
+      if (reader.readings.size() > 1) {
+        lu += '/';
+      }
+    }
+
+    if (index >= reader.readings.size()) {
+      if (biltransSurfaceFormsKeep && !reader.readings.empty()) {
+        put();
+      }
+      flush();
+      continue;
+    }
+
+    if (reader.readings[index].mark == '*') {
+      lu += '*';
+      lu += reader.readings[index].content;
+      lu += '/';
+      if (mode != gm_clean) lu += '*';
+      lu += reader.readings[index].content;
+      put();
+      flush();
+      continue;
     }
+
+    auto& symbols = reader.readings[index].symbols;
+
+    if (!symbols.empty()) {
+      if (biltrans_cache.enabled()) {
+        std::u32string key(1, reader.readings[index].mark);
+        key.append(symbols.begin(), symbols.end());
+        if (auto hit = biltrans_cache.find(key)) {
+          lu += *hit;
+        } else {
+          UString unit = biltransReading(reader.readings[index], mode);
+          biltrans_cache.insert(key, unit);
+          lu += unit;
+        }
+      } else {
+        lu += biltransReading(reader.readings[index], mode);
+      }
+    }
+    put();
+    flush();
   }
 }
 
@@ -1906,7 +2444,7 @@ FSTProcessor::biltransWithQueue(UStringView input_word, bool with_delim)
     {
       current_state.step_case(val, beCaseSensitive(current_state));
     }
-    if(current_state.isFinal(all_finals))
+    if(current_state.isFinal(Node::final_flag))
     {
       current_state.filterFinalsArray(result, all_finals, alphabet,
                                       escaped_chars,
@@ -1995,7 +2533,7 @@ FSTProcessor::biltransWithoutQueue(UStringView input_word, bool with_delim)
 }
 
 void
-FSTProcessor::quoteMerge(InputFile& input, UFILE *output)
+FSTProcessor::quoteMerge(InputFile& input, OutputFile& output)
 {
   StreamReader reader(&input);
   reader.alpha = &alphabet;
@@ -2025,8 +2563,8 @@ FSTProcessor::quoteMerge(InputFile& input, UFILE *output)
       }
       else {
         // The initial blank should just be output before the merged LU:
-        write(reader.blank, output);
-        write(reader.wblank, output);
+        output.write(reader.blank);
+        output.write(reader.wblank);
       }
       if(reader.readings.size() > 0) {
         // Drop possible unknown marks.
@@ -2035,38 +2573,38 @@ FSTProcessor::quoteMerge(InputFile& input, UFILE *output)
       }
     }
     else {
-      write(reader.blank, output);
-      write(reader.wblank, output);
+      output.write(reader.blank);
+      output.write(reader.wblank);
       if(reader.readings.size() > 0) {
         // NB. ^$ will produce a readings vector of length 1 where the single item is empty. EOF should give length 0.
         // (We *want* to keep ^$ in stream, but not print extra ^$ when there was no ^$)
-        u_fputc('^', output);
+        output.put('^');
         bool seen_reading = false;
         for (StreamReader::Reading &it : reader.readings) {
           if (seen_reading) {
-            u_fputc('/', output);
+            output.put('/');
           }
-          if(it.mark != '\0') { u_fputc(it.mark, output); }
-          write(it.content, output);
+          if(it.mark != '\0') { output.put(it.mark); }
+          output.write(it.content);
           seen_reading = true;
         }
-        u_fputc('$', output);
+        output.put('$');
       }
     }
     if(end_merging || reader.at_null) {
       if (merging) {
-        u_fputc('^', output);
-        write(surface, output);
-        u_fputc('/', output);
-        write(surface, output);
-        write("<MERGED>$"_u, output);
+        output.put('^');
+        output.write(surface);
+        output.put('/');
+        output.write(surface);
+        output.write("<MERGED>$"_u);
         merging = false;
       }
       end_merging = false;
       surface.clear();
       if(reader.at_null) {
-        u_fputc('\0', output);
-        u_fflush(output);
+        output.put('\0');
+        output.flush();
       }
     }
   }
@@ -2074,7 +2612,7 @@ FSTProcessor::quoteMerge(InputFile& input, UFILE *output)
 
 
 void
-FSTProcessor::quoteUnmerge(InputFile &input, UFILE *output)
+FSTProcessor::quoteUnmerge(InputFile &input, OutputFile& output)
 {
   StreamReader reader(&input);
   reader.alpha = &alphabet;
@@ -2090,8 +2628,8 @@ FSTProcessor::quoteUnmerge(InputFile &input, UFILE *output)
         unmerging = true;
       }
     }
-    write(reader.blank, output);
-    write(reader.wblank, output);
+    output.write(reader.blank);
+    output.write(reader.wblank);
     if(unmerging) {
       // Just output the last reading (surface form), removing one level of escaping
       StreamReader::Reading &lastReading = reader.readings.back(); // (we know there's at least one because of the above loop)
@@ -2109,28 +2647,28 @@ FSTProcessor::quoteUnmerge(InputFile &input, UFILE *output)
           surface += c;
         }
       }
-      write(surface, output);
+      output.write(surface);
     }
     else {
       if(reader.readings.size() > 0) {
         // NB. ^$ will produce a readings vector of length 1 where the single item is empty. EOF should give length 0.
         // (We *want* to keep ^$ in stream, but not print extra ^$ when there was no ^$)
-        u_fputc('^', output);
+        output.put('^');
         bool seen_reading = false;
         for (StreamReader::Reading &it : reader.readings) {
           if (seen_reading) {
-            u_fputc('/', output);
+            output.put('/');
           }
-          if(it.mark != '\0') { u_fputc(it.mark, output); }
-          write(it.content, output);
+          if(it.mark != '\0') { output.put(it.mark); }
+          output.write(it.content);
           seen_reading = true;
         }
-        u_fputc('$', output);
+        output.put('$');
       }
     }
     if(reader.at_null) {
-      u_fputc('\0', output);
-      u_fflush(output);
+      output.put('\0');
+      output.flush();
     }
   }
 }
@@ -2138,7 +2676,7 @@ FSTProcessor::quoteUnmerge(InputFile &input, UFILE *output)
 bool
 FSTProcessor::valid() const
 {
-  if(initial_state.isFinal(all_finals))
+  if(initial_state.isFinal(Node::final_flag))
   {
     std::cerr << "Error: Invalid dictionary (hint: the left side of an entry is empty)" << std::endl;
     return false;
@@ -2171,7 +2709,7 @@ FSTProcessor::readSAO(InputFile& input)
     return 0;
   }
 
-  if(escaped_chars.find(val) != escaped_chars.end())
+  if(isEscaped(val))
   {
     if(val == '<')
     {
@@ -2212,7 +2750,7 @@ FSTProcessor::readSAO(InputFile& input)
 }
 
 void
-FSTProcessor::printSAOWord(UStringView lf, UFILE *output)
+FSTProcessor::printSAOWord(UStringView lf, OutputFile& output)
 {
   for(unsigned int i = 1, limit = lf.size(); i != limit; i++)
   {
@@ -2220,12 +2758,12 @@ FSTProcessor::printSAOWord(UStringView lf, UFILE *output)
     {
       break;
     }
-    u_fputc(lf[i], output);
+    output.put(lf[i]);
   }
 }
 
 void
-FSTProcessor::SAO(InputFile& input, UFILE *output)
+FSTProcessor::SAO(InputFile& input, OutputFile& output)
 {
   bool last_incond = false;
   bool last_postblank = false;
@@ -2238,13 +2776,14 @@ FSTProcessor::SAO(InputFile& input, UFILE *output)
   escaped_chars.insert('\\');
   escaped_chars.insert('<');
   escaped_chars.insert('>');
+  clearCaches();
 
   while(UChar32 val = readSAO(input))
   {
     // test for final states
-    if(current_state.isFinal(all_finals))
+    if(current_state.isFinal(Node::final_flag))
     {
-      if(current_state.isFinal(inconditional))
+      if(current_state.isFinal(Node::final_flag | Node::inconditional_flag))
       {
         bool firstupper = u_isupper(sf[0]);
         bool uppercase = firstupper && u_isupper(sf[sf.size()-1]);
@@ -2255,7 +2794,7 @@ FSTProcessor::SAO(InputFile& input, UFILE *output)
         last_incond = true;
         last = input_buffer.getPos();
       }
-      else if(current_state.isFinal(postblank))
+      else if(current_state.isFinal(Node::final_flag | Node::postblank_flag))
       {
         bool firstupper = u_isupper(sf[0]);
         bool uppercase = firstupper && u_isupper(sf[sf.size()-1]);
@@ -2306,9 +2845,9 @@ FSTProcessor::SAO(InputFile& input, UFILE *output)
         {
           if(isEscaped(val))
           {
-            u_fputc('\\', output);
+            output.put('\\');
           }
-          u_fputc(val, output);
+          output.put(val);
         }
       }
       else if(last_incond)
@@ -2320,7 +2859,7 @@ FSTProcessor::SAO(InputFile& input, UFILE *output)
       else if(last_postblank)
       {
         printSAOWord(lf, output);
-        u_fputc(' ', output);
+        output.put(' ');
         input_buffer.setPos(last);
         input_buffer.back(1);
       }
@@ -2337,14 +2876,18 @@ FSTProcessor::SAO(InputFile& input, UFILE *output)
         auto limit = firstNotAlpha(sf);
         unsigned int size = sf.size(); // TODO: change these to character counts
         input_buffer.back(1+(size-limit.i_utf16));
-        u_fprintf(output, "<d>%S</d>", sf.c_str());
+        output.write(u"<d>");
+        output.write(sf);
+        output.write(u"</d>");
       }
       else if(lf.empty())
       {
         auto limit = firstNotAlpha(sf);
         unsigned int size = sf.size(); // TODO: change these to character counts
         input_buffer.back(1+(size-limit.i_utf16));
-        u_fprintf(output, "<d>%S</d>", sf.c_str());
+        output.write(u"<d>");
+        output.write(sf);
+        output.write(u"</d>");
       }
       else
       {
@@ -2365,6 +2908,106 @@ FSTProcessor::SAO(InputFile& input, UFILE *output)
   flushBlanks(output);
 }
 
+namespace {
+
+template<typename Run>
+void
+runOnUFILE(UFILE* output, Run run)
+{
+  // anything already written through the UFILE goes first
+  u_fflush(output);
+  FILE* file = u_fgetfile(output);
+  OutputFile out;
+  if (file != nullptr) {
+    out.wrap(file);
+    run(out);
+    out.flush();
+    return;
+  }
+  // a UFILE on a string has no file underneath
+  out.open_in_memory();
+  std::exception_ptr error;
+  try {
+    run(out);
+  } catch (...) {
+    error = std::current_exception();
+  }
+  UString text;
+  utf8::utf8to16(out.str().begin(), out.str().end(), std::back_inserter(text));
+  u_file_write(text.data(), text.size(), output);
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+}
+
+void
+FSTProcessor::analysis(InputFile& input, UFILE *output)
+{
+  runOnUFILE(output, [&](OutputFile& out) { analysis(input, out); });
+}
+
+void
+FSTProcessor::parallelAnalysis(InputFile& input, UFILE *output, size_t threads)
+{
+  runOnUFILE(output, [&](OutputFile& out) { parallelAnalysis(input, out, threads); });
+}
+
+void
+FSTProcessor::tm_analysis(InputFile& input, UFILE *output, TranslationMemoryMode tm_mode)
+{
+  runOnUFILE(output, [&](OutputFile& out) { tm_analysis(input, out, tm_mode); });
+}
+
+void
+FSTProcessor::generation(InputFile& input, UFILE *output, GenerationMode mode)
+{
+  runOnUFILE(output, [&](OutputFile& out) { generation(input, out, mode); });
+}
+
+void
+FSTProcessor::postgeneration(InputFile& input, UFILE *output)
+{
+  runOnUFILE(output, [&](OutputFile& out) { postgeneration(input, out); });
+}
+
+void
+FSTProcessor::intergeneration(InputFile& input, UFILE *output)
+{
+  runOnUFILE(output, [&](OutputFile& out) { intergeneration(input, out); });
+}
+
+void
+FSTProcessor::transliteration(InputFile& input, UFILE *output)
+{
+  runOnUFILE(output, [&](OutputFile& out) { transliteration(input, out); });
+}
+
+void
+FSTProcessor::bilingual(InputFile& input, UFILE *output, GenerationMode mode)
+{
+  runOnUFILE(output, [&](OutputFile& out) { bilingual(input, out, mode); });
+}
+
+void
+FSTProcessor::quoteMerge(InputFile& input, UFILE *output)
+{
+  runOnUFILE(output, [&](OutputFile& out) { quoteMerge(input, out); });
+}
+
+void
+FSTProcessor::quoteUnmerge(InputFile& input, UFILE *output)
+{
+  runOnUFILE(output, [&](OutputFile& out) { quoteUnmerge(input, out); });
+}
+
+void
+FSTProcessor::SAO(InputFile& input, UFILE *output)
+{
+  runOnUFILE(output, [&](OutputFile& out) { SAO(input, out); });
+}
+
 UStringView
 FSTProcessor::removeTags(UStringView str)
 {
@@ -2396,12 +3039,14 @@ void
 FSTProcessor::setCaseSensitiveMode(bool value)
 {
   caseSensitive = value;
+  clearCaches();
 }
 
 void
 FSTProcessor::setDictionaryCaseMode(bool value)
 {
   dictionaryCase = value;
+  clearCaches();
 }
 
 void
@@ -2410,16 +3055,30 @@ FSTProcessor::setNullFlush(bool value)
   nullFlush = value;
 }
 
+void
+FSTProcessor::setBinaryInput(bool value)
+{
+  binaryInput = value;
+}
+
+void
+FSTProcessor::setBinaryOutput(bool value)
+{
+  binaryOutput = value;
+}
+
 void
 FSTProcessor::setIgnoredChars(bool value)
 {
   useIgnoredChars = value;
+  clearCaches();
 }
 
 void
 FSTProcessor::setRestoreChars(bool value)
 {
   useRestoreChars = value;
+  clearCaches();
 }
 
 void
@@ -2432,24 +3091,67 @@ void
 FSTProcessor::setDisplayWeightsMode(bool value)
 {
   displayWeightsMode = value;
+  clearCaches();
 }
 
 void
 FSTProcessor::setMaxAnalysesValue(int value)
 {
   maxAnalyses = value;
+  clearCaches();
 }
 
 void
 FSTProcessor::setMaxWeightClassesValue(int value)
 {
   maxWeightClasses = value;
+  clearCaches();
+}
+
+void
+FSTProcessor::setCacheSize(size_t n)
+{
+  analysis_cache.setCapacity(n);
+  biltrans_cache.setCapacity(n);
+}
+
+size_t
+FSTProcessor::getCacheHits() const
+{
+  return analysis_cache.hits + biltrans_cache.hits;
+}
+
+size_t
+FSTProcessor::getCacheMisses() const
+{
+  return analysis_cache.misses + biltrans_cache.misses;
+}
+
+void
+FSTProcessor::setStats(bool value)
+{
+  collect_stats = value;
+}
+
+ProcessorStats*
+FSTProcessor::getStats()
+{
+  return collect_stats ? &stats : nullptr;
+}
+
+void
+FSTProcessor::clearCaches()
+{
+  analysis_cache.clear();
+  biltrans_cache.clear();
+  std::fill(char_blocks.begin(), char_blocks.end(), nullptr);
 }
 
 void
 FSTProcessor::setCompoundMaxElements(int value)
 {
   compound_max_elements = value;
+  clearCaches();
 }
 
 bool
@@ -2484,16 +3186,17 @@ FSTProcessor::firstNotAlpha(UStringView sf)
   return ix;
 }
 
-bool
-FSTProcessor::lookup(UStringView word, std::vector<UString>& result)
+void
+FSTProcessor::lookupWith(UStringView word, State& current_state,
+                         std::vector<UString>& result)
 {
-  State current_state = initial_state;
+  current_state = initial_state;
   bool firstupper = u_isupper(word[0]);
-  bool uppercase = firstupper && u_isupper(word[1]);
+  bool uppercase = firstupper && word.size() > 1 && u_isupper(word[1]);
   for (auto symbol : symbol_iter(word)) {
-    int32_t val = (symbol.size() == 1 ? symbol[0] : alphabet(symbol));
+    int32_t val = symbolValue(alphabet, symbol);
     if (current_state.size() != 0) {
-      current_state.step(val, beCaseSensitive(current_state));
+      current_state.step_case(val, beCaseSensitive(current_state));
     }
   }
   current_state.filterFinalsArray(result,
@@ -2501,5 +3204,72 @@ FSTProcessor::lookup(UStringView word, std::vector<UString>& result)
                                   escaped_chars,
                                   displayWeightsMode, maxAnalyses, maxWeightClasses,
                                   uppercase, firstupper, 0);
+}
+
+bool
+FSTProcessor::lookup(UStringView word, std::vector<UString>& result)
+{
+  State current_state;
+  lookupWith(word, current_state, result);
   return !result.empty();
 }
+
+void
+FSTProcessor::lookup(UStringView const *words, size_t count, LookupResults& results)
+{
+  results.clear();
+  for (size_t i = 0; i < count; i++) {
+    results.first.push_back(results.offsets.size() - 1);
+    if (words[i].empty()) {
+      continue;
+    }
+    lookupWith(words[i], results.state, results.scratch);
+    for (auto& it : results.scratch) {
+      results.buffer += it;
+      results.offsets.push_back(results.buffer.size());
+    }
+  }
+  results.first.push_back(results.offsets.size() - 1);
+}
+
+void
+FSTProcessor::biltrans(UStringView const *words, size_t count, LookupResults& results,
+                       bool with_delim)
+{
+  results.clear();
+  for (size_t i = 0; i < count; i++) {
+    results.first.push_back(i);
+    biltransWith(words[i], results.state, results.scratch, results.buffer,
+                 with_delim);
+    results.offsets.push_back(results.buffer.size());
+  }
+  results.first.push_back(count);
+}
+
+void
+LookupResults::clear()
+{
+  buffer.clear();
+  offsets.clear();
+  offsets.push_back(0);
+  first.clear();
+}
+
+size_t
+LookupResults::size() const
+{
+  return first.empty() ? 0 : first.size() - 1;
+}
+
+size_t
+LookupResults::count(size_t i) const
+{
+  return first[i+1] - first[i];
+}
+
+UStringView
+LookupResults::get(size_t i, size_t n) const
+{
+  size_t start = offsets[first[i] + n];
+  return UStringView(buffer).substr(start, offsets[first[i] + n + 1] - start);
+}
@@ -22,14 +22,20 @@
 #include <unicode/uchriter.h>
 #include <lttoolbox/alphabet.h>
 #include <lttoolbox/buffer.h>
+#include <lttoolbox/clock_cache.h>
 #include <lttoolbox/my_stdio.h>
+#include <lttoolbox/processor_stats.h>
 #include <lttoolbox/state.h>
+#include <lttoolbox/stream_reader.h>
 #include <lttoolbox/trans_exe.h>
 #include <lttoolbox/input_file.h>
+#include <lttoolbox/output_file.h>
 #include <libxml/xmlreader.h>
 
+#include <array>
 #include <deque>
 #include <map>
+#include <memory>
 #include <queue>
 #include <set>
 #include <string>
@@ -59,6 +65,34 @@ enum TranslationMemoryMode
 };
 
 
+/**
+ * Results of looking up a batch of words. Everything is kept in a few
+ * flat arrays which keep their capacity from one batch to the next, so
+ * a caller that reuses the same object does not allocate per word.
+ * Result n of word i is the slice of buffer from
+ * offsets[first[i]+n] to offsets[first[i]+n+1].
+ */
+struct LookupResults
+{
+  // all results, back to back
+  UString buffer;
+  // start of every result in buffer, plus the end of the last one
+  std::vector<size_t> offsets;
+  // index in offsets of the first result of every word, plus the total
+  std::vector<size_t> first;
+  // working space of FSTProcessor
+  State state;
+  std::vector<UString> scratch;
+
+  void clear();
+  // number of words
+  size_t size() const;
+  // number of results for word i
+  size_t count(size_t i) const;
+  UStringView get(size_t i, size_t n) const;
+};
+
+
 /**
  * Class that implements the FST-based modules of the system
  */
@@ -83,27 +117,27 @@ private:
   /**
    * The final states of inconditional sections in the dictionaries
    */
-  std::map<Node *, double> inconditional;
+  std::map<Node const *, double> inconditional;
 
   /**
    * The final states of standard sections in the dictionaries
    */
-  std::map<Node *, double> standard;
+  std::map<Node const *, double> standard;
 
   /**
    * The final states of postblank sections in the dictionaries
    */
-  std::map<Node *, double> postblank;
+  std::map<Node const *, double> postblank;
 
   /**
    * The final states of preblank sections in the dictionaries
    */
-  std::map<Node *, double> preblank;
+  std::map<Node const *, double> preblank;
 
   /**
    * Merge of 'inconditional', 'standard', 'postblank' and 'preblank' sets
    */
-  std::map<Node *, double> all_finals;
+  std::map<Node const *, double> all_finals;
 
   /**
    * Queue of blanks, used in reading methods
@@ -137,6 +171,51 @@ private:
    */
   std::map<int, std::set<int> > rcx_map;
 
+  /**
+   * Classes of a character that the tokenizers test, see charInfo()
+   */
+  enum CharClass : uint8_t {
+    CC_ALPHABETIC = (1 << 0),
+    CC_ESCAPED = (1 << 1),
+    CC_IGNORED = (1 << 2),
+    CC_UPPER = (1 << 3),
+    CC_RESTORE = (1 << 4),
+  };
+
+  struct CharInfo
+  {
+    UChar32 lower;
+    uint8_t classes;
+  };
+
+  typedef std::array<CharInfo, 256> CharBlock;
+  static constexpr size_t CHAR_BLOCKS = 0x110000 / 256;
+
+  /**
+   * The sets above and ICU's properties flattened into a table indexed
+   * by code point, 256 to a block. A block is filled in when a
+   * character from it is first looked up, and never changes after
+   * that, so copies of the processor share the blocks they inherit.
+   * clearCaches() empties the table.
+   */
+  mutable std::vector<std::shared_ptr<CharBlock const>> char_blocks =
+    std::vector<std::shared_ptr<CharBlock const>>(CHAR_BLOCKS);
+
+  void buildCharBlock(size_t block) const;
+
+  CharInfo charInfo(UChar32 c) const
+  {
+    size_t block = static_cast<uint32_t>(c) >> 8;
+    if (block >= CHAR_BLOCKS) {
+      // tag symbols and other negative values
+      return {c, 0};
+    }
+    if (!char_blocks[block]) {
+      buildCharBlock(block);
+    }
+    return (*char_blocks[block])[c & 0xFF];
+  }
+
   /**
    * Original char being restored
    */
@@ -152,11 +231,6 @@ private:
    */
   Buffer<int32_t> input_buffer;
 
-  /**
-   * Begin of the transducer
-   */
-  Node root;
-
   /**
    * true if the position of input stream is out of a word
    */
@@ -190,6 +264,13 @@ private:
    */
   bool nullFlush = false;
 
+  /**
+   * if true, generation and lexical transfer read the binary form of
+   * the stream (see binary_stream.h) and lexical transfer writes it
+   */
+  bool binaryInput = false;
+  bool binaryOutput = false;
+
   /**
    * nullFlush property for the skipUntil function
    */
@@ -253,6 +334,53 @@ private:
    */
   int maxWeightClasses = INT_MAX;
 
+  /**
+   * With a limit on the number of analyses, drop the paths that can no
+   * longer make it, so that they are not carried to the end of the
+   * word. Small states cost less to carry along than to prune.
+   */
+  void pruneToBest(State &state)
+  {
+    if (maxAnalyses < INT_MAX && maxAnalyses > 0 && !do_decomposition
+        && state.size() > 32 && state.size() > size_t(maxAnalyses)) {
+      state.pruneToBest(maxAnalyses);
+    }
+  }
+
+  /**
+   * Formatted analyses by surface form (analysis) and translations by
+   * lexical unit (bilingual), off unless given a size
+   */
+  ClockCache<UString, UString> analysis_cache;
+  ClockCache<std::u32string, UString> biltrans_cache;
+
+  /**
+   * Whether to keep count in stats, off by default so that the
+   * counting costs a single test of this flag at each site
+   */
+  bool collect_stats = false;
+  ProcessorStats stats;
+
+  void statsToken(bool known)
+  {
+    stats.tokens++;
+    if (!known) {
+      stats.unknown++;
+    }
+  }
+
+  /**
+   * Count the paths of a state that is about to be thrown away, at a
+   * token boundary, and write a report if one has been asked for
+   */
+  void statsBoundary(State const &state)
+  {
+    stats.path_steps += state.pathSteps();
+    if (stats.reporting && ProcessorStats::takeReportRequest()) {
+      stats.report();
+    }
+  }
+
   /**
    * The alphabet index of the tag <ANY_CHAR>
    */
@@ -266,7 +394,7 @@ private:
   /**
    * Write \0 to output and flush if at_null is true
    */
-  void maybeFlush(UFILE* output, bool at_null);
+  void maybeFlush(OutputFile& output, bool at_null);
 
   /**
    * Returns true if the character code is identified as alphabetic
@@ -295,7 +423,7 @@ private:
    * @param output the stream to write on
    * @return the next symbol in the stream
    */
-  int readDecomposition(InputFile& input, UFILE *output);
+  int readDecomposition(InputFile& input, OutputFile& output);
 
   bool readTransliterationBlank(InputFile& input);
   bool readTransliterationWord(InputFile& input);
@@ -311,7 +439,7 @@ private:
    * Flush all the blanks remaining in the current process
    * @param output stream to write blanks
    */
-  void flushBlanks(UFILE *output);
+  void flushBlanks(OutputFile& output);
 
   /**
    * Calculate the initial state of parsing
@@ -329,12 +457,23 @@ private:
    */
   UString filterFinals(const State& state, UStringView casefrom);
 
+  /**
+   * filterFinals(), going through analysis_cache
+   * @param sf the surface form that led to state
+   */
+  UString filterFinalsCached(const State& state, UString const &sf);
+
+  /**
+   * Forget cached results, which a change of options may invalidate
+   */
+  void clearCaches();
+
   /**
    * Write a string to an output stream,
    * @param str the string to write, escaping characters
    * @param output the stream to write in
    */
-  void writeEscaped(UStringView str, UFILE *output);
+  void writeEscaped(UStringView str, OutputFile& output);
 
   /**
    * Write a string to an output stream.
@@ -345,7 +484,7 @@ private:
    * @param output the stream to write in
    * @return how many blanks to pop and print after printing lu
    */
-  size_t writeEscapedPopBlanks(UStringView str, UFILE *output);
+  size_t writeEscapedPopBlanks(UStringView str, OutputFile& output);
 
   /**
    * Write a string to an output stream, escaping all escapable characters
@@ -353,7 +492,7 @@ private:
    * @param str the string to write, escaping characters
    * @param output the stream to write in
    */
-  void writeEscapedWithTags(UStringView str, UFILE *output);
+  void writeEscapedWithTags(UStringView str, OutputFile& output);
 
   /**
    * Prints a word
@@ -361,7 +500,7 @@ private:
    * @param lf lexical form of the word
    * @param output stream where the word is written
    */
-  void printWord(UStringView sf, UStringView lf, UFILE *output);
+  void printWord(UStringView sf, UStringView lf, OutputFile& output);
 
   /**
    * Prints a word.
@@ -371,21 +510,21 @@ private:
    * @param lf lexical form of the word
    * @param output stream where the word is written
    */
-  void printWordPopBlank(UStringView sf, UStringView lf, UFILE *output);
+  void printWordPopBlank(UStringView sf, UStringView lf, OutputFile& output);
 
   /**
    * Prints a word, SAO version
    * @param lf lexical form
    * @param output stream where the word is written
    */
-  void printSAOWord(UStringView lf, UFILE *output);
+  void printSAOWord(UStringView lf, OutputFile& output);
 
   /**
    * Prints an unknown word
    * @param sf surface form of the word
    * @param output stream where the word is written
    */
-  void printUnknownWord(UStringView sf, UFILE *output);
+  void printUnknownWord(UStringView sf, OutputFile& output);
 
   void initDecompositionSymbols();
 
@@ -400,13 +539,13 @@ private:
    * @param val the space character to use if no blank queue
    * @param output stream where the word is written
    */
-  void printSpace(UChar32 val, UFILE *output);
+  void printSpace(UChar32 val, OutputFile& output);
   /**
    * Print one possibly escaped character
    * if it's a space and the blank queue is non-empty,
    * pop the first blank and print that instead
    */
-  void printChar(UChar32 val, UFILE* output);
+  void printChar(UChar32 val, OutputFile& output);
 
   static UStringView removeTags(UStringView str);
   UString compoundAnalysis(UString str);
@@ -430,14 +569,42 @@ private:
    */
   Indices firstNotAlpha(UStringView sf);
 
-  void analysis_wrapper_null_flush(InputFile& input, UFILE *output);
-  void generation_wrapper_null_flush(InputFile& input, UFILE *output,
+  void analysis_wrapper_null_flush(InputFile& input, OutputFile& output);
+
+  void generation_wrapper_null_flush(InputFile& input, OutputFile& output,
                                      GenerationMode mode);
-  void tm_wrapper_null_flush(InputFile& input, UFILE *output,
+  void tm_wrapper_null_flush(InputFile& input, OutputFile& output,
                              TranslationMemoryMode tm_mode);
   UString compose(const std::vector<UString>& lexforms, UStringView queue,
                   bool delim = false, bool mark = false) const;
+  // compose() appending to `result`
+  void compose(const std::vector<UString>& lexforms, UStringView queue,
+               bool delim, bool mark, UString& result) const;
   bool step_biltrans(UStringView word, std::vector<UString>& result, UString& queue);
+  // step_biltrans() starting from `current_state`, which is overwritten
+  bool step_biltrans(UStringView word, State& current_state,
+                     std::vector<UString>& result, UString& queue);
+
+  /**
+   * Translate one lexical unit for bilingual()
+   * @return the source, a slash and the translations
+   */
+  UString biltransReading(StreamReader::Reading const &reading, GenerationMode mode);
+
+  /**
+   * lookup() starting from `current_state`, which is overwritten
+   */
+  void lookupWith(UStringView word, State& current_state,
+                  std::vector<UString>& result);
+
+  /**
+   * biltrans() appending its output to `out`, with `current_state` and
+   * `result` as working space; a word too short to hold its
+   * delimiters gives no output
+   */
+  void biltransWith(UStringView input_word, State& current_state,
+                    std::vector<UString>& result, UString& out,
+                    bool with_delim);
 
   void procNodeICX();
   void procNodeRCX();
@@ -507,20 +674,54 @@ public:
   void initBiltrans();
   void initDecomposition();
 
+  void analysis(InputFile& input, OutputFile& output);
+
+  /**
+   * Analysis spread over a pool of worker threads. The input is cut at
+   * null-flush points and blank lines, each piece is analysed by a copy
+   * of this processor (the copies share the loaded transducers) and the
+   * results are written in input order, so the output is the same as
+   * that of analysis()
+   * @param threads number of worker threads
+   */
+  void parallelAnalysis(InputFile& input, OutputFile& output, size_t threads);
+  /**
+   * Forget everything read from the current stream (pending blanks,
+   * buffered input) so the processor can start on an unrelated one,
+   * e.g. after the previous one ended in an error
+   */
+  void resetStream();
+
+  void tm_analysis(InputFile& input, OutputFile& output, TranslationMemoryMode tm_mode);
+  void generation(InputFile& input, OutputFile& output, GenerationMode mode = gm_unknown);
+  void postgeneration(InputFile& input, OutputFile& output);
+  void intergeneration(InputFile& input, OutputFile& output);
+  void transliteration(InputFile& input, OutputFile& output);
+  UString biltrans(UStringView input_word, bool with_delim = true);
+  UString biltransfull(UStringView input_word, bool with_delim = true);
+  void bilingual(InputFile& input, OutputFile& output, GenerationMode mode = gm_unknown);
+  void quoteMerge(InputFile& input, OutputFile& output);
+  void quoteUnmerge(InputFile& input, OutputFile& output);
+  std::pair<UString, int> biltransWithQueue(UStringView input_word, bool with_delim = true);
+  UString biltransWithoutQueue(UStringView input_word, bool with_delim = true);
+  void SAO(InputFile& input, OutputFile& output);
+
+  /**
+   * The same modes writing to an ICU stream. The output goes as UTF-8
+   * to the file underneath it, whatever the stream's own codepage
+   */
   void analysis(InputFile& input, UFILE *output);
+  void parallelAnalysis(InputFile& input, UFILE *output, size_t threads);
   void tm_analysis(InputFile& input, UFILE *output, TranslationMemoryMode tm_mode);
   void generation(InputFile& input, UFILE *output, GenerationMode mode = gm_unknown);
   void postgeneration(InputFile& input, UFILE *output);
   void intergeneration(InputFile& input, UFILE *output);
   void transliteration(InputFile& input, UFILE *output);
-  UString biltrans(UStringView input_word, bool with_delim = true);
-  UString biltransfull(UStringView input_word, bool with_delim = true);
   void bilingual(InputFile& input, UFILE *output, GenerationMode mode = gm_unknown);
   void quoteMerge(InputFile& input, UFILE *output);
   void quoteUnmerge(InputFile& input, UFILE *output);
-  std::pair<UString, int> biltransWithQueue(UStringView input_word, bool with_delim = true);
-  UString biltransWithoutQueue(UStringView input_word, bool with_delim = true);
   void SAO(InputFile& input, UFILE *output);
+
   void parseICX(std::string const &file);
   void parseRCX(std::string const &file);
 
@@ -535,11 +736,32 @@ public:
   void setIgnoredChars(bool value);
   void setRestoreChars(bool value);
   void setNullFlush(bool value);
+  void setBinaryInput(bool value);
+  void setBinaryOutput(bool value);
   void setUseDefaultIgnoredChars(bool value);
   void setDisplayWeightsMode(bool value);
   void setMaxAnalysesValue(int value);
   void setMaxWeightClassesValue(int value);
   void setCompoundMaxElements(int value);
+
+  /**
+   * Remember the results for up to n distinct words in analysis and
+   * bilingual modes, 0 (the default) to turn this off
+   */
+  void setCacheSize(size_t n);
+  size_t getCacheHits() const;
+  size_t getCacheMisses() const;
+
+  /**
+   * Keep the counters of getStats(), including the time spent in
+   * load(), which should therefore come after this
+   */
+  void setStats(bool value);
+
+  /**
+   * @return the counters, or nullptr if they are not being kept
+   */
+  ProcessorStats* getStats();
   bool getNullFlush();
   bool getDecompoundingMode();
 
@@ -547,6 +769,14 @@ public:
   // and write the output to `result`
   // any existing contents of `result` will be cleared
   bool lookup(UStringView input, std::vector<UString>& result);
+
+  // look up `count` words at once, replacing the contents of `results`
+  void lookup(UStringView const *words, size_t count, LookupResults& results);
+
+  // biltrans() for `count` words at once, with one result per word
+  // (empty for an empty word), replacing the contents of `results`
+  void biltrans(UStringView const *words, size_t count, LookupResults& results,
+                bool with_delim = true);
 };
 
 #endif
@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2022 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+#include <lttoolbox/incremental_builder.h>
+
+#include <algorithm>
+#include <numeric>
+#include <unordered_set>
+
+void
+IncrementalBuilder::add(std::vector<int32_t> const &entry)
+{
+  starts.push_back(labels.size());
+  labels.insert(labels.end(), entry.begin(), entry.end());
+}
+
+bool
+IncrementalBuilder::empty() const
+{
+  return starts.empty();
+}
+
+void
+IncrementalBuilder::replay(Transducer &t, int epsilon_tag, double weight)
+{
+  for(size_t i = 0; i < starts.size(); i++)
+  {
+    size_t limit = (i + 1 < starts.size()) ? starts[i + 1] : labels.size();
+    int e = t.getInitial();
+    for(size_t j = starts[i]; j < limit; j++)
+    {
+      if(labels[j] == epsilon_tag)
+      {
+        e = t.insertNewSingleTransduction(labels[j], e, weight);
+      }
+      else
+      {
+        e = t.insertSingleTransduction(labels[j], e, weight);
+      }
+    }
+    t.setFinal(e, weight);
+  }
+  labels.clear();
+  starts.clear();
+}
+
+Transducer
+IncrementalBuilder::build(double weight)
+{
+  auto begin = [this](size_t i) {
+    return labels.begin() + starts[i];
+  };
+  auto end = [this](size_t i) {
+    return (i + 1 < starts.size()) ? labels.begin() + starts[i + 1]
+                                   : labels.end();
+  };
+  std::vector<size_t> order(starts.size());
+  std::iota(order.begin(), order.end(), 0);
+  auto less = [&](size_t a, size_t b) {
+    return std::lexicographical_compare(begin(a), end(a), begin(b), end(b));
+  };
+  if(!std::is_sorted(order.begin(), order.end(), less))
+  {
+    std::sort(order.begin(), order.end(), less);
+  }
+
+  Transducer t;
+  auto &states = t.getTransitions();
+  std::vector<char> finals(states.size(), 0);
+
+  // the register of finished states, which are told apart by their
+  // finality and their transitions; the weights are all the same
+  auto hash = [&](int s) {
+    uint64_t h = finals[s];
+    for(auto &tr : states[s])
+    {
+      h = (h ^ uint64_t(uint32_t(tr.tag))) * 0x100000001b3ULL;
+      h = (h ^ uint64_t(tr.target)) * 0x100000001b3ULL;
+    }
+    return size_t(h ^ (h >> 29));
+  };
+  auto equal = [&](int a, int b) {
+    return finals[a] == finals[b] &&
+      std::equal(states[a].begin(), states[a].end(),
+                 states[b].begin(), states[b].end(),
+                 [](Transition const &x, Transition const &y) {
+                   return x.tag == y.tag && x.target == y.target;
+                 });
+  };
+  std::unordered_set<int, decltype(hash), decltype(equal)> reg(1024, hash, equal);
+
+  // the states along the previous entry, path[0] being the initial
+  // one; each of them but the last has its newest transition going to
+  // the next, with the target still unset
+  std::vector<std::vector<Transition>> path(1);
+  std::vector<char> path_final(1, 0);
+  auto finish = [&]() {
+    int s = states.size();
+    states.push_back(std::move(path.back()));
+    finals.push_back(path_final.back());
+    auto it = reg.insert(s);
+    if(!it.second)
+    {
+      states.pop_back();
+      finals.pop_back();
+      s = *it.first;
+    }
+    path.pop_back();
+    path_final.pop_back();
+    path.back().back().target = s;
+  };
+
+  for(size_t i : order)
+  {
+    auto first = begin(i), last = end(i);
+    size_t n = last - first;
+    size_t common = 0;
+    while(common < n && common + 1 < path.size() &&
+          path[common].back().tag == first[common])
+    {
+      common++;
+    }
+    while(path.size() > common + 1)
+    {
+      finish();
+    }
+    for(size_t j = common; j < n; j++)
+    {
+      path.back().push_back({first[j], -1, weight});
+      path.emplace_back();
+      path_final.push_back(0);
+    }
+    path_final.back() = 1;
+  }
+  while(path.size() > 1)
+  {
+    finish();
+  }
+  states[t.getInitial()] = std::move(path[0]);
+  finals[t.getInitial()] = path_final[0];
+
+  for(size_t s = 0; s < finals.size(); s++)
+  {
+    if(finals[s])
+    {
+      t.setFinal(s, weight);
+    }
+  }
+
+  labels.clear();
+  labels.shrink_to_fit();
+  starts.clear();
+  starts.shrink_to_fit();
+  return t;
+}
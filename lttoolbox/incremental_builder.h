@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2022 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _LT_INCREMENTAL_BUILDER_H_
+#define _LT_INCREMENTAL_BUILDER_H_
+
+#include <lttoolbox/transducer.h>
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Collects unweighted entries, each a string of symbol pairs, and
+ * builds their minimal transducer directly with the sorted-input
+ * algorithm of Daciuk et al. (2000): once the entries are in order,
+ * a state can't gain any more transitions as soon as an entry leaves
+ * its path, so it is either merged with an equivalent finished state
+ * from a register or becomes one itself. The trie of all the entries
+ * never exists.
+ */
+class IncrementalBuilder
+{
+private:
+  /**
+   * The symbol pairs of every entry, one entry after another
+   */
+  std::vector<int32_t> labels;
+
+  /**
+   * Where each entry begins in labels
+   */
+  std::vector<size_t> starts;
+
+public:
+  /**
+   * Add an entry
+   * @param entry its symbol pairs
+   */
+  void add(std::vector<int32_t> const &entry);
+
+  /**
+   * @return true if there are no entries
+   */
+  bool empty() const;
+
+  /**
+   * Insert the entries into a trie in the order they were added,
+   * exactly as if they had never been held back, and forget them
+   * @param t the transducer
+   * @param epsilon_tag the pair of empty elements, which always gets
+   *        a new state
+   * @param weight the weight of every transition and final
+   */
+  void replay(Transducer &t, int epsilon_tag, double weight);
+
+  /**
+   * Sort the entries, unless they came in order, and build their
+   * minimal transducer
+   * @param weight the weight of every transition and final
+   * @return the transducer
+   */
+  Transducer build(double weight);
+};
+
+#endif
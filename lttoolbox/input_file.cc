@@ -22,9 +22,39 @@
 #include <cstring>
 #include <iostream>
 #include <lttoolbox/my_stdio.h>
+#include <cerrno>
+#include <cstdint>
+#include <string>
+#ifdef _WIN32
+#include <io.h>
+#define read _read
+#define fileno _fileno
+typedef int ssize_t;
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+// bytes requested from the stream at a time
+constexpr size_t READ_SIZE = 1 << 16;
+
+size_t
+sequence_length(unsigned char c)
+{
+  if ((c & 0xF0) == 0xF0) {
+    return 4;
+  } else if ((c & 0xE0) == 0xE0) {
+    return 3;
+  } else if ((c & 0xC0) == 0xC0) {
+    return 2;
+  }
+  return 1;
+}
+}
 
 InputFile::InputFile()
-  : infile(stdin), buffer_size(0)
+  : infile(stdin), fd(fileno(stdin)), cbuffer_size(0), upos(0), usize(0),
+    at_eof(false), raw(false)
 {}
 
 InputFile::~InputFile()
@@ -41,15 +71,24 @@ InputFile::open(const char* fname)
   } else {
     infile = fopen(fname, "rb");
   }
+  fd = (infile == nullptr ? -1 : fileno(infile));
   return (infile != nullptr);
 }
 
 #if HAVE_DECL_FMEMOPEN
 bool
 InputFile::open_in_memory(char *input_buffer)
+{
+  return open_in_memory(input_buffer, strlen(input_buffer));
+}
+
+bool
+InputFile::open_in_memory(char *input_buffer, size_t length)
 {
   close();
-  infile = fmemopen(input_buffer, strlen(input_buffer), "rb");
+  infile = fmemopen(input_buffer, length, "rb");
+  // memory streams have no descriptor, so they are read with fread()
+  fd = -1;
   return (infile != nullptr);
 }
 #endif
@@ -72,6 +111,8 @@ InputFile::close()
     }
     infile = nullptr;
   }
+  fd = -1;
+  reset();
 }
 
 void
@@ -79,80 +120,153 @@ InputFile::wrap(FILE* newinfile)
 {
   close();
   infile = newinfile;
+  fd = (infile == nullptr ? -1 : fileno(infile));
 }
 
 void
-InputFile::internal_read()
+InputFile::setRaw(bool value)
 {
-  if (buffer_size) {
-    return;
-  }
-  if (feof(infile)) {
-    ubuffer[buffer_size++] = U_EOF;
-    return;
-  }
+  raw = value;
+}
 
-  int first = fgetc_unlocked(infile);
-  if (first == EOF) {
-    ubuffer[buffer_size++] = U_EOF;
-    return;
-  } else if (first == '\0') {
-    ubuffer[buffer_size++] = '\0';
+void
+InputFile::reset()
+{
+  cbuffer_size = 0;
+  upos = usize = 0;
+  ungot.clear();
+  at_eof = false;
+}
+
+void
+InputFile::decode()
+{
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(cbuffer.data());
+  const size_t n = cbuffer_size;
+  size_t i = 0;
+  usize = 0;
+  upos = 0;
+  if (raw) {
+    for (; i < n; i++) {
+      ubuffer[usize++] = bytes[i];
+    }
+    cbuffer_size = 0;
     return;
   }
-
-  int i = 1;
-  cbuffer[0] = static_cast<char>(first);
-  if ((first & 0xF0) == 0xF0) {
-    i += 3;
-    if (fread_unlocked(cbuffer+1, 1, 3, infile) != 3) {
-      throw std::runtime_error("Could not read 3 expected bytes from stream");
+  while (i < n) {
+    // copy ASCII 8 bytes at a time while none has the high bit set
+    while (i + 8 <= n) {
+      uint64_t word;
+      memcpy(&word, bytes + i, 8);
+      if (word & 0x8080808080808080ULL) {
+        break;
+      }
+      for (size_t k = 0; k < 8; k++) {
+        ubuffer[usize++] = bytes[i+k];
+      }
+      i += 8;
+    }
+    while (i < n && bytes[i] < 0x80) {
+      ubuffer[usize++] = bytes[i++];
     }
-  } else if ((first & 0xE0) == 0xE0) {
-    i += 2;
-    if (fread_unlocked(cbuffer+1, 1, 2, infile) != 2) {
-      throw std::runtime_error("Could not read 2 expected bytes from stream");
+    // hand a run of complete multibyte sequences to utfcpp in one go
+    size_t j = i;
+    while (j < n && bytes[j] >= 0x80) {
+      size_t len = sequence_length(bytes[j]);
+      if (j + len > n) {
+        break;
+      }
+      j += len;
     }
-  } else if ((first & 0xC0) == 0xC0) {
-    i += 1;
-    if (fread_unlocked(cbuffer+1, 1, 1, infile) != 1) {
-      throw std::runtime_error("Could not read 1 expected byte from stream");
+    if (j > i) {
+      UChar32* out = utf8::utf8to32(cbuffer.data() + i, cbuffer.data() + j,
+                                    ubuffer.data() + usize);
+      usize = out - ubuffer.data();
+      i = j;
+    }
+    if (i < n && bytes[i] >= 0x80) {
+      // incomplete sequence at the end of the buffer
+      break;
     }
   }
-  memset(ubuffer, 0, 3*sizeof(UChar));
-  utf8::utf8to32(cbuffer, cbuffer+i, ubuffer);
-  buffer_size = 1;
+  memmove(cbuffer.data(), cbuffer.data() + i, n - i);
+  cbuffer_size = n - i;
+}
+
+bool
+InputFile::internal_read()
+{
+  if (infile == nullptr || at_eof) {
+    return false;
+  }
+  if (cbuffer.empty()) {
+    cbuffer.resize(READ_SIZE + 4);
+    ubuffer.resize(READ_SIZE + 4);
+  }
+  do {
+    size_t space = cbuffer.size() - cbuffer_size;
+    size_t got = 0;
+    if (fd >= 0) {
+      ssize_t r;
+      do {
+        r = read(fd, cbuffer.data() + cbuffer_size, space);
+      } while (r < 0 && errno == EINTR);
+      got = (r > 0 ? static_cast<size_t>(r) : 0);
+    } else {
+      got = fread_unlocked(cbuffer.data() + cbuffer_size, 1, space, infile);
+    }
+    if (got == 0) {
+      at_eof = true;
+      if (cbuffer_size > 0) {
+        size_t missing = sequence_length(cbuffer[0]) - 1;
+        throw std::runtime_error("Could not read " + std::to_string(missing) +
+                                 (missing == 1 ? " expected byte" : " expected bytes") +
+                                 " from stream");
+      }
+      return false;
+    }
+    cbuffer_size += got;
+    decode();
+  } while (usize == 0);
+  return true;
 }
 
 UChar32
 InputFile::get()
 {
-  if (!buffer_size) {
-    internal_read();
+  if (!ungot.empty()) {
+    UChar32 c = ungot.back();
+    ungot.pop_back();
+    return c;
+  }
+  if (upos == usize && !internal_read()) {
+    return U_EOF;
   }
-  return ubuffer[--buffer_size];
+  return ubuffer[upos++];
 }
 
 UChar32
 InputFile::peek()
 {
-  if (!buffer_size) {
-    internal_read();
+  if (!ungot.empty()) {
+    return ungot.back();
   }
-  return ubuffer[buffer_size-1];
+  if (upos == usize && !internal_read()) {
+    return U_EOF;
+  }
+  return ubuffer[upos];
 }
 
 void
 InputFile::unget(UChar32 c)
 {
-  // this will probably segfault if called multiple times
-  ubuffer[buffer_size++] = c;
+  ungot.push_back(c);
 }
 
 bool
 InputFile::eof()
 {
-  return (infile == nullptr) || feof(infile);
+  return (infile == nullptr) || at_eof;
 }
 
 void
@@ -164,25 +278,32 @@ InputFile::rewind()
       exit(EXIT_FAILURE);
     }
   }
+  reset();
 }
 
 UString
 InputFile::readBlock(const UChar32 start, const UChar32 end)
 {
   UString ret;
-  ret += start;
+  readBlock(start, end, ret);
+  return ret;
+}
+
+void
+InputFile::readBlock(const UChar32 start, const UChar32 end, UString& out)
+{
+  out += start;
   UChar32 c = 0;
   while (c != end && !eof()) {
     c = get();
     if (c == '\0') {
       break;
     }
-    ret += c;
+    out += c;
     if (c == '\\') {
-      ret += get();
+      out += get();
     }
   }
-  return ret;
 }
 
 UString
@@ -223,7 +344,6 @@ InputFile::readBlank(bool readwblank)
         if (readwblank) {
           ret += finishWBlank();
         } else {
-          // buffer size is 3, so we should be ok here
           unget(c2);
           unget(c);
           break;
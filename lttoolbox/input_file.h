@@ -19,6 +19,7 @@
 #define _LT_INPUT_FILE_H_
 
 #include <cstdio>
+#include <vector>
 #include <unicode/uchar.h>
 #include <lttoolbox/ustring.h>
 
@@ -26,20 +27,38 @@ class InputFile
 {
 private:
   FILE* infile;
-  UChar32 ubuffer[3];
-  char cbuffer[4];
-  int buffer_size;
-  void internal_read();
+  // descriptor read directly when there is one, so that a short read
+  // from a pipe doesn't wait for a full buffer
+  int fd;
+  // raw bytes, the tail of which may be an incomplete UTF-8 sequence
+  std::vector<char> cbuffer;
+  size_t cbuffer_size;
+  // decoded characters not yet consumed are ubuffer[upos, usize)
+  std::vector<UChar32> ubuffer;
+  size_t upos;
+  size_t usize;
+  // characters given back with unget(), most recent last
+  std::vector<UChar32> ungot;
+  bool at_eof;
+  // hand out bytes as they are instead of decoding UTF-8
+  bool raw;
+  void reset();
+  void decode();
+  bool internal_read();
 public:
   InputFile();
   ~InputFile();
   bool open(const char* fname = nullptr);
 #if HAVE_DECL_FMEMOPEN
   bool open_in_memory(char* input_buffer);
+  bool open_in_memory(char* input_buffer, size_t length);
 #endif
   void open_or_exit(const char* fname = nullptr);
   void close();
   void wrap(FILE* newinfile);
+  // read bytes rather than characters, as binary streams need; this
+  // must come before anything is read
+  void setRaw(bool value);
   UChar32 get();
   UChar32 peek();
   void unget(UChar32 c);
@@ -49,12 +68,13 @@ public:
   // returns string from start to end inclusive
   // respects backslash escapes
   UString readBlock(const UChar32 start, const UChar32 end);
+  // same, but append the block to out
+  void readBlock(const UChar32 start, const UChar32 end, UString& out);
   // assumes [[ has already been read, reads to ]]
   // returns entire string, including brackets
   UString finishWBlank();
   // read until ^ or \0
   // if readwblank == false, also stop at [[
-  // Note: relies on the fact that ubuffer has length >= 2
   UString readBlank(bool readwblank = false);
 };
 
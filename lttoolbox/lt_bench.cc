@@ -0,0 +1,699 @@
+/*
+ * Copyright (C) 2024 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * lt-bench: generate a large synthetic dictionary and corpus from a
+ * seed, compile it and time every lt-proc mode on it. The report is a
+ * JSON object so that runs can be diffed against each other.
+ */
+
+#include <lttoolbox/compiler.h>
+#include <lttoolbox/fst_processor.h>
+#include <lttoolbox/lt_locale.h>
+#include <lttoolbox/cli.h>
+#include <lttoolbox/file_utils.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+namespace fs = std::filesystem;
+
+/*
+ * Allocation counting. Replacing the global operator new in the
+ * executable also catches the allocations made inside liblttoolbox.
+ */
+static std::atomic<uint64_t> allocations{0};
+
+void* operator new(size_t n)
+{
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = std::malloc(n ? n : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void* operator new[](size_t n)
+{
+  return operator new(n);
+}
+
+void operator delete(void* p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+  std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+  std::free(p);
+}
+
+namespace {
+
+/*
+ * splitmix64, so the generated data only depends on the seed and not
+ * on the standard library's distributions
+ */
+struct Rng
+{
+  uint64_t s;
+  explicit Rng(uint64_t seed) : s(seed) {}
+  uint64_t next()
+  {
+    uint64_t z = (s += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+  size_t below(size_t n) { return next() % n; }
+  double unit() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+  // skewed towards small values, roughly like word frequencies
+  size_t zipfish(size_t n) { double u = unit(); return static_cast<size_t>(u * u * u * n); }
+};
+
+const char* const onsets[] = {"b", "d", "f", "g", "k", "l", "m", "n", "p", "r",
+                              "s", "t", "v", "br", "kl", "st", "tr", "ñ", "ç"};
+const char* const nuclei[] = {"a", "e", "i", "o", "u", "á", "é", "ó", "ai", "ou"};
+
+std::string
+randomWord(Rng& rng, size_t syllables)
+{
+  std::string w;
+  for (size_t i = 0; i < syllables; i++) {
+    w += onsets[rng.below(sizeof(onsets)/sizeof(*onsets))];
+    w += nuclei[rng.below(sizeof(nuclei)/sizeof(*nuclei))];
+  }
+  if (rng.below(3) == 0) {
+    w += onsets[rng.below(10)];
+  }
+  return w;
+}
+
+struct Paradigm
+{
+  const char* name;
+  const char* pos;
+  std::vector<std::pair<const char*, const char*>> forms; // suffix, tags
+};
+
+const std::vector<Paradigm> paradigms = {
+  {"n", "n", {{"", "<sg>"}, {"s", "<pl>"}, {"en", "<sg><def>"}, {"ene", "<pl><def>"}}},
+  {"vblex", "vblex", {{"", "<inf>"}, {"er", "<pri>"}, {"et", "<past>"}, {"ende", "<pprs>"}}},
+  {"adj", "adj", {{"", "<sg>"}, {"e", "<pl>"}, {"ere", "<comp>"}, {"est", "<sup>"}}},
+};
+
+void
+writeTags(std::ostream& out, const std::string& tags)
+{
+  // "<a><b>" -> <s n="a"/><s n="b"/>
+  size_t i = 0;
+  while ((i = tags.find('<', i)) != std::string::npos) {
+    size_t j = tags.find('>', i);
+    out << "<s n=\"" << tags.substr(i+1, j-i-1) << "\"/>";
+    i = j;
+  }
+}
+
+struct Lexicon
+{
+  std::vector<std::string> lemmas;
+  std::vector<size_t> paradigm;
+  std::vector<std::string> targets;
+};
+
+Lexicon
+makeLexicon(Rng& rng, size_t entries)
+{
+  Lexicon lex;
+  std::set<std::string> seen;
+  while (lex.lemmas.size() < entries) {
+    std::string w = randomWord(rng, 1 + rng.below(4));
+    if (rng.below(50) == 0) {
+      w += "_" + randomWord(rng, 1 + rng.below(2)); // multiword
+    }
+    // about a tenth of the stems get a second part of speech
+    size_t n = (rng.below(10) == 0) ? 2 : 1;
+    size_t p = rng.below(paradigms.size());
+    for (size_t k = 0; k < n && lex.lemmas.size() < entries; k++) {
+      if (!seen.insert(w + paradigms[(p+k) % paradigms.size()].name).second) {
+        continue;
+      }
+      lex.lemmas.push_back(w);
+      lex.paradigm.push_back((p+k) % paradigms.size());
+      lex.targets.push_back(randomWord(rng, 1 + rng.below(3)));
+    }
+  }
+  return lex;
+}
+
+std::string
+xmlText(const std::string& w)
+{
+  std::string r;
+  for (char c : w) {
+    if (c == '_') r += "<b/>";
+    else r += c;
+  }
+  return r;
+}
+
+std::string
+plainText(const std::string& w)
+{
+  std::string r = w;
+  std::replace(r.begin(), r.end(), '_', ' ');
+  return r;
+}
+
+void
+writeSdefs(std::ostream& out)
+{
+  out << "<sdefs>\n";
+  std::set<std::string> tags = {"n", "vblex", "adj", "cm", "sent", "def",
+                                "sg", "pl", "inf", "pri", "past", "pprs",
+                                "comp", "sup"};
+  for (auto& t : tags) {
+    out << "  <sdef n=\"" << t << "\"/>\n";
+  }
+  out << "</sdefs>\n";
+}
+
+void
+writeMonodix(const Lexicon& lex, const fs::path& file)
+{
+  std::ofstream out(file);
+  out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<dictionary>\n";
+  out << "<alphabet>abcdefghijklmnopqrstuvwxyzáéóñçABCDEFGHIJKLMNOPQRSTUVWXYZ</alphabet>\n";
+  writeSdefs(out);
+  out << "<pardefs>\n";
+  for (auto& p : paradigms) {
+    out << "  <pardef n=\"" << p.name << "\">\n";
+    for (auto& f : p.forms) {
+      out << "    <e><p><l>" << f.first << "</l><r><s n=\"" << p.pos << "\"/>";
+      writeTags(out, f.second);
+      out << "</r></p></e>\n";
+    }
+    out << "  </pardef>\n";
+  }
+  out << "</pardefs>\n<section id=\"main\" type=\"standard\">\n";
+  for (size_t i = 0; i < lex.lemmas.size(); i++) {
+    out << "  <e><i>" << xmlText(lex.lemmas[i]) << "</i><par n=\""
+        << paradigms[lex.paradigm[i]].name << "\"/></e>\n";
+  }
+  out << "</section>\n<section id=\"final\" type=\"inconditional\">\n";
+  out << "  <e><p><l>,</l><r>,<s n=\"cm\"/></r></p></e>\n";
+  out << "  <e><p><l>.</l><r>.<s n=\"sent\"/></r></p></e>\n";
+  out << "</section>\n</dictionary>\n";
+}
+
+void
+writeBidix(const Lexicon& lex, const fs::path& file)
+{
+  std::ofstream out(file);
+  out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<dictionary>\n<alphabet/>\n";
+  writeSdefs(out);
+  out << "<section id=\"main\" type=\"standard\">\n";
+  for (size_t i = 0; i < lex.lemmas.size(); i++) {
+    auto pos = paradigms[lex.paradigm[i]].pos;
+    out << "  <e><p><l>" << xmlText(lex.lemmas[i]) << "<s n=\"" << pos
+        << "\"/></l><r>" << lex.targets[i] << "<s n=\"" << pos
+        << "\"/></r></p></e>\n";
+  }
+  out << "</section>\n</dictionary>\n";
+}
+
+/*
+ * Post-generation rules of the usual "~x<b/>y<b/>" shape, built from
+ * short words of the lexicon
+ */
+void
+writePostgen(const Lexicon& lex, std::vector<std::string>& triggers, const fs::path& file)
+{
+  std::ofstream out(file);
+  out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<dictionary>\n<alphabet/>\n";
+  writeSdefs(out);
+  out << "<section id=\"main\" type=\"standard\">\n";
+  for (size_t i = 0; i < lex.lemmas.size() && triggers.size() < 200; i += 7) {
+    auto& a = lex.lemmas[i];
+    if (a.find('_') != std::string::npos || a.size() > 4) continue;
+    auto& b = lex.targets[i];
+    out << "  <e><p><l>~" << a << "<b/>" << b << "<b/></l><r>" << a << b
+        << "<b/></r></p></e>\n";
+    triggers.push_back("~" + a + " " + b);
+  }
+  out << "</section>\n</dictionary>\n";
+}
+
+void
+writeTranslit(const fs::path& file)
+{
+  std::ofstream out(file);
+  out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<dictionary>\n<alphabet/>\n";
+  writeSdefs(out);
+  out << "<section id=\"main\" type=\"standard\">\n";
+  const char* from[] = {"a", "e", "i", "o", "u", "á", "é", "ó", "ñ", "ç", "st", "tr"};
+  const char* to[] = {"а", "е", "и", "о", "у", "а́", "е́", "о́", "нь", "с", "ст", "тр"};
+  for (size_t i = 0; i < sizeof(from)/sizeof(*from); i++) {
+    out << "  <e><p><l>" << from[i] << "</l><r>" << to[i] << "</r></p></e>\n";
+  }
+  out << "</section>\n</dictionary>\n";
+}
+
+/*
+ * A translation memory of two- and three-word phrases. lt-tmxcomp
+ * output is an ordinary letter transducer, so it is written as a dix.
+ */
+void
+writeTM(const Lexicon& lex, Rng& rng, std::vector<std::string>& phrases, const fs::path& file)
+{
+  std::ofstream out(file);
+  out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<dictionary>\n<alphabet/>\n";
+  writeSdefs(out);
+  out << "<section id=\"main\" type=\"standard\">\n";
+  std::set<std::string> seen;
+  size_t n = std::max<size_t>(lex.lemmas.size() / 10, 1);
+  for (size_t i = 0; i < n; i++) {
+    std::string l, r;
+    size_t len = 2 + rng.below(2);
+    for (size_t k = 0; k < len; k++) {
+      size_t w = rng.zipfish(lex.lemmas.size());
+      if (k) { l += "_"; r += "_"; }
+      l += lex.lemmas[w];
+      r += lex.targets[w];
+    }
+    if (!seen.insert(l).second) continue;
+    out << "  <e><p><l>" << xmlText(l) << "</l><r>" << xmlText(r) << "</r></p></e>\n";
+    phrases.push_back(plainText(l));
+  }
+  out << "</section>\n</dictionary>\n";
+}
+
+/*
+ * Token streams for each mode. Every token is a complete unit for its
+ * mode, so it can also be run on its own to measure latency.
+ */
+struct Corpus
+{
+  std::vector<std::string> text;     // surface forms and punctuation
+  std::vector<std::string> lexical;  // ^lemma<tags>$
+  std::vector<std::string> postgen;  // text with ~ triggers
+  std::vector<std::string> tm;       // text with known phrases
+};
+
+Corpus
+makeCorpus(const Lexicon& lex, Rng& rng, size_t tokens,
+           const std::vector<std::string>& triggers,
+           const std::vector<std::string>& phrases)
+{
+  Corpus c;
+  for (size_t i = 0; i < tokens; i++) {
+    size_t w = rng.zipfish(lex.lemmas.size());
+    auto& par = paradigms[lex.paradigm[w]];
+    auto& form = par.forms[rng.below(par.forms.size())];
+    std::string word = plainText(lex.lemmas[w]) + form.first;
+    if (rng.below(20) == 0) {
+      word = randomWord(rng, 2 + rng.below(3)) + "x"; // unknown
+    }
+    if (rng.below(25) == 0 && static_cast<unsigned char>(word[0]) < 0x80) {
+      word[0] = static_cast<char>(toupper(word[0]));
+    }
+    c.text.push_back(word);
+    c.lexical.push_back("^" + lex.lemmas[w] + "<" + par.pos + ">" + form.second + "$");
+    std::replace(c.lexical.back().begin(), c.lexical.back().end(), '_', ' ');
+    if (!triggers.empty() && rng.below(10) == 0) {
+      c.postgen.push_back(triggers[rng.below(triggers.size())]);
+    } else {
+      c.postgen.push_back(word);
+    }
+    if (!phrases.empty() && rng.below(5) == 0) {
+      c.tm.push_back(phrases[rng.below(phrases.size())]);
+    } else {
+      c.tm.push_back(word);
+    }
+    if (rng.below(12) == 0) {
+      c.text.push_back(rng.below(2) ? "," : ".");
+      c.postgen.push_back(c.text.back());
+      c.tm.push_back(c.text.back());
+    }
+  }
+  return c;
+}
+
+std::string
+joinTokens(const std::vector<std::string>& tokens)
+{
+  std::string r;
+  for (size_t i = 0; i < tokens.size(); i++) {
+    r += tokens[i];
+    r += (i % 16 == 15) ? '\n' : ' ';
+  }
+  return r;
+}
+
+void
+compile(const fs::path& dix, UStringView dir, const fs::path& bin, bool flat)
+{
+  Compiler c;
+  c.setJobs(false);
+  c.setMaxSectionEntries(0);
+  c.parse(dix.string(), dir);
+  FILE* out = fopen(bin.string().c_str(), "wb");
+  if (!out) {
+    std::cerr << "Error: cannot open '" << bin.string() << "' for writing." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  // writeTransducerSet() prints section sizes on stdout, where the
+  // report goes
+  auto buf = std::cout.rdbuf(nullptr);
+  c.write(out, flat);
+  std::cout.rdbuf(buf);
+  std::cout.clear();
+  fclose(out);
+}
+
+/*
+ * Peak resident set size. On Linux it is the high-water mark since the
+ * last resetPeakRSS(), so that each mode gets its own; elsewhere it is
+ * the peak of the whole process, which never goes down.
+ */
+long
+peakRSSkB()
+{
+#ifdef __linux__
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 6, "VmHWM:") == 0) {
+      return atol(line.c_str() + 6);
+    }
+  }
+#endif
+#ifndef _WIN32
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+  return ru.ru_maxrss / 1024;
+#else
+  return ru.ru_maxrss;
+#endif
+#else
+  return 0;
+#endif
+}
+
+// the largest peak seen before any reset, for the whole run
+long process_peak_rss = 0;
+
+void
+resetPeakRSS()
+{
+  process_peak_rss = std::max(process_peak_rss, peakRSSkB());
+#ifdef __linux__
+#ifdef __GLIBC__
+  // hand back what earlier modes freed, so it doesn't count towards
+  // the next one
+  malloc_trim(0);
+#endif
+  // 5 resets VmHWM to the current resident set size
+  std::ofstream("/proc/self/clear_refs") << "5";
+#endif
+}
+
+double
+since(std::chrono::steady_clock::time_point t0)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+double
+percentile(std::vector<double>& v, double p)
+{
+  if (v.empty()) {
+    return 0;
+  }
+  size_t k = std::min(v.size() - 1, static_cast<size_t>(p * v.size()));
+  std::nth_element(v.begin(), v.begin() + k, v.end());
+  return v[k];
+}
+
+typedef std::function<void(FSTProcessor&, InputFile&, OutputFile&)> Runner;
+
+struct Mode
+{
+  const char* name;
+  fs::path bin;
+  std::function<void(FSTProcessor&)> init;
+  Runner run;
+  const std::vector<std::string>* tokens;
+};
+
+void
+benchMode(const Mode& m, OutputFile& sink, size_t max_samples, std::ostream& json)
+{
+  resetPeakRSS();
+  auto t0 = std::chrono::steady_clock::now();
+  FSTProcessor fstp;
+  FILE* in = fopen(m.bin.string().c_str(), "rb");
+  fstp.load(in);
+  fclose(in);
+  m.init(fstp);
+  double load = since(t0);
+  if (!fstp.valid()) {
+    std::cerr << "Error: invalid transducer for mode " << m.name << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  // throughput: the whole corpus as one stream
+  std::string text = joinTokens(*m.tokens);
+  InputFile input;
+  uint64_t allocs0 = allocations.load();
+  t0 = std::chrono::steady_clock::now();
+  input.open_in_memory(&text[0], text.size());
+  m.run(fstp, input, sink);
+  sink.flush();
+  double total = since(t0);
+  uint64_t allocs = allocations.load() - allocs0;
+
+  // latency: tokens one at a time, each as a stream of its own
+  std::vector<double> lat;
+  std::string tok;
+  for (size_t i = 0; i < m.tokens->size() && i < max_samples; i++) {
+    tok = (*m.tokens)[i];
+    tok += ' ';
+    auto t1 = std::chrono::steady_clock::now();
+    input.open_in_memory(&tok[0], tok.size());
+    m.run(fstp, input, sink);
+    lat.push_back(since(t1) * 1e6);
+  }
+  input.close();
+
+  size_t n = m.tokens->size();
+  json.precision(3);
+  json << std::fixed;
+  json << "    \"" << m.name << "\": {\n"
+       << "      \"load_ms\": " << load * 1e3 << ",\n"
+       << "      \"tokens\": " << n << ",\n"
+       << "      \"seconds\": " << total << ",\n"
+       << "      \"tokens_per_s\": " << (total > 0 ? n / total : 0) << ",\n"
+       << "      \"latency_us\": {\"p50\": " << percentile(lat, 0.50)
+       << ", \"p99\": " << percentile(lat, 0.99) << "},\n"
+       << "      \"allocations\": " << allocs << ",\n"
+       << "      \"allocations_per_token\": " << (n ? double(allocs) / n : 0) << ",\n"
+       << "      \"peak_rss_kb\": " << peakRSSkB() << "\n"
+       << "    }";
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+  LtLocale::tryToSetLocale();
+  CLI cli("benchmark lt-proc modes on generated dictionaries", PACKAGE_VERSION);
+  cli.add_str_arg('e', "entries", "number of dictionary entries (default 20000)", "N");
+  cli.add_str_arg('t', "tokens", "number of corpus tokens (default 100000)", "N");
+  cli.add_str_arg('s', "seed", "random seed (default 1)", "N");
+  cli.add_str_arg('l', "latency-samples", "tokens timed one by one (default 20000)", "N");
+  cli.add_str_arg('m', "modes", "comma-separated subset of analysis,generation,biltrans,postgeneration,transliteration,sao,tm", "LIST");
+  cli.add_str_arg('d', "dir", "keep the generated dictionaries, binaries and corpora in DIR", "DIR");
+  cli.add_bool_arg('F', "flat", "compile to the memory-mappable format");
+  cli.add_bool_arg('h', "help", "print this message and exit");
+  cli.add_file_arg("output_file");
+  cli.parse_args(argc, argv);
+
+  auto strs = cli.get_strs();
+  auto num = [&](const char* name, size_t def) -> size_t {
+    if (strs.find(name) == strs.end()) {
+      return def;
+    }
+    long n = atol(strs[name].back().c_str());
+    if (n < 1) {
+      std::cerr << "Invalid or no argument for " << name << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    return n;
+  };
+  size_t entries = num("entries", 20000);
+  size_t tokens = num("tokens", 100000);
+  size_t seed = num("seed", 1);
+  size_t samples = num("latency-samples", 20000);
+  bool flat = cli.get_bools()["flat"];
+
+  std::set<std::string> wanted;
+  if (strs.find("modes") != strs.end()) {
+    std::stringstream ss(strs["modes"].back());
+    std::string m;
+    while (std::getline(ss, m, ',')) {
+      wanted.insert(m);
+    }
+  }
+
+  const std::set<std::string> known = {"analysis", "generation", "biltrans",
+                                       "postgeneration", "transliteration",
+                                       "sao", "tm"};
+  for (auto& m : wanted) {
+    if (known.find(m) == known.end()) {
+      std::cerr << "Error: unknown mode '" << m << "'" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  bool keep = strs.find("dir") != strs.end();
+  fs::path dir;
+  if (keep) {
+    dir = strs["dir"].back();
+  } else {
+    dir = fs::temp_directory_path() / ("lt-bench-" + std::to_string(seed) + "-"
+                                       + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()));
+  }
+  fs::create_directories(dir);
+
+  Rng rng(seed);
+  auto t0 = std::chrono::steady_clock::now();
+  Lexicon lex = makeLexicon(rng, entries);
+  std::vector<std::string> triggers, phrases;
+  writeMonodix(lex, dir / "mono.dix");
+  writeBidix(lex, dir / "bi.dix");
+  writePostgen(lex, triggers, dir / "postgen.dix");
+  writeTranslit(dir / "translit.dix");
+  writeTM(lex, rng, phrases, dir / "tm.dix");
+  Corpus corpus = makeCorpus(lex, rng, tokens, triggers, phrases);
+  if (keep) {
+    std::ofstream(dir / "text.txt") << joinTokens(corpus.text);
+    std::ofstream(dir / "lexical.txt") << joinTokens(corpus.lexical);
+    std::ofstream(dir / "postgen.txt") << joinTokens(corpus.postgen);
+    std::ofstream(dir / "tm.txt") << joinTokens(corpus.tm);
+  }
+  double gen = since(t0);
+
+  t0 = std::chrono::steady_clock::now();
+  compile(dir / "mono.dix", Compiler::COMPILER_RESTRICTION_LR_VAL, dir / "an.bin", flat);
+  compile(dir / "mono.dix", Compiler::COMPILER_RESTRICTION_RL_VAL, dir / "gen.bin", flat);
+  compile(dir / "bi.dix", Compiler::COMPILER_RESTRICTION_LR_VAL, dir / "bi.bin", flat);
+  compile(dir / "postgen.dix", Compiler::COMPILER_RESTRICTION_LR_VAL, dir / "postgen.bin", flat);
+  compile(dir / "translit.dix", Compiler::COMPILER_RESTRICTION_LR_VAL, dir / "translit.bin", flat);
+  compile(dir / "tm.dix", Compiler::COMPILER_RESTRICTION_LR_VAL, dir / "tm.bin", flat);
+  double comp = since(t0);
+
+  std::vector<Mode> modes = {
+    {"analysis", dir / "an.bin", [](FSTProcessor& f) { f.initAnalysis(); },
+     [](FSTProcessor& f, InputFile& i, OutputFile& o) { f.analysis(i, o); }, &corpus.text},
+    {"generation", dir / "gen.bin", [](FSTProcessor& f) { f.initGeneration(); },
+     [](FSTProcessor& f, InputFile& i, OutputFile& o) { f.generation(i, o); }, &corpus.lexical},
+    {"biltrans", dir / "bi.bin", [](FSTProcessor& f) { f.initBiltrans(); },
+     [](FSTProcessor& f, InputFile& i, OutputFile& o) { f.bilingual(i, o); }, &corpus.lexical},
+    {"postgeneration", dir / "postgen.bin", [](FSTProcessor& f) { f.initPostgeneration(); },
+     [](FSTProcessor& f, InputFile& i, OutputFile& o) { f.postgeneration(i, o); }, &corpus.postgen},
+    {"transliteration", dir / "translit.bin", [](FSTProcessor& f) { f.initTransliteration(); },
+     [](FSTProcessor& f, InputFile& i, OutputFile& o) { f.transliteration(i, o); }, &corpus.text},
+    {"sao", dir / "an.bin", [](FSTProcessor& f) { f.initSAO(); },
+     [](FSTProcessor& f, InputFile& i, OutputFile& o) { f.SAO(i, o); }, &corpus.text},
+    {"tm", dir / "tm.bin", [](FSTProcessor& f) { f.initTMAnalysis(); },
+     [](FSTProcessor& f, InputFile& i, OutputFile& o) { f.tm_analysis(i, o, tm_punct); }, &corpus.tm},
+  };
+
+  OutputFile sink;
+#ifdef _WIN32
+  sink.open("NUL");
+#else
+  sink.open("/dev/null");
+#endif
+
+  std::ostringstream json;
+  json.precision(3);
+  json << std::fixed;
+  json << "{\n  \"version\": \"" << PACKAGE_VERSION << "\",\n"
+       << "  \"seed\": " << seed << ",\n"
+       << "  \"entries\": " << entries << ",\n"
+       << "  \"flat\": " << (flat ? "true" : "false") << ",\n"
+       << "  \"generate_s\": " << gen << ",\n"
+       << "  \"compile_s\": " << comp << ",\n"
+       << "  \"modes\": {\n";
+  bool first = true;
+  for (auto& m : modes) {
+    if (!wanted.empty() && wanted.find(m.name) == wanted.end()) {
+      continue;
+    }
+    if (!first) {
+      json << ",\n";
+    }
+    first = false;
+    benchMode(m, sink, samples, json);
+  }
+  resetPeakRSS();
+  json << "\n  },\n  \"peak_rss_kb\": " << process_peak_rss << "\n}\n";
+  sink.close();
+
+  if (!keep) {
+    fs::remove_all(dir);
+  }
+
+  std::string outfile = cli.get_files()[0];
+  if (outfile.empty()) {
+    std::cout << json.str();
+  } else {
+    std::ofstream(outfile) << json.str();
+  }
+  return EXIT_SUCCESS;
+}
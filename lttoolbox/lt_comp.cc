@@ -20,7 +20,13 @@
 #include <lttoolbox/cli.h>
 #include <lttoolbox/file_utils.h>
 
+#include <cstdio>
 #include <iostream>
+#include <string>
+
+#ifdef HAVE_MMAP
+#include <unistd.h>
+#endif
 
 /*
  * Error function that does nothing so that when we fallback from
@@ -45,6 +51,12 @@ int main(int argc, char *argv[])
   cli.add_bool_arg('H', "hfst", "expect HFST symbols");
   cli.add_bool_arg('S', "no-split", "don't attempt to split into word and punctuation sections");
   cli.add_bool_arg('j', "jobs", "use one cpu core per section when minimising, new section after 50k entries");
+  cli.add_bool_arg('F', "flat", "write a memory-mappable binary that lt-proc can load without decoding");
+  cli.add_bool_arg('I', "index", "write a table of sections, so that readers can skip the ones they don't need");
+  cli.add_bool_arg('i', "incremental", "build unweighted entries straight into a minimal transducer, sorting them first if needed");
+  cli.add_bool_arg('P', "share-paradigms", "make one copy of each entry ending that starts with a paradigm, shared by every entry ending that way");
+  cli.add_str_arg('c', "cache", "keep minimised paradigms and sections in DIR and reuse the unchanged ones", "DIR");
+  cli.add_str_arg('M', "minimise", "minimisation algorithm: auto (default), brzozowski or hopcroft", "ALG");
   cli.add_bool_arg('V', "verbose", "compile verbosely");
   cli.add_bool_arg('h', "help", "print this message and exit");
   cli.add_file_arg("lr | rl | u", false);
@@ -78,6 +90,22 @@ int main(int argc, char *argv[])
   c.setEntryDebugging(cli.get_bools()["debug"]);
   c.setKeepBoundaries(cli.get_bools()["keep-boundaries"]);
   c.setVerbose(cli.get_bools()["verbose"]);
+  c.setIncremental(cli.get_bools()["incremental"]);
+  c.setShareParadigms(cli.get_bools()["share-paradigms"]);
+  if (args.find("cache") != args.end()) {
+    c.setCacheDir(args["cache"][0]);
+  }
+  if (args.find("minimise") != args.end()) {
+    auto& alg = args["minimise"][0];
+    if (alg == "brzozowski") {
+      c.setMinimisation(mm_brzozowski);
+    } else if (alg == "hopcroft") {
+      c.setMinimisation(mm_hopcroft);
+    } else if (alg != "auto") {
+      std::cerr << "Error: unknown minimisation algorithm '" << alg << "'" << std::endl;
+      cli.print_usage();
+    }
+  }
 
   a.setHfstSymbols(cli.get_bools()["hfst"]);
   a.setSplitting(!cli.get_bools()["no-split"]);
@@ -94,6 +122,9 @@ int main(int argc, char *argv[])
   if(const char* max_section_entries = std::getenv("LT_MAX_SECTION_ENTRIES")) {
     c.setMaxSectionEntries(std::stol(max_section_entries));
   }
+  if(const char* threads = std::getenv("LT_THREADS")) {
+    c.setThreads(std::stoul(threads));
+  }
 
   std::string opc = cli.get_files()[0];
   std::string infile = cli.get_files()[1];
@@ -168,14 +199,36 @@ int main(int argc, char *argv[])
     cli.print_usage();
   }
 
-  FILE* output = openOutBinFile(outfile);
+  bool flat = cli.get_bools()["flat"];
+  bool index = cli.get_bools()["index"];
+  // flat binaries are mapped by the programs reading them, so a file is
+  // never rewritten in place: the new one is renamed over the old one
+  std::string tmpfile = outfile;
+#ifdef HAVE_MMAP
+  if(!outfile.empty() && outfile != "-")
+  {
+    tmpfile = outfile + ".tmp" + std::to_string(getpid());
+  }
+#endif
+  FILE* output = openOutBinFile(tmpfile);
   if(ttype == 'a')
   {
-    a.write(output);
+    a.write(output, flat, index);
   }
   else
   {
-    c.write(output);
+    c.write(output, flat, index);
+  }
+  if(fclose(output) != 0)
+  {
+    std::cerr << "Error: Cannot write file '" << tmpfile << "'." << std::endl;
+    remove(tmpfile.c_str());
+    exit(EXIT_FAILURE);
+  }
+  if(tmpfile != outfile && rename(tmpfile.c_str(), outfile.c_str()) != 0)
+  {
+    std::cerr << "Error: Cannot open file '" << outfile << "' for writing." << std::endl;
+    remove(tmpfile.c_str());
+    exit(EXIT_FAILURE);
   }
-  fclose(output);
 }
@@ -48,12 +48,12 @@ void expand(Transducer& inter, int state, const std::set<int>& past_states,
   std::set<int> new_states = past_states;
   new_states.insert(state);
   for (auto& it : inter.getTransitions()[state]) {
-    if (past_states.find(it.second.first) != past_states.end()) {
+    if (past_states.find(it.target) != past_states.end()) {
       continue;
     }
     std::vector<int32_t> new_syms = syms;
-    new_syms.push_back(it.first);
-    expand(inter, it.second.first, new_states, new_syms, alpha, out, outset);
+    new_syms.push_back(it.tag);
+    expand(inter, it.target, new_states, new_syms, alpha, out, outset);
   }
 }
 
@@ -25,6 +25,7 @@ int main(int argc, char *argv[])
   CLI cli("dump a transducer to text in ATT format", PACKAGE_VERSION);
   cli.add_bool_arg('a', "alpha", "print transducer alphabet");
   cli.add_bool_arg('H', "hfst", "use HFST-compatible character escapes");
+  cli.add_str_arg('s', "section", "print only this section (can be repeated)", "NAME");
   cli.add_bool_arg('h', "help", "print this message and exit");
   cli.add_file_arg("bin_file");
   cli.add_file_arg("output_file");
@@ -40,7 +41,17 @@ int main(int argc, char *argv[])
   std::set<UChar32> alphabetic_chars;
   std::map<UString, Transducer> transducers;
 
-  readTransducerSet(input, alphabetic_chars, alphabet, transducers);
+  std::set<UString> sections;
+  for (auto& it : cli.get_strs()["section"]) {
+    sections.insert(to_ustring(it.c_str()));
+  }
+  SectionFilter wanted;
+  if (!sections.empty()) {
+    wanted = [&sections](UString const& name) {
+      return sections.find(name) != sections.end();
+    };
+  }
+  readTransducerSet(input, alphabetic_chars, alphabet, transducers, wanted);
 
   /////////////////////
 
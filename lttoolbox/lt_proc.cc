@@ -19,6 +19,28 @@
 #include <lttoolbox/cli.h>
 #include <lttoolbox/lt_locale.h>
 
+#include <csignal>
+
+#if HAVE_DECL_FMEMOPEN && !defined(_WIN32)
+#define LT_PROC_SERVER 1
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
 void checkValidity(FSTProcessor const &fstp)
 {
   if(!fstp.valid())
@@ -27,14 +49,20 @@ void checkValidity(FSTProcessor const &fstp)
   }
 }
 
-int main(int argc, char *argv[])
+void loadOrExit(FSTProcessor &fstp, FILE* in, std::string const &fname)
 {
-  LtLocale::tryToSetLocale();
+  try {
+    fstp.load(in);
+  } catch (std::exception& e) {
+    std::cerr << "Error: " << fname << ": " << e.what() << std::endl;
+    exit(EXIT_FAILURE);
+  }
+}
 
-  CLI cli("process a stream with a letter transducer", PACKAGE_VERSION);
-  cli.add_file_arg("fst_file", false);
-  cli.add_file_arg("input_file");
-  cli.add_file_arg("output_file");
+// options that choose and tune the processing mode, shared by the
+// command line and the entries of a --server dictionary list
+void addModeArgs(CLI& cli)
+{
   cli.add_bool_arg('a', "analysis", "morphological analysis (default behavior)");
   cli.add_bool_arg('b', "bilingual", "lexical transfer");
   cli.add_bool_arg('c', "case-sensitive", "use the literal case of the incoming characters");
@@ -61,11 +89,13 @@ int main(int argc, char *argv[])
   cli.add_str_arg('N', "analyses", "Output no more than N analyses (if the transducer is weighted, the N best analyses)", "N");
   cli.add_str_arg('L', "weight-classes", "Output no more than N best weight classes (where analyses with equal weight constitute a class)", "N");
   cli.add_str_arg('M', "compound-max-elements", "Set compound max elements", "N");
-  cli.add_bool_arg('h', "help", "show this help");
-  cli.parse_args(argc, argv);
+  cli.add_str_arg('k', "cache", "cache the results for up to N distinct words (-a, -e and -b)", "N");
+}
 
-  FSTProcessor fstp;
-  GenerationMode bilmode = gm_unknown;
+// apply the options added by addModeArgs() to fstp
+// @return the mode letter, or 0 for the default (analysis)
+char readModeArgs(CLI& cli, FSTProcessor& fstp, GenerationMode& bilmode)
+{
   char cmd = 0;
 
   auto args = cli.get_bools();
@@ -173,75 +203,758 @@ int main(int argc, char *argv[])
     }
     fstp.setCompoundMaxElements(n);
   }
+  if (strs.find("cache") != strs.end()) {
+    int n = atoi(strs["cache"].back().c_str());
+    if (n < 1) {
+      std::cerr << "Invalid or no argument for cache size" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    fstp.setCacheSize(n);
+  }
+  return cmd;
+}
 
-  FILE* in = openInBinFile(cli.get_files()[0]);
-  fstp.load(in);
-  fclose(in);
+void initMode(FSTProcessor& fstp, char cmd)
+{
+  switch(cmd)
+  {
+    case 'g':
+      fstp.initGeneration();
+      break;
 
-  InputFile input;
-  if (!cli.get_files()[1].empty()) {
-    input.open_or_exit(cli.get_files()[1].c_str());
+    case 'p':
+    case 't':
+      fstp.initPostgeneration();
+      break;
+
+    case 'b':
+      fstp.initBiltrans();
+      break;
+
+    case 'e':
+      fstp.initDecomposition();
+      break;
+
+    case 's':
+    case 'a':
+    default:
+      fstp.initAnalysis();
+      break;
   }
-  UFILE* output = openOutTextFile(cli.get_files()[2]);
+  checkValidity(fstp);
+}
 
-  try
+const char* modeName(char cmd)
+{
+  switch(cmd)
   {
-    switch(cmd)
-    {
-      case 'g':
-        fstp.initGeneration();
-        checkValidity(fstp);
-        fstp.generation(input, output, bilmode);
-        break;
+    case 'g': return "generation";
+    case 'p': return "post-generation";
+    case 's': return "sao";
+    case 't': return "transliteration";
+    case 'b': return "bilingual";
+    case 'e': return "decomposition";
+    default: return "analysis";
+  }
+}
 
-      case 'p':
-        fstp.initPostgeneration();
-        checkValidity(fstp);
-        fstp.postgeneration(input, output);
-        break;
+void runMode(FSTProcessor& fstp, char cmd, GenerationMode bilmode,
+             InputFile& input, OutputFile& output, size_t threads)
+{
+  switch(cmd)
+  {
+    case 'g':
+      fstp.generation(input, output, bilmode);
+      break;
 
-      case 's':
-        fstp.initAnalysis();
-        checkValidity(fstp);
-        fstp.SAO(input, output);
-        break;
+    case 'p':
+      fstp.postgeneration(input, output);
+      break;
 
-      case 't':
-        fstp.initPostgeneration();
-        checkValidity(fstp);
-        fstp.transliteration(input, output);
-        break;
+    case 's':
+      fstp.SAO(input, output);
+      break;
 
-      case 'b':
-        fstp.initBiltrans();
-        checkValidity(fstp);
-        fstp.bilingual(input, output, bilmode);
-        break;
+    case 't':
+      fstp.transliteration(input, output);
+      break;
 
-      case 'e':
-        fstp.initDecomposition();
-        checkValidity(fstp);
-        fstp.analysis(input, output);
-        break;
+    case 'b':
+      fstp.bilingual(input, output, bilmode);
+      break;
+
+    case 'e':
+    case 'a':
+    default:
+      fstp.parallelAnalysis(input, output, threads);
+      break;
+  }
+}
+
+#ifdef LT_PROC_SERVER
+namespace {
+
+struct Service
+{
+  FSTProcessor fstp;
+  char cmd = 0;
+  GenerationMode bilmode = gm_unknown;
+};
+
+typedef std::map<std::string, Service> Services;
+
+// requests with a message larger than this are refused and the
+// connection dropped; the messages are read in pieces as they come, so
+// this only bounds what one request can make the server hold
+constexpr uint32_t max_frame = 16u << 20;
+
+// a connection that sends nothing for this many seconds is closed, so
+// that idle clients don't hold on to their sockets
+constexpr time_t idle_timeout = 60;
+
+// how long to stop accepting after accept() fails with something other
+// than a client giving up, e.g. running out of file descriptors
+constexpr int accept_backoff = 1;
+
+// a frame is a 4-byte big-endian length followed by that many bytes
+void appendFrame(std::string& out, const std::string& frame)
+{
+  uint32_t size = frame.size();
+  out += char(size >> 24);
+  out += char(size >> 16);
+  out += char(size >> 8);
+  out += char(size);
+  out += frame;
+}
+
+// the length of the frame starting at pos of buf, if all four of its
+// bytes have arrived
+bool frameLength(const std::string& buf, size_t pos, uint32_t& size)
+{
+  if (buf.size() < pos + 4) {
+    return false;
+  }
+  const unsigned char* len = reinterpret_cast<const unsigned char*>(&buf[pos]);
+  size = (uint32_t(len[0]) << 24) | (uint32_t(len[1]) << 16) |
+         (uint32_t(len[2]) << 8) | uint32_t(len[3]);
+  return true;
+}
+
+enum RequestState { req_incomplete, req_ready, req_bad };
+
+// A request is two frames, the name and the text. If both have arrived
+// they are taken off the front of buf.
+RequestState takeRequest(std::string& buf, std::string& name, std::string& text)
+{
+  uint32_t name_size, text_size;
+  if (!frameLength(buf, 0, name_size)) {
+    return req_incomplete;
+  }
+  if (name_size > max_frame) {
+    return req_bad;
+  }
+  size_t text_pos = 4 + size_t(name_size);
+  if (!frameLength(buf, text_pos, text_size)) {
+    return req_incomplete;
+  }
+  if (text_size > max_frame) {
+    return req_bad;
+  }
+  size_t end = text_pos + 4 + text_size;
+  if (buf.size() < end) {
+    return req_incomplete;
+  }
+  name.assign(buf, 4, name_size);
+  text.assign(buf, text_pos + 4, text_size);
+  buf.erase(0, end);
+  return req_ready;
+}
+std::string process(Service& svc, std::string& text)
+{
+  OutputFile out;
+  out.open_in_memory();
+  InputFile in;
+  in.open_in_memory(&text[0], text.size());
+  std::exception_ptr error;
+  try {
+    runMode(svc.fstp, svc.cmd, svc.bilmode, in, out, 1);
+  } catch (...) {
+    error = std::current_exception();
+  }
+  std::string result = out.str();
+  svc.fstp.resetStream();
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  return result;
+}
+
+// the reply to one request, as the two frames to send back
+std::string answer(Services& services, const std::string& name, std::string& text)
+{
+  std::string status = "ok";
+  std::string body;
+  // a request for "a|b|c" goes through a, b and c in turn
+  std::vector<Service*> chain;
+  size_t start = 0;
+  while (true) {
+    size_t end = name.find('|', start);
+    std::string part = name.substr(start, end - start);
+    auto it = services.find(part);
+    if (it == services.end()) {
+      status = "error";
+      body = "Error: unknown dictionary '" + part + "'";
+      break;
+    }
+    chain.push_back(&it->second);
+    if (end == std::string::npos) {
+      break;
+    }
+    start = end + 1;
+  }
+  if (status == "ok") {
+    try {
+      for (auto svc : chain) {
+        text = process(*svc, text);
+      }
+      body.swap(text);
+    } catch (std::exception& e) {
+      status = "error";
+      body = e.what();
+    }
+  }
+  std::string reply;
+  appendFrame(reply, status);
+  appendFrame(reply, body);
+  return reply;
+}
+
+// Each line of the list is a name, a compiled dictionary and the
+// lt-proc options that select its mode, e.g.
+//   eng-morph eng.automorf.bin -a -w
+// Blank lines and lines starting with # are skipped. The names are
+// appended to order as they come. Entries without a -k of their own get
+// cache_size, if it isn't 0.
+Services readServices(const std::string& fname, std::vector<std::string>& order,
+                      size_t cache_size)
+{
+  std::ifstream list(fname);
+  if (!list) {
+    std::cerr << "Error: Unable to open '" << fname << "' for reading." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  Services services;
+  std::map<std::string, FSTProcessor> loaded;
+  std::string line;
+  int lineno = 0;
+  while (std::getline(list, line)) {
+    lineno++;
+    std::istringstream words(line);
+    std::vector<std::string> args;
+    std::string word;
+    while (words >> word) {
+      args.push_back(word);
+    }
+    if (args.empty() || args[0][0] == '#') {
+      continue;
+    }
+    std::string name = args[0];
+    if (services.find(name) != services.end()) {
+      std::cerr << "Error: " << fname << ":" << lineno << ": dictionary '"
+                << name << "' is listed twice." << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    args[0] = fname + ":" + std::to_string(lineno);
+    std::vector<char*> argv;
+    for (auto& a : args) {
+      argv.push_back(&a[0]);
+    }
+    argv.push_back(nullptr);
+    CLI cli("dictionary list entry");
+    addModeArgs(cli);
+    cli.add_file_arg("fst_file", false);
+    cli.parse_args(argv.size() - 1, argv.data());
+
+    // a file listed with several modes is only read once; the copies
+    // share its transducers
+    std::string file = cli.get_files()[0];
+    auto l = loaded.find(file);
+    if (l == loaded.end()) {
+      FILE* in = openInBinFile(file);
+      l = loaded.emplace(file, FSTProcessor()).first;
+      loadOrExit(l->second, in, file);
+      fclose(in);
+    }
+    Service& svc = services.emplace(name, Service{l->second}).first->second;
+    order.push_back(name);
+    if (cache_size > 0) {
+      svc.fstp.setCacheSize(cache_size);
+    }
+    svc.cmd = readModeArgs(cli, svc.fstp, svc.bilmode);
+    svc.fstp.setNullFlush(false);
+    initMode(svc.fstp, svc.cmd);
+  }
+  if (services.empty()) {
+    std::cerr << "Error: no dictionaries listed in '" << fname << "'." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  return services;
+}
 
-      case 'a':
+void serve(const std::string& path, Services const &services, size_t threads)
+{
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "Error: socket path '" << path << "' is too long." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+  // a socket left behind by an earlier server is replaced, anything
+  // else is left alone
+  struct stat st;
+  if (stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+    unlink(path.c_str());
+  }
+  int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0 || bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      listen(sock, SOMAXCONN) != 0) {
+    std::cerr << "Error: cannot listen on '" << path << "': " << strerror(errno) << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  fcntl(sock, F_SETFL, O_NONBLOCK);
+  // a client hanging up early must not take the server down with it
+  signal(SIGPIPE, SIG_IGN);
+
+  // The workers write a byte here when they finish a request, to wake
+  // up the loop below.
+  int wake[2];
+  if (pipe(wake) != 0) {
+    std::cerr << "Error: cannot create pipe: " << strerror(errno) << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  fcntl(wake[0], F_SETFL, O_NONBLOCK);
+  fcntl(wake[1], F_SETFL, O_NONBLOCK);
+
+  struct Request
+  {
+    uint64_t conn;
+    std::string name, text;
+  };
+  std::mutex mtx;
+  std::condition_variable ready;
+  std::deque<Request> requests;
+  std::vector<std::pair<uint64_t, std::string>> replies;
+
+  auto worker = [&]() {
+    // every thread works on its own copies of the processors, which
+    // share the transducers of the originals
+    Services local = services;
+    while (true) {
+      Request req;
+      {
+        std::unique_lock<std::mutex> lock(mtx);
+        ready.wait(lock, [&]() { return !requests.empty(); });
+        req = std::move(requests.front());
+        requests.pop_front();
+      }
+      std::string reply = answer(local, req.name, req.text);
+      {
+        std::lock_guard<std::mutex> lock(mtx);
+        replies.emplace_back(req.conn, std::move(reply));
+      }
+      char c = 0;
+      (void)!write(wake[1], &c, 1);
+    }
+  };
+  std::vector<std::thread> pool;
+  for (size_t i = 0; i < threads; i++) {
+    pool.emplace_back(worker);
+  }
+
+  // This thread does all the reading and writing. It reads whatever
+  // each connection sends and hands every complete request to the
+  // workers, so a handful of clients can't keep the others waiting.
+  // A connection has one request with the workers at a time and isn't
+  // read from until its reply is sent, which keeps the replies in order.
+  struct Connection
+  {
+    int fd;
+    std::string in, out;
+    size_t sent = 0;
+    bool busy = false;
+    time_t last;
+  };
+  std::map<uint64_t, Connection> conns;
+  uint64_t next_conn = 0;
+  time_t accept_paused_until = 0;
+
+  auto closeConn = [&](std::map<uint64_t, Connection>::iterator it) {
+    close(it->second.fd);
+    return conns.erase(it);
+  };
+  // hand the next request of an idle connection to the workers; false
+  // if what it sent can't be a request
+  auto dispatch = [&](uint64_t id, Connection& c) {
+    Request req;
+    req.conn = id;
+    switch (takeRequest(c.in, req.name, req.text)) {
+      case req_bad:
+        return false;
+      case req_ready:
+        c.busy = true;
+        {
+          std::lock_guard<std::mutex> lock(mtx);
+          requests.push_back(std::move(req));
+        }
+        ready.notify_one();
+        return true;
       default:
-        fstp.initAnalysis();
-        checkValidity(fstp);
-        fstp.analysis(input, output);
+        return true;
+    }
+  };
+
+  std::vector<pollfd> fds;
+  std::vector<uint64_t> ids;
+  while (true) {
+    time_t now = time(nullptr);
+    fds.clear();
+    ids.clear();
+    fds.push_back({wake[0], POLLIN, 0});
+    fds.push_back({now >= accept_paused_until ? sock : -1, POLLIN, 0});
+    for (auto& it : conns) {
+      Connection& c = it.second;
+      if (c.sent < c.out.size()) {
+        fds.push_back({c.fd, POLLOUT, 0});
+      } else if (!c.busy) {
+        fds.push_back({c.fd, POLLIN, 0});
+      } else {
+        continue;
+      }
+      ids.push_back(it.first);
+    }
+    // wake up once a second while there are timeouts to check
+    int timeout = (conns.empty() && now >= accept_paused_until) ? -1 : 1000;
+    if (poll(fds.data(), fds.size(), timeout) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "Error: poll failed: " << strerror(errno) << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    now = time(nullptr);
+
+    if (fds[0].revents) {
+      char buf[256];
+      while (read(wake[0], buf, sizeof(buf)) > 0) {}
+      std::vector<std::pair<uint64_t, std::string>> done;
+      {
+        std::lock_guard<std::mutex> lock(mtx);
+        done.swap(replies);
+      }
+      for (auto& r : done) {
+        auto it = conns.find(r.first);
+        if (it != conns.end()) {
+          it->second.busy = false;
+          it->second.out = std::move(r.second);
+          it->second.sent = 0;
+        }
+      }
+    }
+
+    if (fds[1].revents) {
+      while (true) {
+        int conn = accept(sock, nullptr, nullptr);
+        if (conn >= 0) {
+          fcntl(conn, F_SETFL, O_NONBLOCK);
+          conns[next_conn++] = Connection{conn, "", "", 0, false, now};
+          continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          break;
+        } else if (errno == EINTR || errno == ECONNABORTED) {
+          continue;
+        }
+        std::cerr << "Warning: accept failed: " << strerror(errno) << std::endl;
+        accept_paused_until = now + accept_backoff;
         break;
+      }
     }
+
+    for (size_t i = 2; i < fds.size(); i++) {
+      if (!fds[i].revents) {
+        continue;
+      }
+      auto it = conns.find(ids[i - 2]);
+      Connection& c = it->second;
+      bool ok = true;
+      if (fds[i].events & POLLOUT) {
+        ssize_t r = send(c.fd, c.out.data() + c.sent, c.out.size() - c.sent, 0);
+        if (r > 0) {
+          c.sent += r;
+          if (c.sent == c.out.size()) {
+            c.out.clear();
+            c.sent = 0;
+            c.last = now;
+            // the client may have sent its next request already
+            ok = dispatch(it->first, c);
+          }
+        } else if (r < 0 && (errno == EAGAIN || errno == EINTR)) {
+          continue;
+        } else {
+          ok = false;
+        }
+      } else {
+        char buf[65536];
+        ssize_t r = read(c.fd, buf, sizeof(buf));
+        if (r > 0) {
+          c.in.append(buf, r);
+          c.last = now;
+          ok = dispatch(it->first, c);
+        } else if (r < 0 && (errno == EAGAIN || errno == EINTR)) {
+          continue;
+        } else {
+          ok = false;
+        }
+      }
+      if (!ok) {
+        closeConn(it);
+      }
+    }
+
+    for (auto it = conns.begin(); it != conns.end();) {
+      Connection& c = it->second;
+      if (!c.busy && c.out.empty() && now - c.last >= idle_timeout) {
+        it = closeConn(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+}
+
+// Run each stage in a thread of its own, reading what the one before
+// it writes to a pipe, so that the stages overlap as they would in a
+// shell pipeline but share one process and one load of every file.
+// Where a stage can write the binary form of the stream and the next
+// one can read it, that is what goes through the pipe, so the readings
+// are not escaped and parsed again in between.
+void runPipeline(Services& services, std::vector<std::string> const &order,
+                 std::string const &infile, std::string const &outfile,
+                 bool null_flush, size_t threads)
+{
+  size_t n = order.size();
+  for (size_t i = 0; i + 1 < n; i++) {
+    Service& from = services[order[i]];
+    Service& to = services[order[i+1]];
+    if (from.cmd == 'b' && (to.cmd == 'b' || to.cmd == 'g')) {
+      from.fstp.setBinaryOutput(true);
+      to.fstp.setBinaryInput(true);
+    }
+  }
+  std::vector<InputFile> inputs(n);
+  std::vector<OutputFile> outputs(n);
+  std::vector<int> write_fds(n, -1);
+  if (!infile.empty()) {
+    inputs[0].open_or_exit(infile.c_str());
+  }
+  outputs[n-1].open_or_exit(outfile.empty() ? nullptr : outfile.c_str());
+  for (size_t i = 0; i + 1 < n; i++) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+      std::cerr << "Error: cannot create pipe: " << strerror(errno) << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    outputs[i].wrap_fd(fds[1]);
+    write_fds[i] = fds[1];
+    inputs[i+1].wrap(fdopen(fds[0], "rb"));
+  }
+  // a stage that fails closes its input, which makes the one before
+  // it fail to write instead of being killed
+  signal(SIGPIPE, SIG_IGN);
+
+  std::vector<std::exception_ptr> errors(n);
+  auto stage = [&](size_t i) {
+    Service& svc = services[order[i]];
+    svc.fstp.setNullFlush(null_flush);
+    try {
+      runMode(svc.fstp, svc.cmd, svc.bilmode, inputs[i], outputs[i], threads);
+    } catch (...) {
+      errors[i] = std::current_exception();
+      outputs[i].flush();
+      if (null_flush) {
+        outputs[i].put('\0');
+      }
+    }
+    try {
+      outputs[i].close();
+    } catch (...) {
+      if (!errors[i]) {
+        errors[i] = std::current_exception();
+      }
+    }
+    if (write_fds[i] != -1) {
+      close(write_fds[i]);
+    }
+    inputs[i].close();
+  };
+  std::vector<std::thread> pool;
+  for (size_t i = 0; i < n; i++) {
+    pool.emplace_back(stage, i);
+  }
+  for (auto& t : pool) {
+    t.join();
+  }
+  // the last failure is the cause of any before it, which are stages
+  // that could no longer write
+  for (size_t i = n; i-- > 0; ) {
+    if (errors[i]) {
+      try {
+        std::rethrow_exception(errors[i]);
+      } catch (std::exception& e) {
+        std::cerr << e.what();
+      }
+      exit(1);
+    }
+  }
+}
+
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+  LtLocale::tryToSetLocale();
+
+  CLI cli("process a stream with a letter transducer", PACKAGE_VERSION);
+  cli.add_file_arg("fst_file", false);
+  cli.add_file_arg("input_file");
+  cli.add_file_arg("output_file");
+  addModeArgs(cli);
+  cli.add_str_arg('j', "threads", "analyse with N threads (-a and -e only)", "N");
+#ifdef LT_PROC_SERVER
+  cli.add_str_arg('S', "server", "serve the dictionaries listed in fst_file on a Unix socket", "socket");
+  cli.add_bool_arg('P', "pipeline", "run the input through the dictionaries listed in fst_file in turn (lt-proc modes only, no external programs)");
+#endif
+  cli.add_bool_arg('y', "binary-input", "read the binary form of the stream (-g and -b only)");
+  cli.add_bool_arg('Y', "binary-output", "write the binary form of the stream (-b only)");
+  cli.add_str_arg('T', "stats", "write statistics as JSON to FILE (- for stderr) at exit and on SIGUSR1", "FILE");
+  cli.add_bool_arg('h', "help", "show this help");
+  cli.parse_args(argc, argv);
+
+  FSTProcessor fstp;
+  GenerationMode bilmode = gm_unknown;
+  char cmd = readModeArgs(cli, fstp, bilmode);
+
+  auto bools = cli.get_bools();
+  if (bools["binary-input"]) {
+    if (cmd != 'g' && cmd != 'b') {
+      std::cerr << "Error: --binary-input only works with generation (-g) and lexical transfer (-b)" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    fstp.setBinaryInput(true);
+  }
+  if (bools["binary-output"]) {
+    if (cmd != 'b') {
+      std::cerr << "Error: --binary-output only works with lexical transfer (-b)" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    fstp.setBinaryOutput(true);
+  }
+
+  auto strs = cli.get_strs();
+  if (strs.find("stats") != strs.end()) {
+    fstp.setStats(true);
+    if (strs["stats"].back() != "-") {
+      fstp.getStats()->report_path = strs["stats"].back();
+    }
+#ifdef SIGUSR1
+    signal(SIGUSR1, ProcessorStats::requestReport);
+#endif
+  }
+  bool server = (strs.find("server") != strs.end());
+  size_t threads = 1;
+  if (strs.find("threads") != strs.end()) {
+    int n = atoi(strs["threads"].back().c_str());
+    if (n < 1) {
+      std::cerr << "Invalid or no argument for thread count" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    if (!server && cmd && cmd != 'a' && cmd != 'e') {
+      std::cerr << "Error: --threads only works with analysis (-a) and decomposition (-e)" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    threads = n;
+  }
+
+#ifdef LT_PROC_SERVER
+  if ((server || cli.get_bools()["pipeline"]) && fstp.getStats()) {
+    std::cerr << "Error: --stats does not work with --server or --pipeline" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  // a -k on the command line is the default for the listed dictionaries
+  size_t cache_size = 0;
+  if (strs.find("cache") != strs.end()) {
+    cache_size = atoi(strs["cache"].back().c_str());
+  }
+  if (server) {
+    if (!cli.get_files()[1].empty()) {
+      cli.print_usage();
+    }
+    if (strs.find("threads") == strs.end()) {
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    std::vector<std::string> order;
+    serve(strs["server"].back(), readServices(cli.get_files()[0], order, cache_size), threads);
+    return EXIT_SUCCESS;
+  }
+  if (cli.get_bools()["pipeline"]) {
+    std::vector<std::string> order;
+    Services services = readServices(cli.get_files()[0], order, cache_size);
+    runPipeline(services, order, cli.get_files()[1], cli.get_files()[2],
+                fstp.getNullFlush(), threads);
+    return EXIT_SUCCESS;
+  }
+#endif
+
+  FILE* in = openInBinFile(cli.get_files()[0]);
+  loadOrExit(fstp, in, cli.get_files()[0]);
+  fclose(in);
+
+  InputFile input;
+  if (!cli.get_files()[1].empty()) {
+    input.open_or_exit(cli.get_files()[1].c_str());
+  }
+  OutputFile output;
+  output.open_or_exit(cli.get_files()[2].empty() ? nullptr : cli.get_files()[2].c_str());
+
+  try
+  {
+    initMode(fstp, cmd);
+    ProcessorStats::Timer timer(fstp.getStats(), modeName(cmd));
+    runMode(fstp, cmd, bilmode, input, output, threads);
   }
   catch (std::exception& e)
   {
+    output.flush();
     std::cerr << e.what();
     if (fstp.getNullFlush()) {
-      u_fputc('\0', output);
+      output.put('\0');
+      output.flush();
     }
 
     exit(1);
   }
 
-  u_fclose(output);
+  output.close();
+  if (strs.find("cache") != strs.end()) {
+    std::cerr << "Cache: " << fstp.getCacheHits() << " hits, "
+              << fstp.getCacheMisses() << " misses" << std::endl;
+  }
+  if (fstp.getStats()) {
+    fstp.getStats()->report();
+  }
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2024 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+#include <lttoolbox/binary_stream.h>
+#include <lttoolbox/cli.h>
+#include <lttoolbox/input_file.h>
+#include <lttoolbox/lt_locale.h>
+#include <lttoolbox/output_file.h>
+#include <lttoolbox/stream_reader.h>
+
+#include <iostream>
+
+void toBinary(InputFile& input, OutputFile& output)
+{
+  Alphabet alpha;
+  StreamReader reader(&input);
+  reader.alpha = &alpha;
+  reader.add_unknowns = true;
+  BinaryStreamWriter writer(&output);
+  writer.finish();
+  while (!reader.at_eof) {
+    reader.next();
+    writer.blank(reader.blank);
+    if (!reader.readings.empty()) {
+      writer.wblank(reader.wblank);
+      writer.chunk(reader.chunk);
+      writer.unit(reader.readings, alpha);
+    }
+    else {
+      writer.blank(reader.wblank);
+    }
+    if (reader.at_null) {
+      writer.null();
+    }
+  }
+}
+
+void toText(InputFile& input, OutputFile& output)
+{
+  StreamReader reader(&input);
+  reader.setBinary();
+  while (!reader.at_eof) {
+    reader.next();
+    output.write(reader.blank);
+    output.write(reader.wblank);
+    if (!reader.readings.empty()) {
+      output.put('^');
+      for (size_t i = 0; i < reader.readings.size(); i++) {
+        if (i > 0) {
+          output.put('/');
+        }
+        if (reader.readings[i].mark) {
+          output.put(reader.readings[i].mark);
+        }
+        output.write(reader.readings[i].content);
+      }
+      output.write(reader.chunk);
+      output.put('$');
+    }
+    if (reader.at_null) {
+      output.put('\0');
+      output.flush();
+    }
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  LtLocale::tryToSetLocale();
+
+  CLI cli("convert a stream between its text and binary forms", PACKAGE_VERSION);
+  cli.add_bool_arg('t', "text", "convert from binary to text (the default is text to binary)");
+  cli.add_bool_arg('h', "help", "print this message and exit");
+  cli.add_file_arg("input_file");
+  cli.add_file_arg("output_file");
+  cli.parse_args(argc, argv);
+
+  InputFile input;
+  if (!cli.get_files()[0].empty()) {
+    input.open_or_exit(cli.get_files()[0].c_str());
+  }
+  OutputFile output;
+  output.open_or_exit(cli.get_files()[1].empty() ? nullptr : cli.get_files()[1].c_str());
+
+  try {
+    if (cli.get_bools()["text"]) {
+      toText(input, output);
+    }
+    else {
+      toBinary(input, output);
+    }
+  }
+  catch (std::exception& e) {
+    output.flush();
+    std::cerr << e.what();
+    exit(EXIT_FAILURE);
+  }
+  output.close();
+  return EXIT_SUCCESS;
+}
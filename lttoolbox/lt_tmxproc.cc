@@ -46,10 +46,10 @@ int main(int argc, char *argv[])
   if (!cli.get_files()[1].empty()) {
     input.open_or_exit(cli.get_files()[1].c_str());
   }
-  UFILE* output = openOutTextFile(cli.get_files()[2].c_str());
+  OutputFile output;
+  output.open_or_exit(cli.get_files()[2].empty() ? nullptr : cli.get_files()[2].c_str());
 
   fstp.tm_analysis(input, output, tm_mode);
 
-  u_fclose(output);
   return EXIT_SUCCESS;
 }
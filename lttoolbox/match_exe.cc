@@ -42,7 +42,7 @@ MatchExe::MatchExe(Transducer const &t, std::map<int, int > const &final_type)
   for(auto it = t.transitions.begin(),
         limit = t.transitions.end(); it != limit; it++)
   {
-    MatchNode mynode(it->second.size());
+    MatchNode mynode(it->size());
     node_list.push_back(mynode);
   }
 
@@ -57,15 +57,14 @@ MatchExe::MatchExe(Transducer const &t, std::map<int, int > const &final_type)
   initial_id = t.initial;
 
   // set up the transitions
-  for(auto it = t.transitions.begin(),
-        limit = t.transitions.end(); it != limit; it++)
+  for(size_t state = 0; state != t.transitions.size(); state++)
   {
-    MatchNode &mynode = node_list[it->first];
+    MatchNode &mynode = node_list[state];
     int i = 0;
-    for(auto it2 = it->second.begin(),
-          limit2 = it->second.end(); it2 != limit2; it2++)
+    for(auto it2 = t.transitions[state].begin(),
+          limit2 = t.transitions[state].end(); it2 != limit2; it2++)
     {
-      mynode.addTransition(it2->first, &node_list[it2->second.first], it2->second.second, i++);
+      mynode.addTransition(it2->tag, &node_list[it2->target], it2->weight, i++);
     }
   }
 }
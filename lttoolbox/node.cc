@@ -16,69 +16,43 @@
  */
 #include <lttoolbox/node.h>
 
-Node::Node()
+std::pair<uint32_t, uint32_t>
+Node::find(int32_t const i) const
 {
-}
-
-Node::~Node()
-{
-  destroy();
-}
-
-Node::Node(Node const &n)
-{
-  copy(n);
-}
+  int32_t const *keys = inputs();
+  uint32_t const n = size();
+  uint32_t first = 0;
 
-Node &
-Node::operator =(Node const &n)
-{
-  if(this != &n)
+  if(n <= 16)
   {
-    destroy();
-    copy(n);
+    // most nodes are narrow, where a scan beats branching around
+    while(first != n && keys[first] < i)
+    {
+      first++;
+    }
   }
-  return *this;
-}
-
-void
-Node::copy(Node const &n)
-{
-  transitions = n.transitions;
-}
-
-void
-Node::destroy()
-{
-}
-
-void
-Node::addTransition(int const i, int const o, Node * const d, double const wt)
-{
-  Dest &aux = transitions[i];
-  aux.size++;
-  int *out_tag = new int[aux.size];
-  Node **dest = new Node*[aux.size];
-  double *out_weight = new double[aux.size];
-
-  for(int i = 0; i<aux.size-1; i++)
+  else
   {
-    out_tag[i] = aux.out_tag[i];
-    dest[i] = aux.dest[i];
-    out_weight[i] = aux.out_weight[i];
+    uint32_t count = n;
+    while(count > 0)
+    {
+      uint32_t half = count / 2;
+      if(keys[first + half] < i)
+      {
+        first += half + 1;
+        count -= half + 1;
+      }
+      else
+      {
+        count = half;
+      }
+    }
   }
 
-  if(aux.size > 1)
+  uint32_t last = first;
+  while(last != n && keys[last] == i)
   {
-    delete[] aux.out_tag;
-    delete[] aux.dest;
-    delete[] aux.out_weight;
+    last++;
   }
-
-  out_tag[aux.size-1] = o;
-  dest[aux.size-1] = d;
-  out_weight[aux.size-1] = wt;
-  aux.out_tag = out_tag;
-  aux.dest = dest;
-  aux.out_weight = out_weight;
+  return {first, last};
 }
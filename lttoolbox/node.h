@@ -18,151 +18,223 @@
 #ifndef _NODE_
 #define _NODE_
 
-#include <cstdlib>
-#include <list>
-#include <map>
+#include <cstdint>
+#include <utility>
 
-class State;
-class Node;
-
-
-class Dest
+/**
+ * Runtime node, a fixed-width record shared by the in-memory and the
+ * memory-mapped transducer layouts.
+ *
+ * The outgoing transitions of a node are stored in a block of parallel
+ * arrays: the input symbols in ascending order, then the output symbols
+ * and the destinations, then the weights (only if any of them is not the
+ * default).  Offsets are relative to the node record itself, so the
+ * layout is position independent.
+ *
+ * A final node has its final weight right after its transitions.  A
+ * node with epsilon transitions usually has its epsilon closure after
+ * that, as a table of EpsilonStep, so that State can expand it without
+ * walking the transitions again.
+ */
+class Node
 {
 private:
-  int size;
-  int *out_tag;
-  Node **dest;
-  double *out_weight;
+  friend class TransExe;
+
+  static constexpr uint32_t weighted_flag = 0x80000000u;
+  static constexpr uint32_t epsilon_flag = 0x40000000u;
+  static constexpr uint32_t closure_flag = 0x20000000u;
 
-  friend class State;
-  friend class Node;
+  /**
+   * Byte offset from this record to its block of transitions
+   */
+  int32_t trans;
 
-  void copy(Dest const &d)
+  /**
+   * Number of outgoing transitions, plus weighted_flag if the block
+   * carries weights, epsilon_flag if some of them read nothing,
+   * closure_flag if the block is followed by the epsilon closure and
+   * the public flags below
+   */
+  uint32_t size_flags;
+
+  char const * block() const
   {
-    destroy();
-    size = d.size;
-    out_tag = new int[size];
-    dest = new Node*[size];
-    out_weight = new double[size];
+    return reinterpret_cast<char const *>(this) + trans;
   }
 
-  void destroy()
+  /**
+   * Offset of the weight array in a block of n transitions
+   */
+  static uint32_t weightOffset(uint32_t n)
   {
-    if(size != 0)
-    {
-      size = 0;
-      if(out_tag)
-      {
-        delete[] out_tag;
-      }
-      if(dest)
-      {
-        delete[] dest;
-      }
-      if(out_weight)
-      {
-        delete[] out_weight;
-      }
-    }
+    return (n * 12 + 7) & ~7u;
   }
 
-  void init()
+  /**
+   * Size in bytes of a block of n transitions
+   */
+  static uint32_t blockSize(uint32_t n, bool weighted)
   {
-    size = 0;
-    out_tag = NULL;
-    dest = NULL;
-    out_weight = NULL;
+    return weighted ? weightOffset(n) + n * 8 : n * 12;
   }
 
-public:
-  Dest()
+  /**
+   * Offset from this record of the final weight, which is aligned like
+   * the records (and the image) are
+   */
+  int32_t finalOffset() const
   {
-    init();
+    return (trans + blockSize(size(), size_flags & weighted_flag) + 7) & ~7;
   }
 
-  ~Dest()
+  /**
+   * Offset from this record of the epsilon closure
+   */
+  int32_t closureOffset() const
   {
-    destroy();
+    return finalOffset() + ((size_flags & final_flag) ? 8 : 0);
   }
 
-  Dest(Dest const &d)
+public:
+  /**
+   * Set on final nodes
+   */
+  static constexpr uint32_t final_flag = 0x10000000u;
+
+  /**
+   * Set on all the nodes of sections of these types, so that finals
+   * of a type are told apart without looking them up
+   */
+  static constexpr uint32_t inconditional_flag = 0x08000000u;
+  static constexpr uint32_t postblank_flag = 0x04000000u;
+  static constexpr uint32_t preblank_flag = 0x02000000u;
+
+  static constexpr uint32_t section_flags = inconditional_flag | postblank_flag | preblank_flag;
+  static constexpr uint32_t all_flags = weighted_flag | epsilon_flag | closure_flag
+                                        | final_flag | section_flags;
+
+  /**
+   * A node reached from this one through epsilon transitions only,
+   * by way of an earlier step of the closure (or none, with parent -1).
+   * Steps come in the order of a breadth-first walk, which is that of
+   * State's own.
+   */
+  struct EpsilonStep
   {
-    init();
-    copy(d);
-  }
+    int32_t dest;    // offset from the record of the node of the closure
+    int32_t output;  // output symbol of the last transition
+    int32_t parent;
+    uint32_t depth;  // number of transitions, from 1
+    double weight;   // weight of the last transition
+  };
 
-  Dest & operator=(Dest const &d)
+  /**
+   * Number of outgoing transitions
+   */
+  uint32_t size() const
   {
-    if(this != &d)
-    {
-      destroy();
-      copy(d);
-    }
-    return *this;
+    return size_flags & ~all_flags;
   }
-};
 
+  /**
+   * Whether the node has all of the given public flags
+   */
+  bool hasFlags(uint32_t flags) const
+  {
+    return (size_flags & flags) == flags;
+  }
 
+  bool isFinal() const
+  {
+    return size_flags & final_flag;
+  }
 
-/**
- * Node class of TransExe.  State is a friend class since the
- * algorithms are implemented in State
- */
-class Node
-{
-private:
-  friend class State;
+  /**
+   * Weight of the node as a final state, only for final nodes
+   */
+  double finalWeight() const
+  {
+    return *reinterpret_cast<double const *>(reinterpret_cast<char const *>(this) + finalOffset());
+  }
 
   /**
-   * The outgoing transitions of this node.
-   * Schema: (input symbol, (output symbol, destination, weight))
+   * Whether some of the transitions read nothing
    */
-  std::map<int, Dest> transitions;
+  bool hasEpsilons() const
+  {
+    return size_flags & epsilon_flag;
+  }
 
   /**
-   * Copy method
-   * @param n the node to be copied
+   * Number of steps of the epsilon closure, 0 if it has none, or if it
+   * was too large or cyclic to store and has to be walked
    */
-  void copy(Node const &n);
+  uint32_t closureSize() const
+  {
+    if(!(size_flags & closure_flag))
+    {
+      return 0;
+    }
+    return *reinterpret_cast<uint32_t const *>(reinterpret_cast<char const *>(this) + closureOffset());
+  }
 
   /**
-   * Destroy method
+   * Steps of the epsilon closure
    */
-  void destroy();
+  EpsilonStep const * closure() const
+  {
+    return reinterpret_cast<EpsilonStep const *>(reinterpret_cast<char const *>(this) + closureOffset() + 8);
+  }
 
-public:
+  Node const * closureDest(EpsilonStep const &step) const
+  {
+    return reinterpret_cast<Node const *>(reinterpret_cast<char const *>(this) + step.dest);
+  }
 
   /**
-   * Constructor
+   * Input symbols of the transitions, in ascending order
    */
-  Node();
+  int32_t const * inputs() const
+  {
+    return reinterpret_cast<int32_t const *>(block());
+  }
 
   /**
-   * Destructor
+   * Output symbols of the transitions
    */
-  ~Node();
+  int32_t const * outputs() const
+  {
+    return inputs() + size();
+  }
 
   /**
-   * Copy constructor
-   * @param n the node to be copied
+   * Destination of the j-th transition
    */
-  Node(Node const &n);
+  Node const * dest(uint32_t j) const
+  {
+    int32_t const *d = inputs() + 2 * size();
+    return reinterpret_cast<Node const *>(reinterpret_cast<char const *>(this) + d[j]);
+  }
 
   /**
-   * Assignment operator
-   * @param n the node to be assigned
-   * @return the assigned object
+   * Weight of the j-th transition
    */
-  Node & operator=(Node const &n);
+  double weight(uint32_t j) const
+  {
+    if(!(size_flags & weighted_flag))
+    {
+      return 0.0;
+    }
+    return reinterpret_cast<double const *>(block() + weightOffset(size()))[j];
+  }
 
   /**
-   * Making a link between this node and another
+   * Transitions reading a given input symbol
    * @param i input symbol
-   * @param o output symbol
-   * @param d destination
-   * @param w weight value
+   * @return the (possibly empty) range of matching transition indices
    */
-  void addTransition(int i, int o, Node * const d, double wt);
+  std::pair<uint32_t, uint32_t> find(int32_t i) const;
 };
 
 #endif
@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2022 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <lttoolbox/output_file.h>
+#include <lttoolbox/my_stdio.h>
+#include <unicode/utf8.h>
+#include <unicode/utf16.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#ifdef _WIN32
+#include <io.h>
+typedef int ssize_t;
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+ssize_t
+write_fd(int fd, const char* bytes, size_t length)
+{
+#ifdef _WIN32
+  return _write(fd, bytes, static_cast<unsigned int>(length));
+#else
+  return ::write(fd, bytes, length);
+#endif
+}
+}
+
+OutputFile::OutputFile()
+  : outfile(stdout), fd(-1), owned(false), in_memory(false), lead(0)
+{
+  buffer.reserve(WRITE_SIZE + 4);
+}
+
+OutputFile::~OutputFile()
+{
+  close();
+}
+
+bool
+OutputFile::open(const char* fname)
+{
+  close();
+  if (fname == nullptr || strcmp(fname, "-") == 0) {
+    outfile = stdout;
+  } else {
+    outfile = fopen(fname, "wb");
+    owned = (outfile != nullptr);
+  }
+  return (outfile != nullptr);
+}
+
+void
+OutputFile::open_or_exit(const char* fname)
+{
+  if (!open(fname)) {
+    std::cerr << "Error: Cannot open file '" << fname << "' for writing." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
+void
+OutputFile::open_in_memory()
+{
+  close();
+  in_memory = true;
+}
+
+void
+OutputFile::wrap(FILE* newoutfile)
+{
+  close();
+  outfile = newoutfile;
+}
+
+void
+OutputFile::wrap_fd(int newfd)
+{
+  close();
+  fd = newfd;
+}
+
+void
+OutputFile::close()
+{
+  if (outfile != nullptr || fd != -1) {
+    flush();
+  }
+  if (owned) {
+    fclose(outfile);
+  }
+  outfile = nullptr;
+  fd = -1;
+  owned = false;
+  in_memory = false;
+  buffer.clear();
+  lead = 0;
+}
+
+void
+OutputFile::drain()
+{
+  if (in_memory || buffer.empty()) {
+    return;
+  }
+  if (outfile != nullptr) {
+    if (fwrite_unlocked(buffer.data(), 1, buffer.size(), outfile) != buffer.size()) {
+      buffer.clear();
+      throw std::runtime_error("Error: failed to write output.");
+    }
+  } else if (fd != -1) {
+    const char* p = buffer.data();
+    size_t left = buffer.size();
+    while (left > 0) {
+      ssize_t r = write_fd(fd, p, left);
+      if (r < 0 && errno == EINTR) {
+        continue;
+      } else if (r <= 0) {
+        buffer.clear();
+        throw std::runtime_error("Error: failed to write output.");
+      }
+      p += r;
+      left -= r;
+    }
+  }
+  buffer.clear();
+}
+
+void
+OutputFile::flush()
+{
+  drain();
+  if (outfile != nullptr) {
+    fflush(outfile);
+  }
+}
+
+void
+OutputFile::putMultibyte(UChar32 c)
+{
+  if (lead != 0) {
+    if (U16_IS_TRAIL(c)) {
+      c = U16_GET_SUPPLEMENTARY(lead, c);
+      lead = 0;
+    } else {
+      UChar32 unpaired = lead;
+      lead = 0;
+      putMultibyte(unpaired);
+    }
+  } else if (U16_IS_LEAD(c)) {
+    lead = c;
+    return;
+  }
+  size_t i = buffer.size();
+  buffer.resize(i + U8_LENGTH(c));
+  U8_APPEND_UNSAFE(&buffer[0], i, c);
+  if (buffer.size() >= WRITE_SIZE && !in_memory) {
+    drain();
+  }
+}
+
+void
+OutputFile::write(UStringView str)
+{
+  size_t i = 0;
+  size_t n = str.size();
+  if (lead != 0 && n > 0) {
+    put(str[i++]);
+  }
+  while (i < n) {
+    // copy runs of ASCII without looking at each one twice
+    size_t start = i;
+    while (i < n && str[i] < 0x80) {
+      i++;
+    }
+    if (i > start) {
+      size_t pos = buffer.size();
+      buffer.resize(pos + (i - start));
+      for (size_t j = start; j < i; j++) {
+        buffer[pos++] = static_cast<char>(str[j]);
+      }
+    }
+    if (i < n) {
+      UChar32 c;
+      U16_NEXT(str.data(), i, n, c);
+      if (U_IS_SURROGATE(c)) {
+        putMultibyte(c);
+        continue;
+      }
+      size_t pos = buffer.size();
+      buffer.resize(pos + U8_LENGTH(c));
+      U8_APPEND_UNSAFE(&buffer[0], pos, c);
+    }
+    if (buffer.size() >= WRITE_SIZE && !in_memory) {
+      drain();
+    }
+  }
+}
+
+void
+OutputFile::write(const char* bytes, size_t length)
+{
+  buffer.append(bytes, length);
+  if (buffer.size() >= WRITE_SIZE && !in_memory) {
+    drain();
+  }
+}
+
+std::string const&
+OutputFile::str() const
+{
+  return buffer;
+}
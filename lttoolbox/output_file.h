@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2022 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LT_OUTPUT_FILE_H_
+#define _LT_OUTPUT_FILE_H_
+
+#include <cstdio>
+#include <string>
+#include <unicode/uchar.h>
+#include <lttoolbox/ustring.h>
+
+/**
+ * UTF-8 text sink. Output is encoded straight into a buffer which
+ * goes to the target when it fills up or on flush(); the target is a
+ * stream, a file descriptor (e.g. a socket) or memory, in which case
+ * nothing is ever written out and str() holds everything so far.
+ */
+class OutputFile
+{
+private:
+  FILE* outfile;
+  int fd;
+  bool owned;
+  bool in_memory;
+  std::string buffer;
+  // callers that walk a UString may hand over a surrogate pair one
+  // half at a time, so a lead surrogate waits here for its trail
+  UChar lead;
+  // bytes collected before they are written out
+  static constexpr size_t WRITE_SIZE = 1 << 16;
+  void drain();
+  void putMultibyte(UChar32 c);
+public:
+  OutputFile();
+  ~OutputFile();
+  OutputFile(OutputFile const&) = delete;
+  OutputFile& operator=(OutputFile const&) = delete;
+  // nullptr or "-" is stdout
+  bool open(const char* fname = nullptr);
+  void open_or_exit(const char* fname = nullptr);
+  void open_in_memory();
+  // wrap() and wrap_fd() don't take ownership, close() leaves the
+  // target open
+  void wrap(FILE* newoutfile);
+  void wrap_fd(int newfd);
+  void close();
+  void flush();
+
+  void put(UChar32 c)
+  {
+    if (c < 0x80 && lead == 0) {
+      buffer.push_back(static_cast<char>(c));
+      if (buffer.size() >= WRITE_SIZE && !in_memory) {
+        drain();
+      }
+    } else {
+      putMultibyte(c);
+    }
+  }
+  void write(UStringView str);
+  // bytes that are already UTF-8
+  void write(const char* bytes, size_t length);
+
+  // everything written to a memory target
+  std::string const& str() const;
+};
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2022 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+#include <lttoolbox/processor_stats.h>
+
+#include <fstream>
+#include <iostream>
+
+volatile std::sig_atomic_t ProcessorStats::report_requested = 0;
+
+void
+ProcessorStats::requestReport(int)
+{
+  report_requested = 1;
+}
+
+void
+ProcessorStats::merge(ProcessorStats const &other)
+{
+  tokens += other.tokens;
+  unknown += other.unknown;
+  steps += other.steps;
+  for (size_t i = 0; i < state_sizes.size(); i++) {
+    state_sizes[i] += other.state_sizes[i];
+  }
+  if (other.max_state_size > max_state_size) {
+    max_state_size = other.max_state_size;
+  }
+  path_steps += other.path_steps;
+  filter_finals += other.filter_finals;
+  compound_attempts += other.compound_attempts;
+  for (auto &it : other.seconds) {
+    seconds[it.first] += it.second;
+  }
+}
+
+void
+ProcessorStats::write(std::ostream &out) const
+{
+  out << "{\n";
+  out << "  \"tokens\": " << tokens << ",\n";
+  out << "  \"unknown\": " << unknown << ",\n";
+  out << "  \"unknown_rate\": " << (tokens ? double(unknown) / tokens : 0.0) << ",\n";
+  out << "  \"steps\": " << steps << ",\n";
+  out << "  \"state_sizes\": {";
+  bool first = true;
+  for (size_t i = 0; i < state_sizes.size(); i++) {
+    if (state_sizes[i] == 0) {
+      continue;
+    }
+    out << (first ? "" : ",") << "\n    \"";
+    first = false;
+    if (i < 2) {
+      out << i;
+    }
+    else {
+      out << (uint64_t(1) << (i - 1)) << '-' << ((uint64_t(1) << i) - 1);
+    }
+    out << "\": " << state_sizes[i];
+  }
+  out << (first ? "" : "\n  ") << "},\n";
+  out << "  \"max_state_size\": " << max_state_size << ",\n";
+  out << "  \"path_steps\": " << path_steps << ",\n";
+  out << "  \"filter_finals\": " << filter_finals << ",\n";
+  out << "  \"compound_attempts\": " << compound_attempts << ",\n";
+  out << "  \"seconds\": {";
+  first = true;
+  for (auto &it : seconds) {
+    out << (first ? "" : ",") << "\n    \"" << it.first << "\": " << it.second;
+    first = false;
+  }
+  out << (first ? "" : "\n  ") << "}\n";
+  out << "}" << std::endl;
+}
+
+void
+ProcessorStats::report() const
+{
+  if (report_path.empty()) {
+    write(std::cerr);
+    return;
+  }
+  std::ofstream out(report_path);
+  if (!out) {
+    std::cerr << "Error: cannot write statistics to '" << report_path << "'" << std::endl;
+    return;
+  }
+  write(out);
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2022 Apertium
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef _LT_PROCESSOR_STATS_H_
+#define _LT_PROCESSOR_STATS_H_
+
+#include <array>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+
+/**
+ * Counters that FSTProcessor keeps while processing, when asked to
+ * with setStats(), for finding out which inputs and dictionaries are
+ * slow
+ */
+class ProcessorStats
+{
+public:
+  /**
+   * Words (analysis) or lexical units (generation, bilingual) looked
+   * up, not counting those answered from the cache
+   */
+  uint64_t tokens = 0;
+
+  /**
+   * Tokens which got no result
+   */
+  uint64_t unknown = 0;
+
+  /**
+   * State::step() calls
+   */
+  uint64_t steps = 0;
+
+  /**
+   * State sizes after each step, bucket i counting the sizes whose
+   * highest bit is bit i-1 (so bucket 0 is the empty state, bucket 1
+   * size 1, bucket 2 sizes 2-3, bucket 3 sizes 4-7 and so on)
+   */
+  std::array<uint64_t, 33> state_sizes{};
+
+  size_t max_state_size = 0;
+
+  /**
+   * Output symbols appended to the paths of the states of finished
+   * tokens, each of which is an allocation in State
+   */
+  uint64_t path_steps = 0;
+
+  uint64_t filter_finals = 0;
+
+  uint64_t compound_attempts = 0;
+
+  /**
+   * Seconds spent in loading and in each mode, by name
+   */
+  std::map<std::string, double> seconds;
+
+  void step(size_t state_size)
+  {
+    steps++;
+    size_t bucket = 0;
+    for (size_t s = state_size; s != 0 && bucket + 1 < state_sizes.size(); s >>= 1) {
+      bucket++;
+    }
+    state_sizes[bucket]++;
+    if (state_size > max_state_size) {
+      max_state_size = state_size;
+    }
+  }
+
+  /**
+   * Add the counts of another processor, such as a worker thread
+   */
+  void merge(ProcessorStats const &other);
+
+  /**
+   * Write the counters as a JSON object
+   */
+  void write(std::ostream &out) const;
+
+  /**
+   * Set by requestReport(), cleared by takeReportRequest()
+   */
+  static volatile std::sig_atomic_t report_requested;
+
+  /**
+   * A signal handler asking the processor to write a report at the
+   * next token boundary
+   */
+  static void requestReport(int);
+
+  /**
+   * @return whether a report has been asked for since the last call
+   */
+  static bool takeReportRequest()
+  {
+    if (report_requested) {
+      report_requested = 0;
+      return true;
+    }
+    return false;
+  }
+
+  /**
+   * Where reports asked for by signal go, standard error if empty
+   */
+  std::string report_path;
+
+  /**
+   * Whether this one answers report requests, which the copies used
+   * by worker threads leave to the processor they add their counts to
+   */
+  bool reporting = true;
+
+  /**
+   * Write a report to report_path
+   */
+  void report() const;
+
+  /**
+   * Adds the time from its creation to its destruction to seconds[name]
+   */
+  class Timer
+  {
+  private:
+    ProcessorStats *stats;
+    std::string name;
+    std::chrono::steady_clock::time_point start;
+
+  public:
+    Timer(ProcessorStats *s, std::string const &n)
+      : stats(s), name(n), start(std::chrono::steady_clock::now())
+    {}
+
+    ~Timer()
+    {
+      if (stats != nullptr) {
+        std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+        stats->seconds[name] += d.count();
+      }
+    }
+  };
+};
+
+#endif
@@ -270,6 +270,10 @@ public:
 		return elements < o.elements;
 	}
 
+	bool operator==(const sorted_vector<T>& o) const {
+		return elements == o.elements;
+	}
+
 private:
 	container elements;
 	Comp comp;
@@ -20,6 +20,7 @@
 #include <cstring>
 #include <climits>
 #include <algorithm>
+#include <cmath>
 
 //debug//
 //#include <iostream>
@@ -54,54 +55,26 @@ State::operator =(State const &s)
 void
 State::destroy()
 {
-  for(size_t i = 0, limit = state.size(); i != limit; i++)
-  {
-    delete state[i].sequence;
-  }
-
   state.clear();
-
-  for (auto& it : sequence_pool) {
-    delete it;
-  }
-  sequence_pool.clear();
-}
-
-std::vector<std::pair<int, double>>*
-State::new_sequence() {
-  if (sequence_pool.empty()) {
-    sequence_pool.push_back(new std::vector<std::pair<int, double>>());
-  }
-  auto ret = sequence_pool.back();
-  sequence_pool.pop_back();
-  return ret;
-}
-
-void
-State::free_sequence(std::vector<std::pair<int, double>>* seq) {
-  sequence_pool.push_back(seq);
+  steps.clear();
 }
 
 void
 State::copy(State const &s)
 {
-  // release references
-  for(size_t i = 0, limit = state.size(); i != limit; i++)
-  {
-    delete state[i].sequence;
-  }
-  for (auto& it : sequence_pool) {
-    delete it;
-  }
-
   state = s.state;
+  steps = s.steps;
+}
 
-  for(size_t i = 0, limit = state.size(); i != limit; i++)
+void
+State::getSequence(int32_t sequence, std::vector<std::pair<int, double>>& seq) const
+{
+  seq.clear();
+  for(int32_t p = sequence; p != -1; p = steps[p].parent)
   {
-    auto tmp = new_sequence();
-    *tmp = *(state[i].sequence);
-    state[i].sequence = tmp;
+    seq.push_back({steps[p].symbol, steps[p].weight});
   }
+  std::reverse(seq.begin(), seq.end());
 }
 
 size_t
@@ -111,63 +84,73 @@ State::size() const
 }
 
 void
-State::init(Node *initial)
+State::init(Node const *initial)
 {
-  state.clear();
-  state.push_back(TNodeState(initial, new_sequence(), false));
-  state[0].sequence->clear();
+  init(std::vector<Node const *>{initial});
+}
+
+void
+State::init(std::vector<Node const *> const &initials)
+{
+  destroy();
+  for(auto initial : initials)
+  {
+    state.push_back(TNodeState(initial, -1, false, 0.0));
+  }
   epsilonClosure();
 }
 
 bool
 State::apply_into(std::vector<TNodeState>* new_state, int const input, int index, bool dirty)
 {
-  std::map<int, Dest>::const_iterator it;
-  it = state[index].where->transitions.find(input);
-  if(it != state[index].where->transitions.end())
+  Node const *where = state[index].where;
+  auto range = where->find(input);
+  if(range.first == range.second)
+  {
+    return false;
+  }
+  for(uint32_t j = range.first; j != range.second; j++)
   {
-    for(int j = 0; j != it->second.size; j++)
+    int32_t seq = state[index].sequence;
+    double weight = state[index].weight;
+    if(input != 0)
     {
-      auto new_v = new_sequence();
-      *new_v = *(state[index].sequence);
-      if(it->first != 0)
-      {
-        new_v->push_back({it->second.out_tag[j], it->second.out_weight[j]});
-      }
-      new_state->push_back(TNodeState(it->second.dest[j], new_v, state[index].dirty||dirty));
+      seq = extend(seq, where->outputs()[j], where->weight(j));
+      weight += where->weight(j);
     }
-    return true;
+    new_state->push_back(TNodeState(where->dest(j), seq, state[index].dirty||dirty, weight));
   }
-  return false;
+  return true;
 }
 
 bool
 State::apply_into_override(std::vector<TNodeState>* new_state, int const input, int const old_sym, int const new_sym, int index, bool dirty)
 {
-  std::map<int, Dest>::const_iterator it;
-  it = state[index].where->transitions.find(input);
-  if(it != state[index].where->transitions.end())
+  Node const *where = state[index].where;
+  auto range = where->find(input);
+  if(range.first == range.second)
+  {
+    return false;
+  }
+  for(uint32_t j = range.first; j != range.second; j++)
   {
-    for(int j = 0; j != it->second.size; j++)
+    int32_t seq = state[index].sequence;
+    double weight = state[index].weight;
+    if(input != 0)
     {
-      auto new_v = new_sequence();
-      *new_v = *(state[index].sequence);
-      if(it->first != 0)
+      if(where->outputs()[j] == old_sym)
       {
-        if(it->second.out_tag[j] == old_sym)
-        {
-          new_v->push_back({new_sym, it->second.out_weight[j]});
-        }
-        else
-        {
-          new_v->push_back({it->second.out_tag[j], it->second.out_weight[j]});
-        }
+        seq = extend(seq, new_sym, where->weight(j));
+      }
+      else
+      {
+        seq = extend(seq, where->outputs()[j], where->weight(j));
       }
-      new_state->push_back(TNodeState(it->second.dest[j], new_v, state[index].dirty||dirty));
+      weight += where->weight(j);
     }
-    return true;
+    new_state->push_back(TNodeState(where->dest(j), seq, state[index].dirty||dirty, weight));
   }
-  return false;
+  return true;
 }
 
 void
@@ -183,7 +166,6 @@ State::apply(int const input)
   for(size_t i = 0, limit = state.size(); i != limit; i++)
   {
     apply_into(&new_state, input, i, false);
-    free_sequence(state[i].sequence);
   }
 
   state = new_state;
@@ -203,7 +185,6 @@ State::apply_override(int const input, int const old_sym, int const new_sym)
   {
     apply_into_override(&new_state, input, old_sym, new_sym, i, false);
     apply_into_override(&new_state, old_sym, old_sym, new_sym, i, true);
-    free_sequence(state[i].sequence);
   }
 
   state = new_state;
@@ -230,7 +211,6 @@ State::apply_override(int const input, int const alt, int const old_sym, int con
     apply_into_override(&new_state, input, old_sym, new_sym, i, false);
     apply_into_override(&new_state, alt, old_sym, new_sym, i, true);
     apply_into_override(&new_state, old_sym, old_sym, new_sym, i, true);
-    free_sequence(state[i].sequence);
   }
 
   state = new_state;
@@ -256,7 +236,6 @@ State::apply(int const input, int const alt)
   {
     apply_into(&new_state, input, i, false);
     apply_into(&new_state, alt, i, true);
-    free_sequence(state[i].sequence);
   }
 
   state = new_state;
@@ -278,7 +257,6 @@ State::apply_careful(int const input, int const alt)
     {
       apply_into(&new_state, alt, i, true);
     }
-    free_sequence(state[i].sequence);
   }
 
   state = new_state;
@@ -287,21 +265,104 @@ State::apply_careful(int const input, int const alt)
 void
 State::epsilonClosure()
 {
-  for(size_t i = 0; i != state.size(); i++)
+  // use the closures stored with the nodes, which give the paths that
+  // walking the transitions gives in the same order, unless one of
+  // them wasn't stored
+  size_t const roots = state.size();
+  size_t stored = 0;
+  for(size_t i = 0; i != roots; i++)
   {
-    auto it2 = state[i].where->transitions.find(0);
-    if(it2 != state[i].where->transitions.end())
+    if(state[i].where->hasEpsilons())
     {
-      for(int j = 0 ; j != it2->second.size; j++)
+      if(state[i].where->closureSize() == 0)
       {
-        auto tmp = new_sequence();
-        *tmp = *(state[i].sequence);
-        if(it2->second.out_tag[j] != 0)
+        walkEpsilons();
+        return;
+      }
+      stored++;
+    }
+  }
+  if(stored == 0)
+  {
+    return;
+  }
+
+  // the walk is breadth first over all the paths, so go through the
+  // closures a depth at a time
+  struct Cursor
+  {
+    size_t root;
+    uint32_t next;
+    size_t base;    // of the paths of its steps in `paths`
+  };
+  std::vector<Cursor> cursors;
+  cursors.reserve(stored);
+  std::vector<std::pair<int32_t, double>> paths;
+  for(size_t i = 0; i != roots; i++)
+  {
+    if(state[i].where->hasEpsilons())
+    {
+      cursors.push_back({i, 0, paths.size()});
+      paths.resize(paths.size() + state[i].where->closureSize());
+    }
+  }
+
+  for(uint32_t depth = 1; !cursors.empty(); depth++)
+  {
+    size_t active = 0;
+    for(auto &c : cursors)
+    {
+      Node const *where = state[c.root].where;
+      Node::EpsilonStep const *steps = where->closure();
+      uint32_t const size = where->closureSize();
+      for(; c.next != size && steps[c.next].depth == depth; c.next++)
+      {
+        auto &step = steps[c.next];
+        int32_t seq = state[c.root].sequence;
+        double weight = state[c.root].weight;
+        if(step.parent != -1)
+        {
+          seq = paths[c.base + step.parent].first;
+          weight = paths[c.base + step.parent].second;
+        }
+        if(step.output != 0)
         {
-          tmp->push_back({it2->second.out_tag[j], it2->second.out_weight[j]});
+          seq = extend(seq, step.output, step.weight);
+          weight += step.weight;
         }
-        state.push_back(TNodeState(it2->second.dest[j], tmp, state[i].dirty));
+        paths[c.base + c.next] = {seq, weight};
+        state.push_back(TNodeState(where->closureDest(step), seq, state[c.root].dirty, weight));
+      }
+      if(c.next != size)
+      {
+        cursors[active++] = c;
+      }
+    }
+    cursors.resize(active);
+  }
+}
+
+void
+State::walkEpsilons()
+{
+  for(size_t i = 0; i != state.size(); i++)
+  {
+    Node const *where = state[i].where;
+    if(!where->hasEpsilons())
+    {
+      continue;
+    }
+    auto range = where->find(0);
+    for(uint32_t j = range.first; j != range.second; j++)
+    {
+      int32_t seq = state[i].sequence;
+      double weight = state[i].weight;
+      if(where->outputs()[j] != 0)
+      {
+        seq = extend(seq, where->outputs()[j], where->weight(j));
+        weight += where->weight(j);
       }
+      state.push_back(TNodeState(where->dest(j), seq, state[i].dirty, weight));
     }
   }
 }
@@ -332,7 +393,6 @@ State::apply(int const input, int const alt1, int const alt2)
     apply_into(&new_state, input, i, false);
     apply_into(&new_state, alt1, i, true);
     apply_into(&new_state, alt2, i, true);
-    free_sequence(state[i].sequence);
   }
 
   state = new_state;
@@ -364,8 +424,6 @@ State::apply(int const input, std::set<int> const alts)
       if(*sit == input) continue;
       apply_into(&new_state, *sit, i, true);
     }
-
-    free_sequence(state[i].sequence);
   }
 
   state = new_state;
@@ -469,11 +527,25 @@ State::step_optional(UChar32 val)
 }
 
 bool
-State::isFinal(std::map<Node *, double> const &finals) const
+State::isFinal(std::map<Node const *, double> const &finals) const
 {
   for(size_t i = 0, limit = state.size(); i != limit; i++)
   {
-    if(finals.find(state[i].where) != finals.end())
+    if(state[i].where->isFinal() && finals.find(state[i].where) != finals.end())
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool
+State::isFinal(uint32_t flags) const
+{
+  for(size_t i = 0, limit = state.size(); i != limit; i++)
+  {
+    if(state[i].where->hasFlags(flags))
     {
       return true;
     }
@@ -483,12 +555,13 @@ State::isFinal(std::map<Node *, double> const &finals) const
 }
 
 
-std::vector<std::pair< UString, double >>
-State::NFinals(std::vector<std::pair<UString, double>> lf, int maxAnalyses, int maxWeightClasses) const
+template <typename T>
+std::vector<std::pair<T, double>>
+State::NFinals(std::vector<std::pair<T, double>> lf, int maxAnalyses, int maxWeightClasses) const
 {
-  std::vector<std::pair<UString, double>> result;
+  std::vector<std::pair<T, double>> result;
 
-  sort(lf.begin(), lf.end(), sort_weights<UString, double>());
+  sort(lf.begin(), lf.end(), sort_weights<T, double>());
 
   for(auto it = lf.begin(); it != lf.end(); it++)
   {
@@ -509,42 +582,53 @@ State::NFinals(std::vector<std::pair<UString, double>> lf, int maxAnalyses, int
 
 void
 State::filterFinalsArray(std::vector<UString>& result,
-                         std::map<Node *, double> const &finals,
+                         std::map<Node const *, double> const &finals,
                          Alphabet const &alphabet,
                          std::set<UChar32> const &escaped_chars,
                          bool display_weights,
                          int max_analyses, int max_weight_classes,
                          bool uppercase, bool firstupper, int firstchar) const
 {
-  std::vector<std::pair< UString, double >> response;
-  UString temp;
-  double cost = 0.0000;
+  // rank the finals by weight first, so that only those which make the
+  // cut are spelt out
+  std::vector<std::pair<size_t, double>> ranked;
+  std::vector<double> weights;
+  for (size_t i = 0; i < state.size(); i++) {
+    if (!state[i].where->isFinal()) continue;
+    if (finals.find(state[i].where) == finals.end()) continue;
+    weights.clear();
+    for (int32_t p = state[i].sequence; p != -1; p = steps[p].parent) {
+      weights.push_back(steps[p].weight);
+    }
+    // add them up first step first, as they always have been
+    double cost = state[i].where->finalWeight();
+    for (auto w = weights.rbegin(); w != weights.rend(); w++) {
+      cost += *w;
+    }
+    ranked.push_back({i, cost});
+  }
 
-  for (auto& it : state) {
-    auto fin = finals.find(it.where);
-    if (fin == finals.end()) continue;
+  ranked = NFinals(ranked, max_analyses, max_weight_classes);
+
+  result.clear();
+  sorted_vector<UString> seen;
+  UString temp;
+  std::vector<std::pair<int, double>> seq;
+  for (auto& it : ranked) {
+    TNodeState const &ts = state[it.first];
     temp.clear();
-    cost = fin->second;
-    for (auto& step : *(it.sequence)) {
+    getSequence(ts.sequence, seq);
+    for (auto& step : seq) {
       if (escaped_chars.find(step.first) != escaped_chars.end()) temp += '\\';
-      alphabet.getSymbol(temp, step.first, it.dirty && uppercase);
-      cost += step.second;
+      alphabet.getSymbol(temp, step.first, ts.dirty && uppercase);
     }
-    if (it.dirty && firstupper) {
+    if (ts.dirty && firstupper) {
       int loc = firstchar;
       if (temp[loc] == '~') loc++; // skip post-generation mark
       temp[loc] = u_toupper(temp[loc]);
     }
-    response.push_back({temp, cost});
-  }
-
-  response = NFinals(response, max_analyses, max_weight_classes);
-
-  result.clear();
-  sorted_vector<UString> seen;
-  for (auto& it : response) {
-    if (!seen.insert(it.first).second) continue;
-    result.push_back(it.first);
+    if (!seen.insert(temp).second) continue;
+    result.push_back(temp);
     if (display_weights) {
       UChar w[16]{};
       // if anyone wants a weight of 10000, this will not be enough
@@ -555,7 +639,7 @@ State::filterFinalsArray(std::vector<UString>& result,
 }
 
 UString
-State::filterFinals(std::map<Node *, double> const &finals,
+State::filterFinals(std::map<Node const *, double> const &finals,
                     Alphabet const &alphabet,
                     std::set<UChar32> const &escaped_chars,
                     bool display_weights, int max_analyses, int max_weight_classes,
@@ -577,7 +661,7 @@ State::filterFinals(std::map<Node *, double> const &finals,
 
 
 std::set<std::pair<UString, std::vector<UString> > >
-State::filterFinalsLRX(std::map<Node *, double> const &finals,
+State::filterFinalsLRX(std::map<Node const *, double> const &finals,
                        Alphabet const &alphabet,
                        std::set<UChar32> const &escaped_chars,
                        bool uppercase, bool firstupper, int firstchar) const
@@ -586,22 +670,24 @@ State::filterFinalsLRX(std::map<Node *, double> const &finals,
 
   std::vector<UString> current_result;
   UString rule_id;
+  std::vector<std::pair<int, double>> seq;
 
   for(size_t i = 0, limit = state.size(); i != limit; i++)
   {
     if(finals.find(state[i].where) != finals.end())
     {
+      getSequence(state[i].sequence, seq);
       current_result.clear();
       rule_id.clear();
       UString current_word;
-      for(size_t j = 0, limit2 = state[i].sequence->size(); j != limit2; j++)
+      for(size_t j = 0, limit2 = seq.size(); j != limit2; j++)
       {
-        if(escaped_chars.find(((*(state[i].sequence))[j]).first) != escaped_chars.end())
+        if(escaped_chars.find((seq[j]).first) != escaped_chars.end())
         {
           current_word += '\\';
         }
         UString sym;
-        alphabet.getSymbol(sym, ((*(state[i].sequence))[j]).first, uppercase);
+        alphabet.getSymbol(sym, (seq[j]).first, uppercase);
         if(sym == u"<$>"_uv)
         {
           if(!current_word.empty())
@@ -625,37 +711,39 @@ State::filterFinalsLRX(std::map<Node *, double> const &finals,
 
 
 UString
-State::filterFinalsSAO(std::map<Node *, double> const &finals,
+State::filterFinalsSAO(std::map<Node const *, double> const &finals,
                        Alphabet const &alphabet,
                        std::set<UChar32> const &escaped_chars,
                        bool uppercase, bool firstupper, int firstchar) const
 {
   UString result;
   UString annot;
+  std::vector<std::pair<int, double>> seq;
 
   for(size_t i = 0, limit = state.size(); i != limit; i++)
   {
-    if(finals.find(state[i].where) != finals.end())
+    if(state[i].where->isFinal() && finals.find(state[i].where) != finals.end())
     {
+      getSequence(state[i].sequence, seq);
       result += '/';
       unsigned int const first_char = result.size() + firstchar;
-      for(size_t j = 0, limit2 = state[i].sequence->size(); j != limit2; j++)
+      for(size_t j = 0, limit2 = seq.size(); j != limit2; j++)
       {
-        if(escaped_chars.find(((*(state[i].sequence))[j]).first) != escaped_chars.end())
+        if(escaped_chars.find((seq[j]).first) != escaped_chars.end())
         {
           result += '\\';
         }
-        if(alphabet.isTag(((*(state[i].sequence))[j]).first))
+        if(alphabet.isTag((seq[j]).first))
         {
           annot.clear();
-          alphabet.getSymbol(annot, ((*(state[i].sequence))[j]).first);
+          alphabet.getSymbol(annot, (seq[j]).first);
           result += '&';
           result += annot.substr(1,annot.length()-2);
           result += ';';
         }
         else
         {
-          alphabet.getSymbol(result, ((*(state[i].sequence))[j]).first, uppercase);
+          alphabet.getSymbol(result, (seq[j]).first, uppercase);
         }
       }
       if(firstupper)
@@ -677,25 +765,27 @@ State::filterFinalsSAO(std::map<Node *, double> const &finals,
 }
 
 UString
-State::filterFinalsTM(std::map<Node *, double> const &finals,
+State::filterFinalsTM(std::map<Node const *, double> const &finals,
                       Alphabet const &alphabet,
                       std::set<UChar32> const &escaped_chars,
                       std::queue<UString> &blankqueue, std::vector<UString> &numbers) const
 {
   UString result;
+  std::vector<std::pair<int, double>> seq;
 
   for(size_t i = 0, limit = state.size(); i != limit; i++)
   {
-    if(finals.find(state[i].where) != finals.end())
+    if(state[i].where->isFinal() && finals.find(state[i].where) != finals.end())
     {
+      getSequence(state[i].sequence, seq);
       result += '/';
-      for(size_t j = 0, limit2 = state[i].sequence->size(); j != limit2; j++)
+      for(size_t j = 0, limit2 = seq.size(); j != limit2; j++)
       {
-        if(escaped_chars.find((*(state[i].sequence))[j].first) != escaped_chars.end())
+        if(escaped_chars.find(seq[j].first) != escaped_chars.end())
         {
           result += '\\';
         }
-        alphabet.getSymbol(result, (*(state[i].sequence))[j].first);
+        alphabet.getSymbol(result, seq[j].first);
       }
     }
   }
@@ -793,12 +883,17 @@ State::pruneCompounds(int requiredSymbol, int separationSymbol, int compound_max
 
   for(unsigned int i = 0; i<state.size(); i++)
   {
-    std::vector<std::pair<int, double>> seq = *state.at(i).sequence;
+    int32_t seq = state.at(i).sequence;
 
     if(lastPartHasRequiredSymbol(seq, requiredSymbol, separationSymbol))
     {
+      // count separators, leaving out the first and last outputs
       int this_noOfCompoundElements = 0;
-      for (int j = seq.size()-2; j>0; j--) if ((seq.at(j)).first==separationSymbol) this_noOfCompoundElements++;
+      for(int32_t p = (seq == -1) ? -1 : steps[seq].parent;
+          p != -1 && steps[p].parent != -1; p = steps[p].parent)
+      {
+        if(steps[p].symbol == separationSymbol) this_noOfCompoundElements++;
+      }
       noOfCompoundElements[i] = this_noOfCompoundElements;
       minNoOfCompoundElements = (minNoOfCompoundElements < this_noOfCompoundElements) ?
                         minNoOfCompoundElements : this_noOfCompoundElements;
@@ -816,7 +911,6 @@ State::pruneCompounds(int requiredSymbol, int separationSymbol, int compound_max
   {
     if(noOfCompoundElements[i] > minNoOfCompoundElements)
     {
-      free_sequence((*it).sequence);
       it = state.erase(it);
     }
     else
@@ -837,16 +931,14 @@ State::pruneStatesWithForbiddenSymbol(int forbiddenSymbol)
   auto it = state.begin();
   while(it != state.end())
   {
-    std::vector<std::pair<int, double>> *seq = (*it).sequence;
     bool found = false;
-    for(int i = seq->size()-1; i>=0; i--)
+    for(int32_t p = (*it).sequence; p != -1; p = steps[p].parent)
     {
-      if((seq->at(i)).first == forbiddenSymbol)
+      if(steps[p].symbol == forbiddenSymbol)
       {
-        i=-1;
-        free_sequence((*it).sequence);
         it = state.erase(it);
         found = true;
+        break;
       }
     }
     if(!found)
@@ -856,6 +948,75 @@ State::pruneStatesWithForbiddenSymbol(int forbiddenSymbol)
   }
 }
 
+void
+State::pruneToBest(size_t n)
+{
+  if(n == 0 || state.size() <= n)
+  {
+    return;
+  }
+  // nothing to do if all the paths weigh the same, as they do in an
+  // unweighted transducer
+  double lightest = state[0].weight, heaviest = state[0].weight;
+  for(auto& it : state)
+  {
+    lightest = std::min(lightest, it.weight);
+    heaviest = std::max(heaviest, it.weight);
+  }
+  if(heaviest <= lightest + 1e-9 * (1.0 + std::fabs(lightest)))
+  {
+    return;
+  }
+
+  std::vector<size_t> order(state.size());
+  for(size_t i = 0; i < order.size(); i++)
+  {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+    if(state[a].where != state[b].where)
+    {
+      return state[a].where < state[b].where;
+    }
+    return state[a].weight < state[b].weight;
+  });
+
+  std::vector<bool> keep(state.size(), true);
+  bool any = false;
+  for(size_t i = 0, start = 0; i < order.size(); i++)
+  {
+    if(state[order[i]].where != state[order[start]].where)
+    {
+      start = i;
+    }
+    else if(i - start >= n)
+    {
+      // the weights here and in filterFinalsArray() are added up in a
+      // different order, so only prune what is clearly heavier
+      double bound = state[order[start + n - 1]].weight;
+      if(state[order[i]].weight > bound + 1e-9 * (1.0 + std::fabs(bound)))
+      {
+        keep[order[i]] = false;
+        any = true;
+      }
+    }
+  }
+  if(!any)
+  {
+    return;
+  }
+
+  size_t j = 0;
+  for(size_t i = 0; i < state.size(); i++)
+  {
+    if(keep[i])
+    {
+      state[j++] = state[i];
+    }
+  }
+  state.erase(state.begin() + j, state.end());
+}
+
 
 bool
 State::hasSymbol(int requiredSymbol)
@@ -863,11 +1024,9 @@ State::hasSymbol(int requiredSymbol)
   for(size_t i = 0; i<state.size(); i++)
   {
     // loop through sequence – we can't just check that the last tag is cp-L, there may be other tags after it:
-    std::vector<std::pair<int, double>>* seq = state.at(i).sequence;
-    if(seq != NULL) for (unsigned int j=0; j<seq->size(); j++)
+    for(int32_t p = state.at(i).sequence; p != -1; p = steps[p].parent)
     {
-      int symbol=(seq->at(j)).first;
-      if(symbol == requiredSymbol)
+      if(steps[p].symbol == requiredSymbol)
       {
         return true;
       }
@@ -878,13 +1037,13 @@ State::hasSymbol(int requiredSymbol)
 
 
 bool
-State::lastPartHasRequiredSymbol(const std::vector<std::pair<int, double>> &seq, int requiredSymbol, int separationSymbol)
+State::lastPartHasRequiredSymbol(int32_t sequence, int requiredSymbol, int separationSymbol) const
 {
   // state is final - it should be restarted it with all elements in stateset restart_state, with old symbols conserved
   bool restart=false;
-  for(int n=seq.size()-1; n>=0; n--)
+  for(int32_t p = sequence; p != -1; p = steps[p].parent)
   {
-    int symbol=(seq.at(n)).first;
+    int symbol=steps[p].symbol;
     if(symbol==requiredSymbol)
     {
       restart=true;
@@ -900,7 +1059,7 @@ State::lastPartHasRequiredSymbol(const std::vector<std::pair<int, double>> &seq,
 
 
 void
-State::restartFinals(const std::map<Node *, double> &finals, int requiredSymbol, State *restart_state, int separationSymbol)
+State::restartFinals(const std::map<Node const *, double> &finals, int requiredSymbol, State *restart_state, int separationSymbol)
 {
 
   for(unsigned int i=0;  i<state.size(); i++)
@@ -908,9 +1067,9 @@ State::restartFinals(const std::map<Node *, double> &finals, int requiredSymbol,
     TNodeState state_i = state.at(i);
     // A state can be a possible final state and still have transitions
 
-    if(finals.count(state_i.where) > 0)
+    if(state_i.where->isFinal() && finals.count(state_i.where) > 0)
     {
-      bool restart = lastPartHasRequiredSymbol(*(state_i.sequence), requiredSymbol, separationSymbol);
+      bool restart = lastPartHasRequiredSymbol(state_i.sequence, requiredSymbol, separationSymbol);
       if(restart)
       {
         if(restart_state != NULL)
@@ -918,15 +1077,7 @@ State::restartFinals(const std::map<Node *, double> &finals, int requiredSymbol,
           for(unsigned int j=0; j<restart_state->state.size(); j++)
           {
             TNodeState initst = restart_state->state.at(j);
-            auto tnvec = new_sequence();
-            tnvec->clear();
-
-            for(unsigned int k=0; k < state_i.sequence->size(); k++)
-            {
-              tnvec->push_back(state_i.sequence->at(k));
-            }
-            TNodeState tn(initst.where, tnvec, state_i.dirty);
-            tn.sequence->push_back({separationSymbol, 0.0});
+            TNodeState tn(initst.where, extend(state_i.sequence, separationSymbol, 0.0), state_i.dirty, state_i.weight);
             state.push_back(tn);
           }
         }
@@ -942,14 +1093,15 @@ State::getReadableString(const Alphabet &a)
 {
   UString retval;
   retval += '[';
+  std::vector<std::pair<int, double>> seq;
 
   for(unsigned int i=0; i<state.size(); i++)
   {
-    std::vector<std::pair<int, double>>* seq = state.at(i).sequence;
-    if(seq != NULL) for (unsigned int j=0; j<seq->size(); j++)
+    getSequence(state.at(i).sequence, seq);
+    for (unsigned int j=0; j<seq.size(); j++)
     {
       UString ws;
-      a.getSymbol(ws, (seq->at(j)).first);
+      a.getSymbol(ws, (seq.at(j)).first);
       retval.append(ws);
     }
 
@@ -966,10 +1118,13 @@ State::getReadableString(const Alphabet &a)
 void
 State::merge(const State& other)
 {
+  // other's paths live in its own arena; bring the whole arena over
+  int32_t const offset = static_cast<int32_t>(steps.size());
+  for (auto& it : other.steps) {
+    steps.push_back({it.parent == -1 ? -1 : it.parent + offset, it.symbol, it.weight});
+  }
   for (auto& it : other.state) {
-    auto tmp = new_sequence();
-    *tmp = *(it.sequence);
-    TNodeState ns(it.where, tmp, it.dirty);
-    this->state.push_back(std::move(ns));
+    int32_t seq = (it.sequence == -1) ? -1 : it.sequence + offset;
+    this->state.push_back(TNodeState(it.where, seq, it.dirty, it.weight));
   }
 }
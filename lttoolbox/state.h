@@ -39,40 +39,57 @@
 class State
 {
 private:
+  /**
+   * One output symbol of a path, linked to the step before it. The
+   * outputs of all live paths form a tree stored in `steps`, so a path
+   * is just the index of its last step (or -1 for the empty output) and
+   * extending a path never copies its prefix.
+   */
+  struct PathStep
+  {
+    int32_t parent;
+    int32_t symbol;
+    double weight;
+  };
+
   /**
    * The current state of transducer processing
    */
   struct TNodeState
   {
-    Node *where;
-    std::vector<std::pair<int, double>> *sequence;
+    Node const *where;
+    int32_t sequence;
     // a state is "dirty" if it was introduced at runtime (case variants, etc.)
     bool dirty;
+    // the sum of the weights along the path, for pruning
+    double weight;
 
-    TNodeState(Node * const &w, std::vector<std::pair<int, double>> * const &s, bool const &d): where(w), sequence(s), dirty(d){}
-
-    TNodeState(const TNodeState& other)
-      : where(other.where)
-      , sequence(other.sequence)
-      , dirty(other.dirty)
-    {}
-
-    TNodeState & operator=(TNodeState const &other)
-    {
-      where = other.where;
-      sequence = other.sequence;
-      dirty = other.dirty;
-      return *this;
-    }
+    TNodeState(Node const * const &w, int32_t s, bool const &d, double wt): where(w), sequence(s), dirty(d), weight(wt){}
   };
 
   std::vector<TNodeState> state;
 
-  std::vector<std::vector<std::pair<int, double>>*> sequence_pool;
-  // get or create a sequence vector (may be non-empty)
-  std::vector<std::pair<int, double>>* new_sequence();
-  // return a sequence vector to the pool
-  void free_sequence(std::vector<std::pair<int, double>>*);
+  /**
+   * Arena of path steps. Steps of dead paths are not reclaimed one by
+   * one; the whole arena goes away when the state is reinitialised or
+   * assigned, which FSTProcessor does at every word boundary.
+   */
+  std::vector<PathStep> steps;
+
+  /**
+   * Append a step to a path
+   * @return the new path
+   */
+  int32_t extend(int32_t sequence, int32_t symbol, double weight)
+  {
+    steps.push_back({sequence, symbol, weight});
+    return static_cast<int32_t>(steps.size() - 1);
+  }
+
+  /**
+   * Spell out a path, first output first
+   */
+  void getSequence(int32_t sequence, std::vector<std::pair<int, double>>& seq) const;
 
   /**
    * Destroy function
@@ -133,7 +150,13 @@ private:
    */
   void epsilonClosure();
 
-  bool lastPartHasRequiredSymbol(const std::vector<std::pair<int, double>> &seq, int requiredSymbol, int separationSymbol);
+  /**
+   * epsilonClosure() by following the epsilon transitions, for nodes
+   * whose closure isn't stored
+   */
+  void walkEpsilons();
+
+  bool lastPartHasRequiredSymbol(int32_t sequence, int requiredSymbol, int separationSymbol) const;
 
 public:
 
@@ -173,6 +196,15 @@ public:
    */
   size_t size() const;
 
+  /**
+   * Number of output symbols in the path arena since the state was
+   * last reinitialised or assigned
+   */
+  size_t pathSteps() const
+  {
+    return steps.size();
+  }
+
   /**
    * step = apply + epsilonClosure
    * @param input the input symbol
@@ -215,7 +247,13 @@ public:
    * Init the state with the initial node and empty output
    * @param initial the initial node of the transducer
    */
-  void init(Node *initial);
+  void init(Node const *initial);
+
+  /**
+   * Init the state with several initial nodes and empty output
+   * @param initials the initial nodes of the transducers
+   */
+  void init(std::vector<Node const *> const &initials);
 
   /**
     * Remove states not containing a specific symbol in their last 'part', and states
@@ -232,6 +270,15 @@ public:
     */
   void pruneStatesWithForbiddenSymbol(int forbiddenSymbol);
 
+  /**
+   * Remove the paths which can't be among the n cheapest results at
+   * any later point: those with n others at the same node that weigh
+   * less. Not for compounds, whose paths have more than their node
+   * and weight to them.
+   * @param n the number of results wanted
+   */
+  void pruneToBest(size_t n);
+
   /**
    * Remove states not containing a particular symbol
    * @param symbol the symbol that is required
@@ -261,9 +308,10 @@ public:
       }
   };
 
-  std::vector<std::pair< UString, double >> NFinals(std::vector<std::pair<UString, double>> lf,
-                                          int maxAnalyses,
-                                          int maxWeightClasses) const;
+  template <typename T>
+  std::vector<std::pair<T, double>> NFinals(std::vector<std::pair<T, double>> lf,
+                                           int maxAnalyses,
+                                           int maxWeightClasses) const;
 
   /**
    * Print all outputs of current parsing, preceded by a bar '/',
@@ -277,7 +325,7 @@ public:
    * @param firstchar first character of the word
    * @return the result of the transduction
    */
-  UString filterFinals(std::map<Node *, double> const &finals,
+  UString filterFinals(std::map<Node const *, double> const &finals,
                        Alphabet const &a,
                        std::set<UChar32> const &escaped_chars,
                        bool display_weights = false,
@@ -291,7 +339,7 @@ public:
    * filterFinals(), but write the results into `result`
    */
   void filterFinalsArray(std::vector<UString>& result,
-                         std::map<Node *, double> const &finals,
+                         std::map<Node const *, double> const &finals,
                          Alphabet const &a,
                          std::set<UChar32> const &escaped_chars,
                          bool display_weights = false,
@@ -312,7 +360,7 @@ public:
    * @param firstchar first character of the word
    * @return the result of the transduction
    */
-  UString filterFinalsSAO(std::map<Node *, double> const &finals,
+  UString filterFinalsSAO(std::map<Node const *, double> const &finals,
                           Alphabet const &a,
                           std::set<UChar32> const &escaped_chars,
                           bool uppercase = false,
@@ -332,7 +380,7 @@ public:
    * @return the result of the transduction
    */
 
-  std::set<std::pair<UString, std::vector<UString> > > filterFinalsLRX(std::map<Node *, double> const &finals,
+  std::set<std::pair<UString, std::vector<UString> > > filterFinalsLRX(std::map<Node const *, double> const &finals,
                                                         Alphabet const &a,
                                                         std::set<UChar32> const &escaped_chars,
                                                         bool uppercase = false,
@@ -351,7 +399,7 @@ public:
    * @param restart_state
    * @param separationSymbol
    */
-    void restartFinals(const std::map<Node *, double> &finals, int requiredSymbol, State *restart_state, int separationSymbol);
+    void restartFinals(const std::map<Node const *, double> &finals, int requiredSymbol, State *restart_state, int separationSymbol);
 
 
   /**
@@ -360,14 +408,20 @@ public:
    * @param finals set of final nodes @return
    * @true if the state is final
    */
-  bool isFinal(std::map<Node *, double> const &finals) const;
+  bool isFinal(std::map<Node const *, double> const &finals) const;
+
+  /**
+   * Returns true if at least one record of the state references a
+   * node with all of the given flags, such as Node::final_flag
+   */
+  bool isFinal(uint32_t flags) const;
 
   /**
    * Return the full states string (to allow debuging...) using a Java ArrayList.toString style
    */
   UString getReadableString(const Alphabet &a);
 
-  UString filterFinalsTM(std::map<Node *, double> const &finals,
+  UString filterFinalsTM(std::map<Node const *, double> const &finals,
                          Alphabet const &alphabet,
                          std::set<UChar32> const &escaped_chars,
                          std::queue<UString> &blanks,
@@ -16,6 +16,11 @@
  */
 
 #include <stream_reader.h>
+#include <lttoolbox/binary_stream.h>
+
+#include <stdexcept>
+#include <string>
+#include <utf8.h>
 
 StreamReader::StreamReader(InputFile* i) : in(i) {}
 
@@ -31,6 +36,11 @@ void StreamReader::next() {
 
   at_null = false;
 
+  if (binary) {
+    nextBinary();
+    return;
+  }
+
   blank = in->readBlank(false);
 
   UChar32 c = in->get();
@@ -68,9 +78,12 @@ void StreamReader::next() {
     c = in->get();
     while (c != '/' && c != '$' && c != '\0' && !in->eof()) {
       if (c == '<') {
-        UString tag = in->readBlock('<', '>');
-        cur.content += tag;
+        // the tag is looked up where it lands in the content, so
+        // that it needn't be copied
+        size_t start = cur.content.size();
+        in->readBlock('<', '>', cur.content);
         if (alpha) {
+          UStringView tag = UStringView(cur.content).substr(start);
           if (add_unknowns) alpha->includeSymbol(tag);
           cur.symbols.push_back((*alpha)(tag));
         }
@@ -96,3 +109,121 @@ void StreamReader::next() {
   if (c == '\0') at_null = true;
   else if (c == U_EOF || in->eof()) at_eof = true;
 }
+
+void StreamReader::setBinary() {
+  binary = true;
+  in->setRaw(true);
+  for (size_t i = 0; i < 5; i++) {
+    UChar32 c = in->get();
+    if (c == U_EOF && i == 0) {
+      // nothing at all is an empty stream in either form
+      at_eof = true;
+      return;
+    }
+    if (c != (i < 4 ? BinaryStream::MAGIC[i] : BinaryStream::VERSION)) {
+      throw std::runtime_error("Error: input is not a binary stream of a known version.\n");
+    }
+  }
+}
+
+uint64_t StreamReader::readNumber() {
+  uint64_t n = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    UChar32 c = in->get();
+    if (c == U_EOF) {
+      break;
+    }
+    n |= uint64_t(c & 0x7F) << shift;
+    if (!(c & 0x80)) {
+      return n;
+    }
+  }
+  throw std::runtime_error("Error: malformed binary stream.\n");
+}
+
+void StreamReader::readText(UString& out) {
+  uint64_t n = readNumber();
+  std::string bytes;
+  bytes.reserve(n);
+  for (uint64_t i = 0; i < n; i++) {
+    UChar32 c = in->get();
+    if (c == U_EOF) {
+      throw std::runtime_error("Error: malformed binary stream.\n");
+    }
+    bytes += static_cast<char>(c);
+  }
+  utf8::utf8to16(bytes.begin(), bytes.end(), std::back_inserter(out));
+}
+
+void StreamReader::nextBinary() {
+  while (true) {
+    UChar32 type = in->get();
+    switch (type) {
+    case U_EOF:
+      at_eof = true;
+      return;
+    case 'b':
+      readText(blank);
+      break;
+    case 'w':
+      readText(wblank);
+      break;
+    case 'k':
+      readText(chunk);
+      break;
+    case 't': {
+      tag_names.emplace_back();
+      readText(tag_names.back());
+      int32_t sym = 0;
+      if (alpha) {
+        if (add_unknowns) alpha->includeSymbol(tag_names.back());
+        sym = (*alpha)(tag_names.back());
+      }
+      tag_symbols.push_back(sym);
+      break;
+    }
+    case 'z':
+      at_null = true;
+      return;
+    case 'u': {
+      readings.resize(readNumber());
+      for (auto& cur : readings) {
+        UChar32 mark = in->get();
+        cur.mark = (mark == U_EOF ? 0 : mark);
+        uint64_t count = readNumber();
+        for (uint64_t i = 0; i < count; i++) {
+          uint64_t v = readNumber();
+          if (v == 0) {
+            v = readNumber();
+            if (v >= tag_names.size()) {
+              throw std::runtime_error("Error: malformed binary stream.\n");
+            }
+            cur.content += tag_names[v];
+            if (alpha) cur.symbols.push_back(tag_symbols[v]);
+          }
+          else {
+            UChar32 c = static_cast<UChar32>(v);
+            // the content is as it would have been read from text
+            switch (c) {
+            case '*': case '#': case '=': case '%':
+              if (i != 0) break;
+              [[fallthrough]];
+            case '[': case ']': case '{': case '}': case '^': case '$':
+            case '/': case '\\': case '@': case '<': case '>':
+              cur.content += '\\';
+              break;
+            default:
+              break;
+            }
+            cur.content += c;
+            if (alpha) cur.symbols.push_back(static_cast<int32_t>(c));
+          }
+        }
+      }
+      return;
+    }
+    default:
+      throw std::runtime_error("Error: malformed binary stream.\n");
+    }
+  }
+}
@@ -25,6 +25,15 @@
 class StreamReader {
 private:
   InputFile* in;
+
+  // the binary stream (see binary_stream.h) and its tags so far, as
+  // text and as symbols of alpha
+  bool binary = false;
+  std::vector<UString> tag_names;
+  std::vector<int32_t> tag_symbols;
+  uint64_t readNumber();
+  void readText(UString& out);
+  void nextBinary();
 public:
   struct Reading {
     UChar32 mark = '\0';
@@ -44,6 +53,12 @@ public:
   StreamReader(InputFile* i);
   ~StreamReader();
   void next();
+
+  /**
+   * Read the binary form of the stream instead of text, checking its
+   * header; this must come before next()
+   */
+  void setBinary();
 };
 
 #endif
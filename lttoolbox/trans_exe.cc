@@ -18,10 +18,48 @@
 #include <lttoolbox/trans_exe.h>
 #include <lttoolbox/compression.h>
 #include <lttoolbox/my_stdio.h>
+#include <lttoolbox/string_utils.h>
+#include <lttoolbox/transducer.h>
+
+#include <algorithm>
 #include <cstring>
+#include <stdexcept>
+
+#include <boost/endian/conversion.hpp>
+
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static_assert(sizeof(Node) == 8, "Node records must be 8 bytes");
+
+namespace {
+
+constexpr bool native_little_endian =
+  boost::endian::order::native == boost::endian::order::little;
+
+template<typename T>
+void
+reverse_inplace(T &value)
+{
+  boost::endian::endian_reverse_inplace(value);
+}
+
+void
+reverse_inplace(double &value)
+{
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  boost::endian::endian_reverse_inplace(bits);
+  memcpy(&value, &bits, sizeof(bits));
+}
+
+}
 
 TransExe::TransExe():
-initial_id(0),
+image(nullptr),
 default_weight(0.0000)
 {
 }
@@ -50,21 +88,428 @@ TransExe::operator =(TransExe const &te)
 void
 TransExe::copy(TransExe const &te)
 {
-  initial_id = te.initial_id;
+  storage = te.storage;
+  image = te.image;
   default_weight = te.default_weight;
-  node_list = te.node_list;
   finals = te.finals;
 }
 
 void
 TransExe::destroy()
 {
+  finals.clear();
+  image = nullptr;
+  storage.reset();
+}
+
+TransExe::Header const &
+TransExe::header() const
+{
+  return *reinterpret_cast<Header const *>(image);
+}
+
+Node const *
+TransExe::nodes() const
+{
+  return reinterpret_cast<Node const *>(image + sizeof(Header));
+}
+
+TransExe::Final const *
+TransExe::finalList() const
+{
+  size_t trans_offset, finals_offset, labels_offset, total;
+  layout(header(), trans_offset, finals_offset, labels_offset, total);
+  return reinterpret_cast<Final const *>(image + finals_offset);
+}
+
+void
+TransExe::layout(Header const &h, size_t &trans_offset,
+                 size_t &finals_offset, size_t &labels_offset, size_t &total)
+{
+  trans_offset = sizeof(Header) + size_t(h.states) * sizeof(Node);
+  trans_offset = (trans_offset + 7) & ~size_t(7);
+  finals_offset = trans_offset + ((size_t(h.blocks) + 7) & ~size_t(7));
+  labels_offset = finals_offset + size_t(h.finals) * sizeof(Final);
+  total = labels_offset + size_t(h.transitions) * sizeof(int32_t);
+  total = (total + 7) & ~size_t(7);
+}
+
+void
+TransExe::swapImage(char *img, bool native_header)
+{
+  Header *h = reinterpret_cast<Header *>(img);
+  Header counts = *h;
+  reverse_inplace(h->version);
+  reverse_inplace(h->initial);
+  reverse_inplace(h->states);
+  reverse_inplace(h->transitions);
+  reverse_inplace(h->finals);
+  reverse_inplace(h->blocks);
+  if(!native_header)
+  {
+    counts = *h;
+  }
+
+  size_t trans_offset, finals_offset, labels_offset, total;
+  layout(counts, trans_offset, finals_offset, labels_offset, total);
+
+  Node *n = reinterpret_cast<Node *>(img + sizeof(Header));
+  for(uint32_t i = 0; i != counts.states; i++)
+  {
+    if(!native_header)
+    {
+      reverse_inplace(n[i].trans);
+      reverse_inplace(n[i].size_flags);
+    }
+    uint32_t size = n[i].size();
+    char *block = reinterpret_cast<char *>(&n[i]) + n[i].trans;
+    int32_t *ints = reinterpret_cast<int32_t *>(block);
+    for(uint32_t j = 0; j != 3 * size; j++)
+    {
+      reverse_inplace(ints[j]);
+    }
+    if(n[i].size_flags & Node::weighted_flag)
+    {
+      double *weights = reinterpret_cast<double *>(block + Node::weightOffset(size));
+      for(uint32_t j = 0; j != size; j++)
+      {
+        reverse_inplace(weights[j]);
+      }
+    }
+    if(n[i].size_flags & Node::final_flag)
+    {
+      reverse_inplace(*reinterpret_cast<double *>(reinterpret_cast<char *>(&n[i]) + n[i].finalOffset()));
+    }
+    if(n[i].size_flags & Node::closure_flag)
+    {
+      char *closure = reinterpret_cast<char *>(&n[i]) + n[i].closureOffset();
+      uint32_t *count = reinterpret_cast<uint32_t *>(closure);
+      uint32_t steps = *count;
+      reverse_inplace(*count);
+      if(!native_header)
+      {
+        steps = *count;
+      }
+      Node::EpsilonStep *e = reinterpret_cast<Node::EpsilonStep *>(closure + 8);
+      for(uint32_t j = 0; j != steps; j++)
+      {
+        reverse_inplace(e[j].dest);
+        reverse_inplace(e[j].output);
+        reverse_inplace(e[j].parent);
+        reverse_inplace(e[j].depth);
+        reverse_inplace(e[j].weight);
+      }
+    }
+    if(native_header)
+    {
+      reverse_inplace(n[i].trans);
+      reverse_inplace(n[i].size_flags);
+    }
+  }
+  Final *f = reinterpret_cast<Final *>(img + finals_offset);
+  for(uint32_t i = 0; i != counts.finals; i++)
+  {
+    reverse_inplace(f[i].state);
+    reverse_inplace(f[i].reserved);
+    reverse_inplace(f[i].weight);
+  }
+  int32_t *labels = reinterpret_cast<int32_t *>(img + labels_offset);
+  for(uint32_t i = 0; i != counts.transitions; i++)
+  {
+    reverse_inplace(labels[i]);
+  }
+}
+
+uint32_t
+TransExe::sectionFlags(UStringView name)
+{
+  if(StringUtils::endswith(name, u"@inconditional"))
+  {
+    return Node::inconditional_flag;
+  }
+  else if(StringUtils::endswith(name, u"@postblank"))
+  {
+    return Node::postblank_flag;
+  }
+  else if(StringUtils::endswith(name, u"@preblank"))
+  {
+    return Node::preblank_flag;
+  }
+  return 0;
+}
+
+void
+TransExe::build(uint32_t initial, std::map<int, double> const &myfinals,
+                std::vector<std::vector<Arc>> &arcs, uint32_t section_flags)
+{
+  // transitions are looked up by input symbol; keep the file order
+  // among those sharing one
+  for(auto &myarcs : arcs)
+  {
+    std::stable_sort(myarcs.begin(), myarcs.end(),
+                     [](Arc const &a, Arc const &b) { return a.input < b.input; });
+  }
+
+  // the epsilon closure of every node with epsilon transitions, walked
+  // breadth first like State::epsilonClosure() does; the nodes of the
+  // steps are kept in dest until the records have their places
+  std::vector<std::vector<Node::EpsilonStep>> closures(arcs.size());
+  std::vector<bool> epsilons(arcs.size(), false);
+  for(size_t i = 0; i != arcs.size(); i++)
+  {
+    auto eps = [&arcs](uint32_t state) {
+      return std::equal_range(arcs[state].begin(), arcs[state].end(),
+                              Arc{0, 0, 0, 0, 0.0},
+                              [](Arc const &a, Arc const &b) { return a.input < b.input; });
+    };
+    auto range = eps(i);
+    if(range.first == range.second)
+    {
+      continue;
+    }
+    epsilons[i] = true;
+    // stop as soon as the closure outgrows max_closure, a node with a
+    // huge fan-out or a cycle would otherwise get far past it
+    auto &closure = closures[i];
+    for(auto it = range.first; it != range.second && closure.size() <= max_closure; it++)
+    {
+      closure.push_back({int32_t(it->dest), it->output, -1, 1, it->weight});
+    }
+    for(size_t k = 0; k != closure.size() && closure.size() <= max_closure; k++)
+    {
+      auto next = eps(closure[k].dest);
+      for(auto it = next.first; it != next.second && closure.size() <= max_closure; it++)
+      {
+        closure.push_back({int32_t(it->dest), it->output, int32_t(k),
+                           closure[k].depth + 1, it->weight});
+      }
+    }
+    if(closure.size() > max_closure)
+    {
+      // too large, or cyclic: State walks it instead
+      closure.clear();
+    }
+  }
+
+  // size the transition table: a block per node, aligned for its widest
+  // member, and its closure
+  size_t number_of_transitions = 0;
+  size_t blocks = 0;
+  std::vector<bool> weighted(arcs.size(), false);
+  for(size_t i = 0; i != arcs.size(); i++)
+  {
+    uint32_t n = arcs[i].size();
+    if(arcs[i].size() & Node::all_flags)
+    {
+      throw std::runtime_error("Too many transitions from one state for the runtime format");
+    }
+    number_of_transitions += n;
+    for(auto &arc : arcs[i])
+    {
+      if(arc.weight != default_weight)
+      {
+        weighted[i] = true;
+        break;
+      }
+    }
+    if(weighted[i])
+    {
+      blocks = (blocks + 7) & ~size_t(7);
+    }
+    blocks += Node::blockSize(n, weighted[i]);
+    if(myfinals.count(i))
+    {
+      blocks = ((blocks + 7) & ~size_t(7)) + 8;
+    }
+    if(!closures[i].empty())
+    {
+      blocks = ((blocks + 7) & ~size_t(7)) + 8 + closures[i].size() * sizeof(Node::EpsilonStep);
+    }
+  }
+
+  Header h{flat_version, initial, uint32_t(arcs.size()),
+           uint32_t(number_of_transitions), uint32_t(myfinals.size()),
+           uint32_t(blocks)};
+  size_t trans_offset, finals_offset, labels_offset, total;
+  layout(h, trans_offset, finals_offset, labels_offset, total);
+  if(total > INT32_MAX)
+  {
+    throw std::runtime_error("Transducer is too large for the flat format");
+  }
+
+  std::shared_ptr<uint64_t> buffer(new uint64_t[total / sizeof(uint64_t)](),
+                                   std::default_delete<uint64_t[]>());
+  char *img = reinterpret_cast<char *>(buffer.get());
+  memcpy(img, &h, sizeof(h));
+
+  Node *n = reinterpret_cast<Node *>(img + sizeof(Header));
+  int32_t *labels = reinterpret_cast<int32_t *>(img + labels_offset);
+  size_t offset = trans_offset;
+  for(size_t i = 0; i != arcs.size(); i++)
+  {
+    auto &myarcs = arcs[i];
+    uint32_t size = myarcs.size();
+    if(weighted[i])
+    {
+      offset = (offset + 7) & ~size_t(7);
+    }
+    char *block = img + offset;
+    n[i].trans = block - reinterpret_cast<char *>(&n[i]);
+    n[i].size_flags = size | section_flags
+                      | (weighted[i] ? Node::weighted_flag : 0)
+                      | (epsilons[i] ? Node::epsilon_flag : 0)
+                      | (closures[i].empty() ? 0 : Node::closure_flag)
+                      | (myfinals.count(i) ? Node::final_flag : 0);
+
+    int32_t *ints = reinterpret_cast<int32_t *>(block);
+    double *weights = reinterpret_cast<double *>(block + Node::weightOffset(size));
+    for(uint32_t j = 0; j != size; j++)
+    {
+      ints[j] = myarcs[j].input;
+      ints[size + j] = myarcs[j].output;
+      ints[2 * size + j] = reinterpret_cast<char *>(&n[myarcs[j].dest]) - reinterpret_cast<char *>(&n[i]);
+      if(weighted[i])
+      {
+        weights[j] = myarcs[j].weight;
+      }
+      *labels++ = myarcs[j].label;
+    }
+    offset += Node::blockSize(size, weighted[i]);
+
+    auto fin = myfinals.find(i);
+    if(fin != myfinals.end())
+    {
+      offset = (offset + 7) & ~size_t(7);
+      *reinterpret_cast<double *>(img + offset) = fin->second;
+      offset += 8;
+    }
+
+    if(!closures[i].empty())
+    {
+      offset = (offset + 7) & ~size_t(7);
+      *reinterpret_cast<uint32_t *>(img + offset) = closures[i].size();
+      auto *steps = reinterpret_cast<Node::EpsilonStep *>(img + offset + 8);
+      for(auto &step : closures[i])
+      {
+        *steps = step;
+        steps->dest = reinterpret_cast<char *>(&n[step.dest]) - reinterpret_cast<char *>(&n[i]);
+        steps++;
+      }
+      offset += 8 + closures[i].size() * sizeof(Node::EpsilonStep);
+    }
+  }
+
+  Final *f = reinterpret_cast<Final *>(img + finals_offset);
+  for(auto &it : myfinals)
+  {
+    f->state = it.first;
+    f->weight = it.second;
+    f++;
+  }
+
+  storage = buffer;
+  image = img;
+  attach(total);
 }
 
-#include <iostream>
+void
+TransExe::attach(size_t length)
+{
+  if(length < sizeof(Header) || header().version != flat_version)
+  {
+    throw std::runtime_error("Flat transducer layout is not supported by this version of lttoolbox - recompile the dictionary");
+  }
+
+  size_t trans_offset, finals_offset, labels_offset, total;
+  layout(header(), trans_offset, finals_offset, labels_offset, total);
+  if(total > length || header().initial >= header().states)
+  {
+    throw std::runtime_error("Malformed flat transducer");
+  }
+
+  // a mapped image is used as it is, so every offset in it has to
+  // lead somewhere inside it
+  auto malformed = []() {
+    throw std::runtime_error("Malformed flat transducer");
+  };
+  int64_t const nodes_begin = sizeof(Header);
+  int64_t const nodes_end = nodes_begin + int64_t(header().states) * int64_t(sizeof(Node));
+  auto checkDest = [&](int64_t at, int32_t d) {
+    int64_t pos = at + d;
+    if(pos < nodes_begin || pos >= nodes_end || (pos - nodes_begin) % sizeof(Node) != 0)
+    {
+      malformed();
+    }
+  };
+  for(uint32_t i = 0; i != header().states; i++)
+  {
+    Node const *n = getNode(i);
+    int64_t at = nodes_begin + int64_t(i) * int64_t(sizeof(Node));
+    uint32_t size = n->size();
+    bool weighted = n->size_flags & Node::weighted_flag;
+    int64_t block = at + n->trans;
+    int64_t end = block + Node::blockSize(size, weighted);
+    if(block < int64_t(trans_offset) || block % (weighted ? 8 : 4) != 0 ||
+       end > int64_t(finals_offset))
+    {
+      malformed();
+    }
+    int32_t const *dests = n->inputs() + 2 * size;
+    for(uint32_t j = 0; j != size; j++)
+    {
+      checkDest(at, dests[j]);
+    }
+    end = (end + 7) & ~int64_t(7);
+    if(n->size_flags & Node::final_flag)
+    {
+      end += 8;
+    }
+    if(n->size_flags & Node::closure_flag)
+    {
+      if(end + 8 > int64_t(finals_offset))
+      {
+        malformed();
+      }
+      uint32_t steps = *reinterpret_cast<uint32_t const *>(image + end);
+      end += 8 + int64_t(steps) * int64_t(sizeof(Node::EpsilonStep));
+      if(end > int64_t(finals_offset))
+      {
+        malformed();
+      }
+      Node::EpsilonStep const *e = n->closure();
+      for(uint32_t j = 0; j != steps; j++)
+      {
+        checkDest(at, e[j].dest);
+        // State expands the steps a depth at a time, each from a step of
+        // the depth before
+        if(e[j].parent < -1 || e[j].parent >= int32_t(j) ||
+           e[j].depth != (e[j].parent == -1 ? 1 : e[e[j].parent].depth + 1) ||
+           (j > 0 && e[j].depth < e[j-1].depth))
+        {
+          malformed();
+        }
+      }
+    }
+    else if(end > int64_t(finals_offset))
+    {
+      malformed();
+    }
+  }
+
+  finals.clear();
+  Final const *f = finalList();
+  for(uint32_t i = 0; i != header().finals; i++)
+  {
+    if(f[i].state >= header().states)
+    {
+      throw std::runtime_error("Malformed flat transducer");
+    }
+    finals.insert({getNode(f[i].state), f[i].weight});
+  }
+}
 
 void
-TransExe::read(FILE *input, Alphabet const &alphabet)
+TransExe::read(FILE *input, Alphabet const &alphabet, uint32_t section_flags)
 {
   bool read_weights = false;
 
@@ -77,6 +522,13 @@ TransExe::read(FILE *input, Alphabet const &alphabet)
           if (features >= TDF_UNKNOWN) {
               throw std::runtime_error("Transducer has features that are unknown to this version of lttoolbox - upgrade!");
           }
+          if (features & TDF_FLAT) {
+              readFlat(input);
+              if ((getInitial()->size_flags & Node::section_flags) != section_flags) {
+                  throw std::runtime_error("Flat transducer section does not match its type - recompile the dictionary");
+              }
+              return;
+          }
           read_weights = (features & TDF_WEIGHTS);
       }
       else {
@@ -85,9 +537,8 @@ TransExe::read(FILE *input, Alphabet const &alphabet)
       }
   }
 
-  TransExe &new_t = *this;
-  new_t.destroy();
-  new_t.initial_id = Compression::multibyte_read(input);
+  destroy();
+  uint32_t initial = Compression::multibyte_read(input);
   int finals_size = Compression::multibyte_read(input);
 
   int base = 0;
@@ -112,19 +563,14 @@ TransExe::read(FILE *input, Alphabet const &alphabet)
 
   int number_of_states = base;
   int current_state = 0;
-  new_t.node_list.resize(number_of_states);
-
-  for(auto it = myfinals.begin(), limit = myfinals.end();
-      it != limit; it++)
-  {
-    new_t.finals.insert({&new_t.node_list[it->first], it->second});
-  }
+  std::vector<std::vector<Arc>> arcs(number_of_states);
 
   while(number_of_states > 0)
   {
     int number_of_local_transitions = Compression::multibyte_read(input);
     int tagbase = 0;
-    Node &mynode = new_t.node_list[current_state];
+    auto &myarcs = arcs[current_state];
+    myarcs.reserve(number_of_local_transitions);
 
     while(number_of_local_transitions > 0)
     {
@@ -135,40 +581,211 @@ TransExe::read(FILE *input, Alphabet const &alphabet)
       {
         base_weight = Compression::long_multibyte_read(input);
       }
-      int i_symbol = alphabet.decode(tagbase).first;
-      int o_symbol = alphabet.decode(tagbase).second;
-
-      mynode.addTransition(i_symbol, o_symbol, &new_t.node_list[state], base_weight);
+      auto symbols = alphabet.decode(tagbase);
+      myarcs.push_back({symbols.first, symbols.second, tagbase,
+                        uint32_t(state), base_weight});
     }
     number_of_states--;
     current_state++;
   }
+
+  build(initial, myfinals, arcs, section_flags);
 }
 
 void
-TransExe::unifyFinals()
+TransExe::readFlat(FILE *input)
+{
+  uint64_t length = read_u64_be(input);
+  int padding = fgetc_unlocked(input);
+  if(padding < 0 || padding > 7)
+  {
+    throw std::runtime_error("Malformed flat transducer");
+  }
+  while(padding-- > 0)
+  {
+    fgetc_unlocked(input);
+  }
+
+  destroy();
+
+#ifdef HAVE_MMAP
+  long offset = ftell(input);
+  struct stat st;
+  if(native_little_endian && offset >= 0 && offset % 8 == 0 &&
+     fstat(fileno(input), &st) == 0 && S_ISREG(st.st_mode))
+  {
+    // a mapping past the end of the file faults when it is touched
+    // instead of failing here, so the image has to fit in the file
+    if(length < sizeof(Header) || uint64_t(st.st_size) < uint64_t(offset) ||
+       length > uint64_t(st.st_size) - uint64_t(offset))
+    {
+      throw std::runtime_error("Malformed flat transducer");
+    }
+    long page = sysconf(_SC_PAGESIZE);
+    long start = offset - offset % page;
+    size_t maplength = length + (offset - start);
+    void *mapping = mmap(nullptr, maplength, PROT_READ, MAP_PRIVATE,
+                         fileno(input), start);
+    if(mapping != MAP_FAILED)
+    {
+      storage = std::shared_ptr<void const>(mapping, [maplength](void const *p) {
+        munmap(const_cast<void *>(p), maplength);
+      });
+      image = static_cast<char const *>(mapping) + (offset - start);
+      if(fseek(input, offset + length, SEEK_SET) != 0)
+      {
+        throw std::runtime_error("Failed to skip flat transducer");
+      }
+      attach(length);
+      return;
+    }
+  }
+#endif
+
+  // not a regular file, or no mmap(): read a private copy
+  std::shared_ptr<uint64_t> buffer(new uint64_t[(length + 7) / sizeof(uint64_t)](),
+                                   std::default_delete<uint64_t[]>());
+  char *img = reinterpret_cast<char *>(buffer.get());
+  if(fread_unlocked(img, 1, length, input) != length)
+  {
+    throw std::runtime_error("Failed to read flat transducer");
+  }
+  if(!native_little_endian)
+  {
+    swapImage(img, false);
+  }
+  storage = buffer;
+  image = img;
+  attach(length);
+}
+
+void
+TransExe::build(Transducer &t, Alphabet const &alphabet, uint32_t section_flags)
 {
-  node_list.resize(node_list.size()+1);
+  auto &transitions = t.getTransitions();
+  std::vector<std::vector<Arc>> arcs(t.size());
+  for(size_t i = 0; i != transitions.size(); i++)
+  {
+    auto &myarcs = arcs[i];
+    myarcs.reserve(transitions[i].size());
+    for(auto &it2 : transitions[i])
+    {
+      auto symbols = alphabet.decode(it2.tag);
+      myarcs.push_back({symbols.first, symbols.second, it2.tag,
+                        uint32_t(it2.target), it2.weight});
+    }
+  }
+  destroy();
+  build(t.getInitial(), t.getFinals(), arcs, section_flags);
+}
+
+void
+TransExe::write(FILE *output) const
+{
+  fwrite_unlocked(HEADER_TRANSDUCER, 1, 4, output);
+  write_be(output, TDF_FLAT);
 
-  Node *newfinal = &node_list[node_list.size()-1];
+  size_t trans_offset, finals_offset, labels_offset, total;
+  layout(header(), trans_offset, finals_offset, labels_offset, total);
+  write_be(output, total);
 
-  for(auto& it : finals)
+  // align the image in the file so that it can be mapped in place
+  long offset = ftell(output);
+  int padding = (offset < 0) ? 0 : (8 - (offset + 1) % 8) % 8;
+  fputc_unlocked(padding, output);
+  for(int i = 0; i != padding; i++)
   {
-    it.first->addTransition(0, 0, newfinal, it.second);
+    fputc_unlocked(0, output);
   }
 
-  finals.clear();
-  finals.insert({newfinal, default_weight});
+  if(native_little_endian)
+  {
+    if(fwrite_unlocked(image, 1, total, output) != total)
+    {
+      throw std::runtime_error("Failed to write flat transducer");
+    }
+  }
+  else
+  {
+    std::vector<uint64_t> img(total / sizeof(uint64_t));
+    memcpy(img.data(), image, total);
+    swapImage(reinterpret_cast<char *>(img.data()), true);
+    if(fwrite_unlocked(img.data(), 1, total, output) != total)
+    {
+      throw std::runtime_error("Failed to write flat transducer");
+    }
+  }
+}
+
+void
+TransExe::unifyFinals()
+{
+  if(!image)
+  {
+    return;
+  }
+
+  // the image can't be changed in place, so it is built again with a
+  // new state that every final state reaches by an epsilon transition
+  // carrying its weight
+  std::vector<std::vector<Arc>> arcs(size() + 1);
+  int32_t const *labels = getLabels();
+  for(size_t i = 0; i != size(); i++)
+  {
+    Node const *node = getNode(i);
+    for(uint32_t j = 0; j != node->size(); j++)
+    {
+      arcs[i].push_back({node->inputs()[j], node->outputs()[j], *labels++,
+                         uint32_t(getIndex(node->dest(j))), node->weight(j)});
+    }
+  }
+  uint32_t newfinal = size();
+  for(auto &it : finals)
+  {
+    arcs[getIndex(it.first)].push_back({0, 0, 0, newfinal, it.second});
+  }
+  std::map<int, double> myfinals;
+  myfinals.insert({int(newfinal), default_weight});
+  uint32_t initial = header().initial;
+  uint32_t section_flags = getInitial()->size_flags & Node::section_flags;
+  destroy();
+  build(initial, myfinals, arcs, section_flags);
 }
 
-Node *
-TransExe::getInitial()
+Node const *
+TransExe::getInitial() const
 {
-  return &node_list[initial_id];
+  return getNode(header().initial);
 }
 
-std::map<Node *, double> &
-TransExe::getFinals()
+std::map<Node const *, double> const &
+TransExe::getFinals() const
 {
   return finals;
 }
+
+size_t
+TransExe::size() const
+{
+  return image ? header().states : 0;
+}
+
+Node const *
+TransExe::getNode(size_t i) const
+{
+  return nodes() + i;
+}
+
+size_t
+TransExe::getIndex(Node const *n) const
+{
+  return n - nodes();
+}
+
+int32_t const *
+TransExe::getLabels() const
+{
+  size_t trans_offset, finals_offset, labels_offset, total;
+  layout(header(), trans_offset, finals_offset, labels_offset, total);
+  return reinterpret_cast<int32_t const *>(image + labels_offset);
+}
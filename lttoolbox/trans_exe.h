@@ -21,23 +21,79 @@
 #include <cstdio>
 #include <cstdlib>
 #include <map>
+#include <memory>
 #include <set>
 #include <vector>
 
 #include <lttoolbox/alphabet.h>
 #include <lttoolbox/node.h>
 
+class Transducer;
 
 /**
  * Transducer class for execution of lexical processing algorithms
+ *
+ * Nodes and transitions live in a single contiguous image: fixed-width
+ * node records, a compressed sparse row table of transitions, final
+ * weights and epsilon closures (see Node),
+ * the final states and, last, the symbol pair codes of the transitions,
+ * which are only needed to convert back to a Transducer.  The same image
+ * is written to disk by write() (TDF_FLAT), so a flat binary can be
+ * memory-mapped read-only and used without decoding; transducers in the
+ * compressed format are decoded into an equivalent heap-allocated image.
  */
 class TransExe
 {
 private:
   /**
-   * Initial state
+   * Layout version of the flat image, bump when the records change
+   */
+  static constexpr uint32_t flat_version = 5;
+
+  /**
+   * Largest epsilon closure stored with its node
+   */
+  static constexpr size_t max_closure = 64;
+
+  struct Header
+  {
+    uint32_t version;
+    uint32_t initial;
+    uint32_t states;
+    uint32_t transitions;
+    uint32_t finals;
+    uint32_t blocks;      // size in bytes of the transition table
+  };
+
+  struct Final
+  {
+    uint32_t state;
+    uint32_t reserved;
+    double weight;
+  };
+
+  /**
+   * Outgoing transition of a state while building the image
+   */
+  struct Arc
+  {
+    int32_t input;
+    int32_t output;
+    int32_t label;
+    uint32_t dest;
+    double weight;
+  };
+
+  /**
+   * Owner of the image, either a heap buffer or a read-only mapping,
+   * shared between copies of the transducer
+   */
+  std::shared_ptr<void const> storage;
+
+  /**
+   * Start of the image
    */
-  int initial_id;
+  char const *image;
 
   /**
    * Default value of weight
@@ -45,14 +101,43 @@ private:
   double default_weight;
 
   /**
-   * Node list
+   * Final node set mapped to its weight walues
    */
-  std::vector<Node> node_list;
+  std::map<Node const *, double> finals;
+
+  Header const & header() const;
+  Node const * nodes() const;
+  Final const * finalList() const;
 
   /**
-   * Final node set mapped to its weight walues
+   * Compute the byte offsets of the sections of an image
    */
-  std::map<Node *, double> finals;
+  static void layout(Header const &h, size_t &trans_offset,
+                     size_t &finals_offset, size_t &labels_offset,
+                     size_t &total);
+
+  /**
+   * Convert the records of an image between native and little-endian
+   * byte order
+   * @param img the image
+   * @param native_header whether the header is currently in native order
+   */
+  static void swapImage(char *img, bool native_header);
+
+  /**
+   * Build a heap-allocated image
+   * @param initial the initial state
+   * @param myfinals the final states with their weights
+   * @param arcs the outgoing transitions of every state
+   * @param section_flags the flags for the type of the section
+   */
+  void build(uint32_t initial, std::map<int, double> const &myfinals,
+             std::vector<std::vector<Arc>> &arcs, uint32_t section_flags);
+
+  /**
+   * Check the image header and index the final nodes
+   */
+  void attach(size_t length);
 
   /**
    * Copy function
@@ -94,25 +179,77 @@ public:
    * Read method with an encoding base
    * @param input the stream
    * @param alphabet the alphabet object to decode the symbols
+   * @param section_flags the flags for the type of the section, which
+   *                      a flat transducer must already have
    */
-  void read(FILE *input, Alphabet const &alphabet);
+  void read(FILE *input, Alphabet const &alphabet, uint32_t section_flags = 0);
+
+  /**
+   * Read the body of a flat transducer, the stream being positioned right
+   * after the transducer header.  The image is memory-mapped if the stream
+   * is a regular file, and read into memory otherwise.
+   * @param input the stream
+   */
+  void readFlat(FILE *input);
+
+  /**
+   * Build the runtime form of a compile-time transducer
+   * @param t the transducer
+   * @param alphabet the alphabet object to decode the symbols
+   * @param section_flags the flags for the type of the section
+   */
+  void build(Transducer &t, Alphabet const &alphabet, uint32_t section_flags = 0);
+
+  /**
+   * The flags marking the nodes of a section (see Node), from the type
+   * at the end of its name
+   */
+  static uint32_t sectionFlags(UStringView name);
+
+  /**
+   * Write the transducer in the flat format
+   * @param output the stream
+   */
+  void write(FILE *output) const;
 
   /**
    * Reduces all the final states to one
+   * @deprecated rebuilds the whole image; kept for code written against
+   * the old node list
    */
-  void unifyFinals();
+  [[deprecated]] void unifyFinals();
 
   /**
    * Gets the initial node of the transducer
    * @return the initial node
    */
-  Node * getInitial();
+  Node const * getInitial() const;
 
   /**
    * Gets the set of final nodes
    * @return the set of final nodes
    */
-  std::map<Node *, double> & getFinals();
+  std::map<Node const *, double> const & getFinals() const;
+
+  /**
+   * Number of nodes
+   */
+  size_t size() const;
+
+  /**
+   * Gets a node by state number
+   */
+  Node const * getNode(size_t i) const;
+
+  /**
+   * Gets the state number of a node
+   */
+  size_t getIndex(Node const *n) const;
+
+  /**
+   * Symbol pair codes of all the transitions, node after node
+   */
+  int32_t const * getLabels() const;
 };
 
 #endif
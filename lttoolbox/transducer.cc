@@ -20,25 +20,78 @@
 #include <lttoolbox/my_stdio.h>
 #include <lttoolbox/deserialiser.h>
 #include <lttoolbox/serialiser.h>
+#include <lttoolbox/trans_exe.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <iostream>
 #include <vector>
+#include <condition_variable>
 #include <cstring>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
+namespace {
 
-int
-Transducer::newState()
+bool
+tagLess(Transition const &a, Transition const &b)
+{
+  return a.tag < b.tag;
+}
+
+// the transitions of a state with the given tag, like
+// std::multimap::equal_range
+template<typename List>
+auto
+tagRange(List &list, int tag) -> decltype(std::make_pair(list.begin(), list.end()))
+{
+  return std::equal_range(list.begin(), list.end(),
+                          Transition{tag, 0, default_weight}, tagLess);
+}
+
+// insert after any transitions with the same tag, like
+// std::multimap::insert
+void
+insertTransition(std::vector<Transition> &list, Transition const &t)
+{
+  list.insert(std::upper_bound(list.begin(), list.end(), t, tagLess), t);
+}
+
+// for looking up sets of states in determinize()
+struct SubsetHash
 {
-  int nstate = transitions.size();
+  size_t operator()(sorted_vector<int> const &s) const
+  {
+    uint64_t h = s.size();
+    for(int q : s)
+    {
+      h = (h ^ uint64_t(q)) * 0x100000001b3ULL;
+    }
+    return h ^ (h >> 29);
+  }
+};
 
-  while(transitions.find(nstate) != transitions.end())
+// restore the order of a state whose transitions were appended to or
+// retagged; the sort is stable so that transitions with the same tag
+// stay in the order they were added
+void
+sortTransitions(std::vector<Transition> &list)
+{
+  if(!std::is_sorted(list.begin(), list.end(), tagLess))
   {
-    nstate++;
+    std::stable_sort(list.begin(), list.end(), tagLess);
   }
-  transitions[nstate].clear();  // force creating
+}
 
-  return nstate;
+}
+
+int
+Transducer::newState()
+{
+  transitions.emplace_back();
+  return transitions.size() - 1;
 }
 
 Transducer::Transducer()
@@ -70,29 +123,29 @@ Transducer::operator =(Transducer const &t)
 int
 Transducer::insertSingleTransduction(int const tag, int const source, double const weight)
 {
-  if(transitions.find(source) != transitions.end())
+  if(source >= 0 && size_t(source) < transitions.size())
   {
-    if(transitions[source].count(tag) == 1)
+    auto range = tagRange(transitions[source], tag);
+    auto count = range.second - range.first;
+    if(count == 1)
     {
-      auto range = transitions[source].equal_range(tag);
-      return range.first->second.first;
+      return range.first->target;
     }
-    else if(transitions[source].count(tag) == 0)
+    else if(count == 0)
     {
       // new state
       int state = newState();
-      transitions[source].insert({tag, std::make_pair(state, weight)});
+      insertTransition(transitions[source], {tag, state, weight});
       return state;
     }
-    else if(transitions[source].count(tag) == 2)
+    else if(count == 2)
     {
       // there's a local cycle, must be ignored and treated like in '1'
-      auto range = transitions[source].equal_range(tag);
       for(; range.first != range.second; range.first++)
       {
-        if(range.first->second.first != source)
+        if(range.first->target != source)
         {
-          return range.first->second.first;
+          return range.first->target;
         }
       }
       return -1;
@@ -112,7 +165,7 @@ int
 Transducer::insertNewSingleTransduction(int const tag, int const source, double const weight)
 {
   int state = newState();
-  transitions[source].insert({tag, std::make_pair(state, weight)});
+  insertTransition(transitions[source], {tag, state, weight});
   return state;
 }
 
@@ -120,8 +173,6 @@ int
 Transducer::insertTransducer(int const source, Transducer &t,
                             int const epsilon_tag)
 {
-  std::map<int, int> relation;
-
   if(t.transitions.empty())
   {
 	return source;
@@ -129,22 +180,23 @@ Transducer::insertTransducer(int const source, Transducer &t,
 
   t.joinFinals(epsilon_tag);
 
-  for(auto& it : t.transitions)
+  // the states of t are appended in order, so relation[i] is just
+  // i + base and the copied transitions stay sorted
+  int base = transitions.size();
+  transitions.resize(base + t.transitions.size());
+  for(size_t i = 0; i != t.transitions.size(); i++)
   {
-    relation[it.first] = newState();
-  }
-
-  for(auto& it : t.transitions)
-  {
-    for(auto& it2 : it.second)
+    auto& out = transitions[base + i];
+    out.reserve(t.transitions[i].size());
+    for(auto& it : t.transitions[i])
     {
-      transitions[relation[it.first]].insert({it2.first, std::make_pair(relation[it2.second.first], it2.second.second)});
+      out.push_back({it.tag, base + it.target, it.weight});
     }
   }
 
-  transitions[source].insert({epsilon_tag, std::make_pair(relation[t.initial], default_weight)});
+  insertTransition(transitions[source], {epsilon_tag, base + t.initial, default_weight});
 
-  return relation[t.finals.begin()->first];
+  return base + t.finals.begin()->first;
 }
 
 void
@@ -152,20 +204,18 @@ Transducer::linkStates(int const source, int const target,
                        int const tag, double const weight)
 {
 
-  if(transitions.find(source) != transitions.end() &&
-     transitions.find(target) != transitions.end())
+  int const states = transitions.size();
+  if(source >= 0 && source < states && target >= 0 && target < states)
   {
-    // new code
-    auto range = transitions[source].equal_range(tag);
+    auto range = tagRange(transitions[source], tag);
     for(;range.first != range.second; range.first++)
     {
-      if(range.first->first == tag && range.first->second.first == target)
+      if(range.first->target == target)
       {
         return;
       }
     }
-    // end of new code
-    transitions[source].insert({tag, std::make_pair(target, weight)});
+    transitions[source].insert(range.second, {tag, target, weight});
   }
   else
   {
@@ -223,18 +273,16 @@ Transducer::closure(int const state, std::set<int> const &epsilon_tags) const
 
   while (nonvisited.size() > 0) {
     int auxest = *nonvisited.begin();
-    for (const int epsilon_tag : epsilon_tags) {
-      try {
-        auto range = transitions.at(auxest).equal_range(epsilon_tag);
+    if (auxest >= 0 && size_t(auxest) < transitions.size()) {
+      for (const int epsilon_tag : epsilon_tags) {
+        auto range = tagRange(transitions[auxest], epsilon_tag);
         while (range.first != range.second) {
-          if (result.find(range.first->second.first) == result.end()) {
-            result.insert(range.first->second.first);
-            nonvisited.insert(range.first->second.first);
+          if (result.find(range.first->target) == result.end()) {
+            result.insert(range.first->target);
+            nonvisited.insert(range.first->target);
           }
           range.first++;
         }
-      } catch (std::out_of_range const &e) {
-        // No transition from any of the epsilon_tags – this is fine
       }
     }
     nonvisited.erase(auxest);
@@ -254,11 +302,11 @@ Transducer::closure_all(const int epsilon_tag) const
   for (size_t i = 0; i < transitions.size(); i++) {
     sorted_vector<int> c;
     c.insert(i);
-    auto range = transitions.at(i).equal_range(epsilon_tag);
+    auto range = tagRange(transitions[i], epsilon_tag);
     for (; range.first != range.second; range.first++) {
-      if (range.first->second.second != default_weight) continue;
-      c.insert(range.first->second.first);
-      reversed[range.first->second.first].push_back(i);
+      if (range.first->weight != default_weight) continue;
+      c.insert(range.first->target);
+      reversed[range.first->target].push_back(i);
     }
     if (c.size() > 1) todo.insert(i);
     ret.push_back(c);
@@ -301,13 +349,13 @@ Transducer::joinFinals(int const epsilon_tag)
 }
 
 void
-Transducer::determinize(int const epsilon_tag)
+Transducer::determinize(int const epsilon_tag, unsigned int threads)
 {
   std::vector<sorted_vector<int>> R(2);
   std::vector<sorted_vector<int>> Q_prime;
-  std::map<sorted_vector<int>, int> Q_prime_inv;
+  std::unordered_map<sorted_vector<int>, int, SubsetHash> Q_prime_inv;
 
-  std::map<int, std::multimap<int, std::pair<int, double> > > transitions_prime;
+  std::vector<std::vector<Transition>> transitions_prime(1);
 
   // We're almost certainly going to need the closure of (nearly) every
   // state, and we're often going to need the closure several times,
@@ -335,13 +383,131 @@ Transducer::determinize(int const epsilon_tag)
     finals_state.insert(it.first);
   }
 
+  // The successors of one state of the frontier: (label, weight), the
+  // set of old states reached, and its number if that set was already
+  // known at the start of the round (-1 otherwise)
+  struct Successor
+  {
+    std::pair<int, double> label;
+    sorted_vector<int> target;
+    int known;
+  };
+  std::vector<int> frontier;
+  std::vector<std::vector<Successor>> successors;
+
+  auto expand = [&](size_t i) {
+    std::map<std::pair<int, double>, sorted_vector<int> > mymap;
+
+    for(auto& it2 : Q_prime[frontier[i]])
+    {
+      for(auto& it3 : transitions[it2])
+      {
+        if(it3.tag != epsilon_tag || it3.weight != default_weight)
+        {
+          auto& it4 = all_closures[it3.target];
+          mymap[std::make_pair(it3.tag, it3.weight)].insert(it4.begin(), it4.end());
+        }
+      }
+    }
+
+    auto& out = successors[i];
+    out.clear();
+    for(auto& it2 : mymap)
+    {
+      auto loc = Q_prime_inv.find(it2.second);
+      out.push_back({it2.first, std::move(it2.second),
+                     loc == Q_prime_inv.end() ? -1 : loc->second});
+    }
+  };
+
+  // Workers for the rounds with a large frontier, started on the first
+  // of them; in between rounds they wait for the next frontier
+  struct Pool
+  {
+    std::mutex mtx;
+    std::condition_variable start, done;
+    unsigned int round = 0;
+    unsigned int busy = 0;
+    bool stop = false;
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> workers;
+
+    ~Pool()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mtx);
+        stop = true;
+      }
+      start.notify_all();
+      for(auto& thr : workers)
+      {
+        thr.join();
+      }
+    }
+  } pool;
+  auto work = [&]() {
+    unsigned int seen = 0;
+    while(true)
+    {
+      {
+        std::unique_lock<std::mutex> lock(pool.mtx);
+        pool.start.wait(lock, [&]() { return pool.stop || pool.round != seen; });
+        if(pool.stop)
+        {
+          return;
+        }
+        seen = pool.round;
+      }
+      for(size_t i = pool.next++; i < frontier.size(); i = pool.next++)
+      {
+        expand(i);
+      }
+      std::lock_guard<std::mutex> lock(pool.mtx);
+      if(--pool.busy == 0)
+      {
+        pool.done.notify_one();
+      }
+    }
+  };
+
   while(size_Q_prime != Q_prime.size())
   {
     size_Q_prime = Q_prime.size();
     R[(t+1)%2].clear();
 
-    for(auto& it : R[t])
+    // Working out the successors of each state only reads the automaton
+    // and the states known so far, so that is shared between threads.
+    // Numbering the new states is left to this thread and done in the
+    // same order as a single-threaded run, so the result is identical.
+    frontier.assign(R[t].begin(), R[t].end());
+    successors.resize(frontier.size());
+    if(threads > 1 && frontier.size() >= 64)
     {
+      if(pool.workers.empty())
+      {
+        for(unsigned int n = 0; n < threads; n++)
+        {
+          pool.workers.emplace_back(work);
+        }
+      }
+      std::unique_lock<std::mutex> lock(pool.mtx);
+      pool.next = 0;
+      pool.busy = threads;
+      pool.round++;
+      pool.start.notify_all();
+      pool.done.wait(lock, [&]() { return pool.busy == 0; });
+    }
+    else
+    {
+      for(size_t i = 0; i < frontier.size(); i++)
+      {
+        expand(i);
+      }
+    }
+
+    for(size_t i = 0; i < frontier.size(); i++)
+    {
+      int it = frontier[i];
       if (Q_prime[it].intersects(finals_state)) {
         double w = default_weight;
         auto it3 = finals.find(it);
@@ -351,56 +517,571 @@ Transducer::determinize(int const epsilon_tag)
         finals_prime.insert({it, w});
       }
 
-      std::map<std::pair<int, double>, sorted_vector<int> > mymap;
+      // adding new states; the successors come ordered by label, so
+      // the transitions can simply be appended
+      std::vector<Transition> state_prime;
+      state_prime.reserve(successors[i].size());
+      for(auto& it2 : successors[i])
+      {
+        int tag = it2.known;
+        if(tag == -1) {
+          auto loc = Q_prime_inv.find(it2.target);
+          if(loc == Q_prime_inv.end()) {
+            tag = Q_prime.size();
+            Q_prime.push_back(it2.target);
+            Q_prime_inv[it2.target] = tag;
+            R[(t+1)%2].insert(tag);
+            transitions_prime.emplace_back();
+          } else {
+            tag = loc->second;
+          }
+        }
+        state_prime.push_back({it2.label.first, tag, it2.label.second});
+      }
+      transitions_prime[it].swap(state_prime);
+    }
+
+    t = (t+1)%2;
+  }
+
+  transitions.swap(transitions_prime);
+  finals.swap(finals_prime);
+  initial = initial_prime;
+}
+
+
+namespace {
+
+/**
+ * A deterministic automaton over dense state and label numbers, for
+ * the minimisation algorithms; the transitions of state q are those
+ * from first[q] up to first[q+1], in label order
+ */
+struct Dfa
+{
+  int initial;
+  std::vector<char> finals;
+  std::vector<int> first;
+  std::vector<int> label;
+  std::vector<int> head;
+
+  int size() const
+  {
+    return finals.size();
+  }
+};
+
+/**
+ * A partition of the numbers [0, n) into blocks that can be refined
+ * by marking some elements and then splitting every block which had
+ * some, but not all, of its elements marked, as in Valmari and
+ * Lehtinen's version of Hopcroft's algorithm
+ */
+struct Refinable
+{
+  int blocks = 0;
+  // the elements, block after block
+  std::vector<int> elems;
+  // position of each element in elems
+  std::vector<int> loc;
+  // block of each element
+  std::vector<int> block;
+  // range of each block in elems; its marked elements come first
+  std::vector<int> first;
+  std::vector<int> past;
+  std::vector<int> marked;
+  // blocks with marked elements
+  std::vector<int> touched;
+
+  explicit Refinable(int n)
+    : elems(n), loc(n), block(n, 0), first(n + 1, 0), past(n + 1, 0),
+      marked(n + 1, 0)
+  {
+    for(int i = 0; i != n; i++)
+    {
+      elems[i] = loc[i] = i;
+    }
+    if(n > 0)
+    {
+      blocks = 1;
+      past[0] = n;
+    }
+  }
+
+  void mark(int e)
+  {
+    int s = block[e], i = loc[e], j = first[s] + marked[s];
+    if(i < j)
+    {
+      return;
+    }
+    elems[i] = elems[j];
+    loc[elems[i]] = i;
+    elems[j] = e;
+    loc[e] = j;
+    if(marked[s]++ == 0)
+    {
+      touched.push_back(s);
+    }
+  }
+
+  void split()
+  {
+    while(!touched.empty())
+    {
+      int s = touched.back(), j = first[s] + marked[s];
+      touched.pop_back();
+      if(j == past[s])
+      {
+        marked[s] = 0;
+        continue;
+      }
+      // the smaller part becomes the new block
+      if(marked[s] <= past[s] - j)
+      {
+        first[blocks] = first[s];
+        past[blocks] = first[s] = j;
+      }
+      else
+      {
+        past[blocks] = past[s];
+        first[blocks] = past[s] = j;
+      }
+      for(int i = first[blocks]; i != past[blocks]; i++)
+      {
+        block[elems[i]] = blocks;
+      }
+      marked[s] = marked[blocks++] = 0;
+    }
+  }
+};
+
+/**
+ * Revuz's minimisation of an acyclic automaton. Two states are
+ * equivalent if they agree on finality and have the same transitions
+ * into equivalent states, so taking states after everything they lead
+ * to, each is merged with an earlier one with the same finality and
+ * transitions, looked up in a hash table, or else starts a new block.
+ * @return false if the automaton has a cycle
+ */
+bool
+revuz(Dfa const &a, std::vector<int> &block, int &blocks)
+{
+  int const n = a.size();
+  auto hash = [&](int q) {
+    uint64_t h = a.finals[q];
+    for(int t = a.first[q]; t != a.first[q + 1]; t++)
+    {
+      h = (h ^ uint64_t(a.label[t])) * 0x100000001b3ULL;
+      h = (h ^ uint64_t(block[a.head[t]])) * 0x100000001b3ULL;
+    }
+    return h ^ (h >> 29);
+  };
+  auto equivalent = [&](int x, int y) {
+    if(a.finals[x] != a.finals[y] ||
+       a.first[x + 1] - a.first[x] != a.first[y + 1] - a.first[y])
+    {
+      return false;
+    }
+    for(int i = a.first[x], j = a.first[y]; i != a.first[x + 1]; i++, j++)
+    {
+      if(a.label[i] != a.label[j] || block[a.head[i]] != block[a.head[j]])
+      {
+        return false;
+      }
+    }
+    return true;
+  };
+  // one representative state of each block, by open addressing
+  size_t mask = 1;
+  while(mask < size_t(n) * 2)
+  {
+    mask <<= 1;
+  }
+  std::vector<int> table(mask--, -1);
+
+  // -1 is not visited yet, -2 is on the depth-first stack
+  block.assign(n, -1);
+  blocks = 0;
+  // each entry is a state and the next of its transitions to follow
+  std::vector<std::pair<int, int>> stack;
+  stack.push_back({a.initial, a.first[a.initial]});
+  block[a.initial] = -2;
+  while(!stack.empty())
+  {
+    int q = stack.back().first;
+    int t = stack.back().second;
+    if(t != a.first[q + 1])
+    {
+      stack.back().second++;
+      int r = a.head[t];
+      if(block[r] == -2)
+      {
+        return false;
+      }
+      if(block[r] == -1)
+      {
+        block[r] = -2;
+        stack.push_back({r, a.first[r]});
+      }
+      continue;
+    }
+    stack.pop_back();
+    size_t slot = hash(q) & mask;
+    while(table[slot] != -1 && !equivalent(table[slot], q))
+    {
+      slot = (slot + 1) & mask;
+    }
+    if(table[slot] == -1)
+    {
+      table[slot] = q;
+      block[q] = blocks++;
+    }
+    else
+    {
+      block[q] = block[table[slot]];
+    }
+  }
+  return true;
+}
+
+/**
+ * Hopcroft's minimisation, in Valmari and Lehtinen's version which
+ * allows states without a transition for every label: the states are
+ * split by finality and then by whether they have a transition with a
+ * given label into a given block, until no block can be split.
+ */
+void
+hopcroft(Dfa const &a, std::vector<int> &block, int &blocks)
+{
+  int const n = a.size();
+  int const m = a.head.size();
+
+  Refinable states(n);
+  for(int q = 0; q != n; q++)
+  {
+    if(a.finals[q])
+    {
+      states.mark(q);
+    }
+  }
+  states.split();
+
+  // the transitions start out grouped by label
+  std::vector<int> tail(m);
+  for(int q = 0; q != n; q++)
+  {
+    for(int t = a.first[q]; t != a.first[q + 1]; t++)
+    {
+      tail[t] = q;
+    }
+  }
+  Refinable arcs(m);
+  std::stable_sort(arcs.elems.begin(), arcs.elems.end(), [&](int x, int y) {
+    return a.label[x] < a.label[y];
+  });
+  arcs.blocks = 0;
+  for(int i = 0; i != m; i++)
+  {
+    int t = arcs.elems[i];
+    if(i == 0 || a.label[t] != a.label[arcs.elems[i - 1]])
+    {
+      arcs.first[arcs.blocks++] = i;
+    }
+    arcs.past[arcs.blocks - 1] = i + 1;
+    arcs.block[t] = arcs.blocks - 1;
+    arcs.loc[t] = i;
+  }
+
+  // transitions into each state
+  std::vector<int> in_first(n + 1, 0);
+  std::vector<int> in(m);
+  for(int t = 0; t != m; t++)
+  {
+    in_first[a.head[t] + 1]++;
+  }
+  for(int q = 0; q != n; q++)
+  {
+    in_first[q + 1] += in_first[q];
+  }
+  std::vector<int> fill(in_first.begin(), in_first.end() - 1);
+  for(int t = 0; t != m; t++)
+  {
+    in[fill[a.head[t]]++] = t;
+  }
 
-      for(auto& it2 : Q_prime[it])
+  int b = 1;
+  for(int c = 0; c != arcs.blocks; c++)
+  {
+    for(int i = arcs.first[c]; i != arcs.past[c]; i++)
+    {
+      states.mark(tail[arcs.elems[i]]);
+    }
+    states.split();
+    for(; b != states.blocks; b++)
+    {
+      for(int i = states.first[b]; i != states.past[b]; i++)
       {
-        for(auto& it3 : transitions[it2])
+        int q = states.elems[i];
+        for(int j = in_first[q]; j != in_first[q + 1]; j++)
         {
-          if(it3.first != epsilon_tag || it3.second.second != default_weight)
-          {
-            auto& it4 = all_closures[it3.second.first];
-            mymap[std::make_pair(it3.first, it3.second.second)].insert(it4.begin(), it4.end());
-          }
+          arcs.mark(in[j]);
         }
       }
+      arcs.split();
+    }
+  }
+
+  block.swap(states.block);
+  blocks = states.blocks;
+}
 
-      // adding new states
-      auto& state_prime = transitions_prime[it];
-      for(auto& it2 : mymap)
+}
+
+bool
+Transducer::isDeterministic(int const epsilon_tag) const
+{
+  for(auto& state : transitions)
+  {
+    for(size_t i = 0; i != state.size(); i++)
+    {
+      if(state[i].tag == epsilon_tag && state[i].weight == default_weight)
+      {
+        return false;
+      }
+      for(size_t j = i + 1; j != state.size() && state[j].tag == state[i].tag; j++)
       {
-        int tag;
-        auto loc = Q_prime_inv.find(it2.second);
-        if(loc == Q_prime_inv.end()) {
-          tag = Q_prime.size();
-          Q_prime.push_back(it2.second);
-          Q_prime_inv[it2.second] = tag;
-          R[(t+1)%2].insert(tag);
-          transitions_prime[tag].clear();
-        } else {
-          tag = loc->second;
+        if(state[j].weight == state[i].weight)
+        {
+          return false;
         }
-        state_prime.insert({it2.first.first, std::make_pair(tag, it2.first.second)});
       }
     }
+  }
+  return true;
+}
 
-    t = (t+1)%2;
+bool
+Transducer::minimizeDeterministic()
+{
+  int const states = transitions.size();
+
+  // only the states on some path from the initial state to a final
+  // one are kept
+  std::vector<char> reached(states, 0);
+  std::vector<int> todo{initial};
+  reached[initial] = 1;
+  for(size_t i = 0; i != todo.size(); i++)
+  {
+    for(auto& it : transitions[todo[i]])
+    {
+      if(!reached[it.target])
+      {
+        reached[it.target] = 1;
+        todo.push_back(it.target);
+      }
+    }
+  }
+  std::vector<int> in_first(states + 1, 0);
+  for(int q : todo)
+  {
+    for(auto& it : transitions[q])
+    {
+      in_first[it.target + 1]++;
+    }
+  }
+  for(int q = 0; q != states; q++)
+  {
+    in_first[q + 1] += in_first[q];
+  }
+  std::vector<int> in(in_first[states]);
+  std::vector<int> fill(in_first.begin(), in_first.end() - 1);
+  for(int q : todo)
+  {
+    for(auto& it : transitions[q])
+    {
+      in[fill[it.target]++] = q;
+    }
+  }
+  todo.clear();
+  for(auto& it : finals)
+  {
+    if(reached[it.first])
+    {
+      reached[it.first] = 2;
+      todo.push_back(it.first);
+    }
+  }
+  for(size_t i = 0; i != todo.size(); i++)
+  {
+    for(int j = in_first[todo[i]]; j != in_first[todo[i] + 1]; j++)
+    {
+      if(reached[in[j]] == 1)
+      {
+        reached[in[j]] = 2;
+        todo.push_back(in[j]);
+      }
+    }
+  }
+  if(reached[initial] != 2)
+  {
+    return false;
+  }
+
+  std::vector<int> number(states, -1);
+  Dfa a;
+  for(int q = 0; q != states; q++)
+  {
+    if(reached[q] == 2)
+    {
+      number[q] = a.finals.size();
+      a.finals.push_back(0);
+    }
+  }
+  for(auto& it : finals)
+  {
+    if(number[it.first] != -1)
+    {
+      a.finals[number[it.first]] = 1;
+    }
+  }
+  a.initial = number[initial];
+
+  // labels are numbered in order of appearance first, and then
+  // renumbered in (tag, weight) order
+  auto label_hash = [](std::pair<int, double> const &l) {
+    return std::hash<int>()(l.first) * 31 + std::hash<double>()(l.second);
+  };
+  std::unordered_map<std::pair<int, double>, int, decltype(label_hash)> ids(64, label_hash);
+  for(int q = 0; q != states; q++)
+  {
+    if(number[q] == -1)
+    {
+      continue;
+    }
+    a.first.push_back(a.label.size());
+    for(auto& it : transitions[q])
+    {
+      if(number[it.target] != -1)
+      {
+        auto id = ids.emplace(std::make_pair(it.tag, it.weight), ids.size());
+        a.label.push_back(id.first->second);
+        a.head.push_back(number[it.target]);
+      }
+    }
+  }
+  a.first.push_back(a.label.size());
+  std::vector<std::pair<int, double>> labels(ids.size());
+  for(auto& it : ids)
+  {
+    labels[it.second] = it.first;
+  }
+  std::sort(labels.begin(), labels.end());
+  std::vector<int> rank(labels.size());
+  for(size_t i = 0; i != labels.size(); i++)
+  {
+    rank[ids[labels[i]]] = i;
+  }
+  std::vector<std::pair<int, int>> out;
+  for(int q = 0; q != a.size(); q++)
+  {
+    out.clear();
+    for(int t = a.first[q]; t != a.first[q + 1]; t++)
+    {
+      out.push_back({rank[a.label[t]], a.head[t]});
+    }
+    std::sort(out.begin(), out.end());
+    for(int t = a.first[q]; t != a.first[q + 1]; t++)
+    {
+      a.label[t] = out[t - a.first[q]].first;
+      a.head[t] = out[t - a.first[q]].second;
+    }
+  }
+
+  std::vector<int> block;
+  int blocks;
+  if(!revuz(a, block, blocks))
+  {
+    hopcroft(a, block, blocks);
+  }
+
+  // One state for each block, numbered breadth-first from the initial
+  // one and taking transitions in (tag, weight) order, which is how
+  // determinize() numbers them. The minimal automaton is unique, so
+  // this is the very same transducer minimizing by reverse and
+  // determinize gives.
+  std::vector<int> member(blocks, -1);
+  for(int q = 0; q != a.size(); q++)
+  {
+    if(member[block[q]] == -1)
+    {
+      member[block[q]] = q;
+    }
+  }
+  std::vector<int> order{block[a.initial]};
+  std::vector<int> renumber(blocks, -1);
+  renumber[block[a.initial]] = 0;
+  std::vector<std::vector<Transition>> transitions_prime;
+  transitions_prime.reserve(blocks);
+  std::map<int, double> finals_prime;
+  for(size_t i = 0; i != order.size(); i++)
+  {
+    int q = member[order[i]];
+    if(a.finals[q])
+    {
+      finals_prime.insert({i, default_weight});
+    }
+    std::vector<Transition> state_prime;
+    state_prime.reserve(a.first[q + 1] - a.first[q]);
+    for(int t = a.first[q]; t != a.first[q + 1]; t++)
+    {
+      int target = block[a.head[t]];
+      if(renumber[target] == -1)
+      {
+        renumber[target] = order.size();
+        order.push_back(target);
+      }
+      auto& label = labels[a.label[t]];
+      state_prime.push_back({label.first, renumber[target], label.second});
+    }
+    transitions_prime.push_back(std::move(state_prime));
   }
 
   transitions.swap(transitions_prime);
   finals.swap(finals_prime);
-  initial = initial_prime;
+  initial = 0;
+  return true;
 }
 
-
 void
-Transducer::minimize(int const epsilon_tag)
+Transducer::minimize(int const epsilon_tag, unsigned int threads,
+                     MinimisationMode mode)
 {
   if (finals.empty()) return;
+  if (mode != mm_brzozowski) {
+    // Reversing joins the final states with epsilon transitions that
+    // carry their weights, or drops the weight if there is just one,
+    // so do the same here for the other algorithms to agree
+    bool weighted_finals = false;
+    for (auto& it : finals) {
+      weighted_finals |= (it.second != default_weight);
+    }
+    if (finals.size() == 1) {
+      finals.begin()->second = default_weight;
+    } else if (weighted_finals) {
+      joinFinals(epsilon_tag);
+    }
+    if (mode == mm_hopcroft && !isDeterministic(epsilon_tag)) {
+      determinize(epsilon_tag, threads);
+    }
+    if (isDeterministic(epsilon_tag) && minimizeDeterministic()) {
+      return;
+    }
+  }
   reverse(epsilon_tag);
-  determinize(epsilon_tag);
+  determinize(epsilon_tag, threads);
   reverse(epsilon_tag);
-  determinize(epsilon_tag);
+  determinize(epsilon_tag, threads);
 }
 
 void
@@ -460,7 +1141,7 @@ Transducer::hasNoFinals() const
   return finals.size() == 0;
 }
 
-std::map<int, std::multimap<int, std::pair<int, double> > >&
+std::vector<std::vector<Transition>>&
 Transducer::getTransitions()
 {
   return transitions;
@@ -485,7 +1166,7 @@ Transducer::numberOfTransitions() const
 
   for(auto& it : transitions)
   {
-    counter += it.second.size();
+    counter += it.size();
   }
 
   return counter;
@@ -494,17 +1175,8 @@ Transducer::numberOfTransitions() const
 bool
 Transducer::isEmpty(int const state) const
 {
-
-  auto it = transitions.find(state);
-  if(it != transitions.end())
-  {
-    if(it->second.size() > 0)
-    {
-      return false;
-    }
-  }
-
-  return true;
+  return state < 0 || size_t(state) >= transitions.size() ||
+         transitions[state].empty();
 }
 
 // Determine whether any weights are non-default (0)
@@ -515,8 +1187,8 @@ bool Transducer::weighted() const {
     }
   }
   for (auto& it : transitions) {
-    for (auto& it2 : it.second) {
-      if (it2.second.second != default_weight) {
+    for (auto& it2 : it) {
+      if (it2.weight != default_weight) {
         return true;
       }
     }
@@ -553,26 +1225,27 @@ Transducer::write(FILE *output, int const decalage)
 
   base = transitions.size();
   Compression::multibyte_write(base, output);
-  for(auto& it : transitions)
+  for(int state = 0; state != base; state++)
   {
-    Compression::multibyte_write(it.second.size(), output);
+    auto& it = transitions[state];
+    Compression::multibyte_write(it.size(), output);
     int tagbase = 0;
-    for(auto& it2 : it.second)
+    for(auto& it2 : it)
     {
-      Compression::multibyte_write(it2.first - tagbase + decalage, output);
-      tagbase = it2.first;
+      Compression::multibyte_write(it2.tag - tagbase + decalage, output);
+      tagbase = it2.tag;
 
-      if(it2.second.first >= it.first)
+      if(it2.target >= state)
       {
-        Compression::multibyte_write(it2.second.first - it.first, output);
+        Compression::multibyte_write(it2.target - state, output);
       }
       else
       {
-        Compression::multibyte_write(it2.second.first + base - it.first, output);
+        Compression::multibyte_write(it2.target + base - state, output);
       }
       if(write_weights)
       {
-        Compression::long_multibyte_write(it2.second.second, output);
+        Compression::long_multibyte_write(it2.weight, output);
       }
     }
   }
@@ -594,6 +1267,10 @@ Transducer::read(FILE *input, int const decalage)
           if (features >= TDF_UNKNOWN) {
               throw std::runtime_error("Transducer has features that are unknown to this version of lttoolbox - upgrade!");
           }
+          if (features & TDF_FLAT) {
+              readFlat(input);
+              return;
+          }
           read_weights = (features & TDF_WEIGHTS);
       }
       else {
@@ -620,15 +1297,13 @@ Transducer::read(FILE *input, int const decalage)
   }
 
   base = Compression::multibyte_read(input);
-  int number_of_states = base;
-  int current_state = 0;
-  while(number_of_states > 0)
+  new_t.transitions.resize(std::max(base, 1));
+  for(int current_state = 0; current_state < base; current_state++)
   {
     int number_of_local_transitions = Compression::multibyte_read(input);
     int tagbase = 0;
-    if (new_t.transitions.find(current_state) == new_t.transitions.end()) {
-      new_t.transitions[current_state].clear(); // force create
-    }
+    auto& out = new_t.transitions[current_state];
+    out.reserve(number_of_local_transitions);
     while(number_of_local_transitions > 0)
     {
       number_of_local_transitions--;
@@ -638,17 +1313,41 @@ Transducer::read(FILE *input, int const decalage)
       {
         base_weight = Compression::long_multibyte_read(input);
       }
-      if(new_t.transitions.find(state) == new_t.transitions.end())
-      {
-        new_t.transitions[state].clear(); // force create
-      }
-      new_t.transitions[current_state].insert({tagbase, std::make_pair(state, base_weight)});
+      out.push_back({tagbase, state, base_weight});
+    }
+    sortTransitions(out);
+  }
+
+  *this = std::move(new_t);
+}
+
+void
+Transducer::readFlat(FILE *input)
+{
+  TransExe flat;
+  flat.readFlat(input);
+
+  Transducer new_t;
+  new_t.initial = flat.getIndex(flat.getInitial());
+  for(auto& it : flat.getFinals())
+  {
+    new_t.finals.insert({flat.getIndex(it.first), it.second});
+  }
+  int32_t const *labels = flat.getLabels();
+  new_t.transitions.resize(std::max(flat.size(), size_t(1)));
+  for(size_t i = 0; i != flat.size(); i++)
+  {
+    auto& out = new_t.transitions[i];
+    Node const *node = flat.getNode(i);
+    out.reserve(node->size());
+    for(uint32_t j = 0; j != node->size(); j++)
+    {
+      out.push_back({*labels++, int(flat.getIndex(node->dest(j))), node->weight(j)});
     }
-    number_of_states--;
-    current_state++;
+    sortTransitions(out);
   }
 
-  *this = new_t;
+  *this = std::move(new_t);
 }
 
 void
@@ -656,7 +1355,20 @@ Transducer::serialise(std::ostream &serialised) const
 {
   Serialiser<int>::serialise(initial, serialised);
   Serialiser<std::map<int, double> >::serialise(finals, serialised);
-  Serialiser<std::map<int, std::multimap<int, std::pair<int, double> > > >::serialise(transitions, serialised);
+  // laid out as a map from state to a multimap from tag to (target,
+  // weight), which is how transitions used to be stored
+  Serialiser<uint64_t>::serialise(transitions.size(), serialised);
+  for(size_t i = 0; i != transitions.size(); i++)
+  {
+    Serialiser<int>::serialise(i, serialised);
+    Serialiser<uint64_t>::serialise(transitions[i].size(), serialised);
+    for(auto& it : transitions[i])
+    {
+      Serialiser<int>::serialise(it.tag, serialised);
+      Serialiser<int>::serialise(it.target, serialised);
+      Serialiser<double>::serialise(it.weight, serialised);
+    }
+  }
 }
 
 void
@@ -664,7 +1376,24 @@ Transducer::deserialise(std::istream &serialised)
 {
   initial = Deserialiser<int>::deserialise(serialised);
   finals = Deserialiser<std::map<int, double> >::deserialise(serialised);
-  transitions = Deserialiser<std::map<int, std::multimap<int, std::pair<int, double> > > >::deserialise(serialised);
+  transitions.clear();
+  for(auto states = Deserialiser<uint64_t>::deserialise(serialised); states != 0; states--)
+  {
+    int state = Deserialiser<int>::deserialise(serialised);
+    if(size_t(state) >= transitions.size())
+    {
+      transitions.resize(state + 1);
+    }
+    auto& out = transitions[state];
+    for(auto n = Deserialiser<uint64_t>::deserialise(serialised); n != 0; n--)
+    {
+      int tag = Deserialiser<int>::deserialise(serialised);
+      int target = Deserialiser<int>::deserialise(serialised);
+      double weight = Deserialiser<double>::deserialise(serialised);
+      out.push_back({tag, target, weight});
+    }
+    sortTransitions(out);
+  }
 }
 
 void
@@ -685,39 +1414,50 @@ Transducer::reverse(int const epsilon_tag)
 {
   joinFinals(epsilon_tag);
 
-  std::map<int, std::multimap<int, std::pair<int, double> > > tmp_transitions;
+  int const states = transitions.size();
+  std::vector<size_t> incoming(states, 0);
+  for(auto& it : transitions)
+  {
+    for(auto& it2 : it)
+    {
+      incoming[it2.target]++;
+    }
+  }
+  std::vector<std::vector<Transition>> reversed(states);
+  for(int i = 0; i != states; i++)
+  {
+    reversed[i].reserve(incoming[i]);
+  }
 
-  for(std::map<int, std::multimap<int, std::pair<int, double> > >::reverse_iterator it = transitions.rbegin(); it != transitions.rend(); it++)
+  // Among transitions with the same tag, loops come first and then
+  // the other sources from the highest one down
+  for(int i = 0; i != states; i++)
   {
-    auto aux = it->second;
-    it->second.clear();
-    for(auto& it2 : aux)
+    for(auto& it : transitions[i])
     {
-      if(it2.second.first >= it->first)
+      if(it.target == i)
       {
-        transitions[it2.second.first].insert({it2.first, std::make_pair(it->first, it2.second.second)});
+        reversed[i].push_back(it);
       }
-      else
-      {
-        tmp_transitions[it2.second.first].insert({it2.first, std::make_pair(it->first, it2.second.second)});
-      }
-    }
-    if(tmp_transitions.find(it->first) != tmp_transitions.end())
-    {
-      it->second.insert(tmp_transitions[it->first].begin(), tmp_transitions[it->first].end());
-      tmp_transitions.erase(it->first);
     }
   }
-
-  for(std::map<int, std::multimap<int, std::pair<int, double> > >::reverse_iterator it = tmp_transitions.rbegin(),
-                                                                  limit = tmp_transitions.rend();
-      it != limit; it++)
+  for(int i = states - 1; i >= 0; i--)
   {
-    for(auto& it2 : it->second)
+    for(auto& it : transitions[i])
     {
-      transitions[it->first].insert({it2.first, it2.second});
+      if(it.target != i)
+      {
+        reversed[it.target].push_back({it.tag, i, it.weight});
+      }
     }
+    // the old transitions are not needed any more
+    std::vector<Transition>().swap(transitions[i]);
+  }
+  for(auto& it : reversed)
+  {
+    sortTransitions(it);
   }
+  transitions.swap(reversed);
 
   int tmp = initial;
   initial = finals.begin()->first;
@@ -752,12 +1492,12 @@ Transducer::escapeSymbol(UString& symbol, bool hfst) const
 void
 Transducer::show(Alphabet const &alphabet, UFILE *output, int const epsilon_tag, bool hfst) const
 {
-  for(auto& it : transitions)
+  for(size_t i = 0; i != transitions.size(); i++)
   {
-    for(auto& it2 : it.second)
+    for(auto& it2 : transitions[i])
     {
-      auto t = alphabet.decode(it2.first);
-      u_fprintf(output, "%d\t%d\t", it.first, it2.second.first);
+      auto t = alphabet.decode(it2.tag);
+      u_fprintf(output, "%d\t%d\t", int(i), it2.target);
       UString l;
       alphabet.getSymbol(l, t.first);
       escapeSymbol(l, hfst);
@@ -766,7 +1506,7 @@ Transducer::show(Alphabet const &alphabet, UFILE *output, int const epsilon_tag,
       alphabet.getSymbol(r, t.second);
       escapeSymbol(r, hfst);
       u_fprintf(output, "%S\t", r.c_str());
-      u_fprintf(output, "%f\n", it2.second.second);
+      u_fprintf(output, "%f\n", it2.weight);
     }
   }
 
@@ -814,7 +1554,7 @@ Transducer::recognise(UStringView pattern, Alphabet &a, FILE *err) const
       for(auto& it3 : p)
       {
 
-        auto t = a.decode(it3.first);
+        auto t = a.decode(it3.tag);
         UString l;
         a.getSymbol(l, t.first);
         //UString r;
@@ -824,7 +1564,7 @@ Transducer::recognise(UStringView pattern, Alphabet &a, FILE *err) const
         //if(l.find(*it) != UString::npos || l.empty() )
         if(l.find(it) != UString::npos)
         {
-          auto myclosure = closure(it3.second.first, 0);
+          auto myclosure = closure(it3.target, 0);
           //std::cerr << "Before closure alives: " <<new_state.size() << std::endl;
           new_state.insert(myclosure.begin(), myclosure.end());
           //std::cerr << "After closure alives: " <<new_state.size() << std::endl;
@@ -902,8 +1642,8 @@ Transducer::copyWithTagsFirst(int start,
 
     for(auto& trans_it : transitions[this_src])
     {
-      int label = trans_it.first, this_trg = trans_it.second.first;
-      double this_wt = trans_it.second.second;
+      int label = trans_it.tag, this_trg = trans_it.target;
+      double this_wt = trans_it.weight;
       int left_symbol = alphabet.decode(label).first;
 
       // Anything after the first tag goes before the lemq, whether
@@ -1003,8 +1743,8 @@ Transducer::moveLemqsLast(Alphabet const &alphabet,
     seen.insert(this_src);
     for(auto& trans_it : transitions[this_src])
     {
-      int label = trans_it.first,
-       this_trg = trans_it.second.first;
+      int label = trans_it.tag,
+       this_trg = trans_it.target;
       UString left;
       alphabet.getSymbol(left, alphabet.decode(label).first);
       int new_src = states_this_new[this_src];
@@ -1105,9 +1845,9 @@ Transducer::trim(Transducer &trimmer,
 
     // First loop through _epsilon_ transitions of trimmer
     for(auto& trimmer_trans_it : trimmer.transitions[trimmer_src]) {
-      int trimmer_label = trimmer_trans_it.first,
-          trimmer_trg   = trimmer_trans_it.second.first;
-      double trimmer_wt = trimmer_trans_it.second.second;
+      int trimmer_label = trimmer_trans_it.tag,
+          trimmer_trg   = trimmer_trans_it.target;
+      double trimmer_wt = trimmer_trans_it.weight;
       int32_t trimmer_left = trimmer_a.decode(trimmer_label).first;
 
       if(trimmer_preplus == trimmer_src) {
@@ -1135,9 +1875,9 @@ Transducer::trim(Transducer &trimmer,
     // from live_trimmer_states, add that to (the front of) todo:
     for(auto& trans_it : transitions[this_src])
     {
-      int this_label = trans_it.first,
-          this_trg   = trans_it.second.first;
-      double this_wt = trans_it.second.second;
+      int this_label = trans_it.tag,
+          this_trg   = trans_it.target;
+      double this_wt = trans_it.weight;
       int32_t this_right = this_a.decode(this_label).second;
 
       bool special = false;
@@ -1207,8 +1947,8 @@ Transducer::trim(Transducer &trimmer,
 
         for(auto& trimmer_trans_it : trimmer.transitions.at(trimmer_src))
         {
-          int trimmer_label = trimmer_trans_it.first,
-              trimmer_trg   = trimmer_trans_it.second.first;
+          int trimmer_label = trimmer_trans_it.tag,
+              trimmer_trg   = trimmer_trans_it.target;
           int32_t trimmer_left = trimmer_a.decode(trimmer_label).first;
 
           if(trimmer_preplus == trimmer_src) {
@@ -1261,13 +2001,13 @@ Transducer::updateAlphabet(Alphabet& old_alpha, Alphabet& new_alpha,
   std::set<int32_t> symbol_pairs;
   std::set<int32_t> symbols;
   for (auto& it : transitions) {
-    for (auto& it2 : it.second) {
-      if (!has_pairs && it2.first < 0) {
-        symbols.insert(it2.first);
+    for (auto& it2 : it) {
+      if (!has_pairs && it2.tag < 0) {
+        symbols.insert(it2.tag);
       } else {
-        symbol_pairs.insert(it2.first);
-        int32_t l = old_alpha.decode(it2.first).first;
-        int32_t r = old_alpha.decode(it2.first).second;
+        symbol_pairs.insert(it2.tag);
+        int32_t l = old_alpha.decode(it2.tag).first;
+        int32_t r = old_alpha.decode(it2.tag).second;
         if (l < 0) {
           symbols.insert(l);
         }
@@ -1295,56 +2035,58 @@ Transducer::updateAlphabet(Alphabet& old_alpha, Alphabet& new_alpha,
     }
     symbol_update.swap(pair_update);
   }
-  std::map<int, std::multimap<int, std::pair<int, double> > > new_trans;
   for (auto& it : transitions) {
-    new_trans[it.first].clear();
-    for (auto& it2 : it.second) {
-      int32_t s = it2.first;
-      if (symbol_update.find(s) != symbol_update.end()) {
-        s = symbol_update[s];
+    for (auto& it2 : it) {
+      auto loc = symbol_update.find(it2.tag);
+      if (loc != symbol_update.end()) {
+        it2.tag = loc->second;
       }
-      new_trans[it.first].insert({s, std::make_pair(it2.second.first, it2.second.second)});
     }
+    sortTransitions(it);
   }
-  transitions.swap(new_trans);
 }
 
 void
 Transducer::invert(Alphabet& alpha)
 {
-  std::map<int, std::multimap<int, std::pair<int, double>>> tmp_trans;
   for (auto& it : transitions) {
-    std::multimap<int, std::pair<int, double>> tmp_state;
-    for (auto& it2 : it.second) {
-      auto pr = alpha.decode(it2.first);
-      int new_sym = alpha(pr.second, pr.first);
-      tmp_state.insert({new_sym, it2.second});
+    for (auto& it2 : it) {
+      auto pr = alpha.decode(it2.tag);
+      it2.tag = alpha(pr.second, pr.first);
     }
-    tmp_trans.insert({it.first, tmp_state});
+    sortTransitions(it);
   }
-  transitions.swap(tmp_trans);
 }
 
 void
 Transducer::deleteSymbols(const sorted_vector<int32_t>& syms)
 {
   for (auto& state : transitions) {
-    for (auto& sym : syms) {
-      state.second.erase(sym);
-    }
+    state.erase(std::remove_if(state.begin(), state.end(),
+                               [&](Transition const &t) {
+                                 return syms.count(t.tag);
+                               }),
+                state.end());
   }
 }
 
 void
 Transducer::epsilonizeSymbols(const sorted_vector<int32_t>& syms)
 {
+  std::vector<Transition> kept, moved;
   for (auto& state: transitions) {
-    for (auto& sym : syms) {
-      auto pr = state.second.equal_range(sym);
-      for (auto it = pr.first; it != pr.second; it++) {
-        state.second.insert({0, it->second});
+    kept.clear();
+    moved.clear();
+    for (auto& it : state) {
+      if (syms.count(it.tag)) {
+        moved.push_back({0, it.target, it.weight});
+      } else {
+        kept.push_back(it);
       }
-      state.second.erase(sym);
+    }
+    if (!moved.empty()) {
+      kept.insert(tagRange(kept, 0).second, moved.begin(), moved.end());
+      state.assign(kept.begin(), kept.end());
     }
   }
 }
@@ -1354,19 +2096,18 @@ Transducer::applyACX(Alphabet& alpha,
                      const std::map<int32_t, sorted_vector<int32_t>>& acx)
 {
   for (auto& state : transitions) {
-    std::vector<std::pair<int, std::pair<int, double>>> to_insert;
-    for (auto& it : state.second) {
-      auto pr = alpha.decode(it.first);
+    size_t count = state.size();
+    for (size_t i = 0; i != count; i++) {
+      auto pr = alpha.decode(state[i].tag);
       auto loc = acx.find(pr.first);
       if (loc != acx.end()) {
         for (auto& sym : loc->second) {
-          to_insert.push_back({alpha(sym, pr.second), it.second});
+          state.push_back({alpha(sym, pr.second), state[i].target,
+                           state[i].weight});
         }
       }
     }
-    for (auto& it : to_insert) {
-      state.second.insert(it);
-    }
+    sortTransitions(state);
   }
 }
 
@@ -1445,9 +2186,9 @@ Transducer::compose(Transducer const &g,
 
     // First loop through _epsilon_ transitions of g (input side)
     for(const auto &g_trans_it : g.transitions.at(g_src)) {
-      int g_label = g_trans_it.first,
-          g_trg   = g_trans_it.second.first;
-      double g_wt = g_trans_it.second.second;
+      int g_label = g_trans_it.tag,
+          g_trg   = g_trans_it.target;
+      double g_wt = g_trans_it.weight;
       std::pair<int32_t, int32_t> g_leftright = g_a.decode(g_label);
       int32_t g_left = g_leftright.first,
               g_right = g_leftright.second;
@@ -1474,9 +2215,9 @@ Transducer::compose(Transducer const &g,
     // matches left-side of an arc from g states, add that to todo:
     for(auto& trans_it : transitions[f_src])
     {
-      int f_label = trans_it.first,
-          f_trg   = trans_it.second.first;
-      double f_wt = trans_it.second.second;
+      int f_label = trans_it.tag,
+          f_trg   = trans_it.target;
+      double f_wt = trans_it.weight;
       std::pair<int32_t, int32_t> f_leftright = f_a.decode(f_label);
       int32_t f_input, f_output;
       if(f_inverted) {
@@ -1490,9 +2231,9 @@ Transducer::compose(Transducer const &g,
 
       // Loop through non-epsilon arcs from the live state of g
       for (auto &g_trans_it : g.transitions.at(g_src)) {
-        int g_label = g_trans_it.first,
-            g_trg = g_trans_it.second.first;
-        double g_wt = g_trans_it.second.second;
+        int g_label = g_trans_it.tag,
+            g_trg = g_trans_it.target;
+        double g_wt = g_trans_it.weight;
         std::pair<int32_t, int32_t> g_leftright = g_a.decode(g_label);
         const int32_t g_left = g_leftright.first,
                       g_right = g_leftright.second;
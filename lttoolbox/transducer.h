@@ -20,6 +20,7 @@
 #include <cstdio>
 #include <map>
 #include <set>
+#include <vector>
 
 #include <lttoolbox/alphabet.h>
 #include <lttoolbox/sorted_vector.hpp>
@@ -33,6 +34,27 @@ constexpr double default_weight = 0;
 
 class MatchExe;
 
+/**
+ * How Transducer::minimize() goes about it
+ */
+enum MinimisationMode
+{
+  mm_auto,       // mm_hopcroft if the transducer is deterministic,
+                 // mm_brzozowski otherwise
+  mm_brzozowski, // reverse + determinize + reverse + determinize
+  mm_hopcroft    // determinize if needed, then merge equivalent states
+};
+
+/**
+ * A transition leaving a state of a Transducer
+ */
+struct Transition
+{
+  int tag;
+  int target;
+  double weight;
+};
+
 /**
  * Class to represent a letter transducer during the dictionary compilation
  */
@@ -53,10 +75,11 @@ private:
   std::map<int, double> finals;
 
   /**
-   * Transitions of the transducer
-   * Schema: (source state, tag, target state, weight)
+   * Transitions of the transducer, indexed by source state. The
+   * transitions of a state are ordered by tag, and in order of
+   * insertion among those with the same tag.
    */
-  std::map<int, std::multimap<int, std::pair<int, double> > > transitions;
+  std::vector<std::vector<Transition>> transitions;
 
   /**
    * New state creator
@@ -82,6 +105,21 @@ private:
    */
   void escapeSymbol(UString& symbol, bool hfst) const;
 
+  /**
+   * Read the body of a transducer in the flat format
+   * @param input the stream to read from
+   */
+  void readFlat(FILE *input);
+
+  /**
+   * Merge the equivalent states of a deterministic transducer whose
+   * final states have the default weight, with Revuz's algorithm if
+   * it is acyclic and Hopcroft's partition refinement otherwise
+   * @return false, leaving the transducer untouched, if no final
+   * state can be reached
+   */
+  bool minimizeDeterministic();
+
 public:
 
   /**
@@ -119,6 +157,12 @@ public:
    */
   Transducer(Transducer const &t);
 
+  /**
+   * Move constructor
+   * @param t transducer to be moved
+   */
+  Transducer(Transducer &&t) = default;
+
   /**
    * Assignment operator
    * @param t transducer to be assigned
@@ -126,6 +170,13 @@ public:
    */
   Transducer & operator =(Transducer const &t);
 
+  /**
+   * Move assignment operator
+   * @param t transducer to be moved
+   * @return the object result of the assignment
+   */
+  Transducer & operator =(Transducer &&t) = default;
+
   /**
    * Determine whether any weight is non-default
    * @return bool true or false
@@ -231,9 +282,9 @@ public:
   std::map<int, double> getFinals() const;
 
   /**
-   * Return reference to the transitions
+   * Return reference to the transitions, indexed by source state
    */
-  std::map<int, std::multimap<int, std::pair<int, double> > >& getTransitions();
+  std::vector<std::vector<Transition>>& getTransitions();
 
   /**
    * Reverse all the transductions of a transducer
@@ -251,14 +302,25 @@ public:
   /**
    * Determinize the transducer
    * @param epsilon_tag the tag to take as epsilon
+   * @param threads number of threads working on the subset construction
+   */
+  void determinize(int epsilon_tag = 0, unsigned int threads = 1);
+
+  /**
+   * Test if no state has epsilon transitions or two transitions with
+   * the same tag and weight
+   * @param epsilon_tag the tag to take as epsilon
    */
-  void determinize(int epsilon_tag = 0);
+  bool isDeterministic(int epsilon_tag = 0) const;
 
   /**
-   * Minimize = reverse + determinize + reverse + determinize
+   * Minimize; every mode gives the same result
    * @param epsilon_tag the tag to take as epsilon
+   * @param threads number of threads for each determinization
+   * @param mode the algorithm to use
    */
-  void minimize(int epsilon_tag = 0);
+  void minimize(int epsilon_tag = 0, unsigned int threads = 1,
+                MinimisationMode mode = mm_auto);
 
 
   /**
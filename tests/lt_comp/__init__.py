@@ -1,6 +1,9 @@
 # -*- coding: utf-8 -*-
 
-from basictest import ProcTest, PrintTest
+from basictest import ProcTest, PrintTest, TempDir
+import os
+import random
+from subprocess import run
 import unittest
 
 class CompNormalAndJoin(unittest.TestCase, ProcTest):
@@ -119,3 +122,88 @@ class ConflictingEntryWeights(ProcTest):
     procdix = 'data/more-entry-weights.dix'
     inputs = ['house']
     expectedOutputs = ['^house/house<n><sg><W:1.000000>/house<vblex><pres><W:2.000000>/house<vblex><inf><W:3.000000>/house<vblex><imp><W:4.000000>$']
+
+class MinimiseHopcroft(unittest.TestCase, ProcTest):
+    compflags = ['-M', 'hopcroft']
+    inputs = ["abc", "ab", "y", "n", "jg", "jh", "kg"]
+    expectedOutputs = ["^abc/ab<n><def>$", "^ab/ab<n><ind>$", "^y/y<n><ind>$", "^n/n<n><ind>$", "^jg/j<pr>+g<n>$", "^jh/j<pr>+h<n>$", "^kg/k<pr>+g<n>$"]
+
+class MinimiseHopcroftWeights(unittest.TestCase, ProcTest):
+    compflags = ['-M', 'hopcroft']
+    procflags = ['-W']
+    procdix = 'data/more-entry-weights.dix'
+    inputs = ['house']
+    expectedOutputs = ['^house/house<vblex><pres><W:0.000000>/house<vblex><inf><W:1.000000>/house<n><sg><W:1.000000>/house<vblex><imp><W:2.000000>$']
+
+class IncrementalPlain(unittest.TestCase, ProcTest):
+    compflags = ['-i']
+    inputs = ["abc", "ab", "y", "n", "jg", "jh", "kg"]
+    expectedOutputs = ["^abc/ab<n><def>$", "^ab/ab<n><ind>$", "^y/y<n><ind>$", "^n/n<n><ind>$", "^jg/j<pr>+g<n>$", "^jh/j<pr>+h<n>$", "^kg/k<pr>+g<n>$"]
+
+class IncrementalWeights(unittest.TestCase, ProcTest):
+    compflags = ['-i']
+    procflags = ['-W']
+    procdix = 'data/more-entry-weights.dix'
+    inputs = ['house']
+    expectedOutputs = ['^house/house<vblex><pres><W:0.000000>/house<vblex><inf><W:1.000000>/house<n><sg><W:1.000000>/house<vblex><imp><W:2.000000>$']
+
+class ShareParadigms(unittest.TestCase, ProcTest):
+    compflags = ['-P']
+    procdix = 'data/group-after-join-mono.dix'
+    inputs = ['notG a', 'notG-jy a', 'hasG-jy']
+    expectedOutputs = ['^notG a/notG<vblex><inf># a$', '^notG-jy a/notG<vblex>+jy<prn># a$', '^hasG-jy/hasG<vblex>+jy<prn>$']
+
+class CacheReuse(unittest.TestCase, ProcTest):
+    procdix = 'data/group-after-join-mono.dix'
+    inputs = ['notG a', 'notG-jy a', 'hasG-jy']
+    expectedOutputs = ['^notG a/notG<vblex><inf># a$', '^notG-jy a/notG<vblex>+jy<prn># a$', '^hasG-jy/hasG<vblex>+jy<prn>$']
+
+    def compileTest(self, tmpd):
+        # the second run takes everything from the cache
+        for _ in range(2):
+            ret = self.compileDix(self.procdir, self.procdix,
+                                  flags=['-c', tmpd+'/cache'],
+                                  binName=tmpd+'/compiled.bin')
+            if not ret: return ret
+        return ret
+
+class ParallelCompileSameBinary(unittest.TestCase, ProcTest):
+    # Random words share few prefixes or suffixes, so the rounds of
+    # determinize get frontiers large enough for the worker threads
+    def randomWords(rng):
+        return sorted({''.join(rng.choice('abcdefghij')
+                               for _ in range(rng.randint(4, 9)))
+                       for _ in range(3000)})
+    words = randomWords(random.Random(0))
+
+    def writeDix(self, path, sections):
+        with open(path, 'w') as f:
+            f.write('<dictionary><alphabet/><sdefs><sdef n="n"/></sdefs>\n')
+            for s in range(sections):
+                f.write('<section id="s%d" type="standard">\n' % s)
+                for w in self.words[s::sections]:
+                    f.write('<e><p><l>%s</l><r>%s<s n="n"/></r></p></e>\n'
+                            % (w, w))
+                f.write('</section>\n')
+            f.write('</dictionary>\n')
+
+    def compileTo(self, dix, binName, flags, env):
+        cmd = [os.environ['LTTOOLBOX_PATH']+'/lt-comp'] + flags + ['lr', dix, binName]
+        res = run(cmd, capture_output=True, env=dict(os.environ, **env))
+        self.assertEqual(res.returncode, 0, res.stderr)
+        with open(binName, 'rb') as f:
+            return f.read()
+
+    def runTest(self):
+        with TempDir() as tmpd:
+            for sections in [1, 4]:
+                dix = tmpd+'/test.dix'
+                self.writeDix(dix, sections)
+                for alg in ['brzozowski', 'hopcroft']:
+                    flags = ['-M', alg]
+                    serial = self.compileTo(dix, tmpd+'/serial.bin', flags,
+                                            {'LT_THREADS': '1'})
+                    parallel = self.compileTo(dix, tmpd+'/parallel.bin',
+                                              flags + ['-j'],
+                                              {'LT_THREADS': '8'})
+                    self.assertEqual(serial, parallel)
@@ -15,6 +15,11 @@ class WeightedFst(unittest.TestCase, PrintTest):
     expectedOutput = "0\t1\tc\tc\t4.567895\n1\t2\ta\ta\t0.989532\n2\t3\tt\tt\t2.796193\n3\t4\tε\t+\t0.824564\n4\t5\tε\tn\t1.824564\n4\t5\tε\tv\t2.856296\n5\t0.525487\n"
 
 
+class FlatWeightedFst(WeightedFst):
+    def compileTest(self, tmpd):
+        return self.compileDix(self.printdir, self.printdix, flags=["-F"],
+                               binName=tmpd+'/compiled.bin')
+
 class NegativeWeightedFst(unittest.TestCase, PrintTest):
     printdix = "data/cat-weight-negative.att"
     printdir = "lr"
@@ -40,6 +45,28 @@ class SectionsFst(unittest.TestCase, PrintTest):
 """
 
 
+class IndexedSectionsFst(SectionsFst):
+    def compileTest(self, tmpd):
+        return self.compileDix(self.printdir, self.printdix, flags=["-I"],
+                               binName=tmpd+'/compiled.bin')
+
+
+class IndexedSectionSelection(IndexedSectionsFst):
+    printflags = ["-s", "main@standard"]
+    expectedOutput = """0\t1\tX\tX\t0.000000
+1\t2\tε\t<np>\t0.000000
+2\t0.000000
+"""
+
+
+class SectionSelection(SectionsFst):
+    printflags = ["-s", "final@inconditional"]
+    expectedOutput = """0\t1\t.\t.\t0.000000
+1\t2\tε\t<sent>\t0.000000
+2\t0.000000
+"""
+
+
 class Alphabet(unittest.TestCase, PrintTest):
     printdix = "data/alphabet.att"
     printdir = "lr"
@@ -1,5 +1,11 @@
 # -*- coding: utf-8 -*-
-from basictest import ProcTest as _ProcTest
+from basictest import ProcTest as _ProcTest, TempDir
+import json
+import os
+import socket
+import struct
+from subprocess import run
+import time
 import unittest
 
 class ProcTest(unittest.TestCase, _ProcTest):
@@ -68,12 +74,330 @@ class PrintWeightsNegative(ProcTest):
     inputs = ["cat"]
     expectedOutputs = ["^cat/cat+n<W:8.828133>/cat+v<W:9.859865>$"]
 
+class FlatBinary(ValidInput):
+    compflags = ["-F"]
+
+class FlatBinaryWeights(PrintWeights):
+    compflags = ["-F"]
+
+class FlatBinaryTruncated(ProcTest):
+    def runTest(self):
+        with TempDir() as tmpd:
+            self.compileDix('lr', self.procdix, ['-F'], binName=tmpd+'/full.bin')
+            with open(tmpd+'/full.bin', 'rb') as f:
+                image = f.read()
+            with open(tmpd+'/cut.bin', 'wb') as f:
+                f.write(image[:-64])
+            res = run([os.environ['LTTOOLBOX_PATH']+'/lt-proc', tmpd+'/cut.bin'],
+                      input=b'ab', capture_output=True)
+            self.assertEqual(res.returncode, 1)
+            self.assertIn(b'Malformed flat transducer', res.stderr)
+
+class FlatBinaryCorrupt(ProcTest):
+    procdix = "data/big-mono.dix"
+
+    def corrupt(self, binary, node, word, value):
+        # the image of the first section follows its header, its length
+        # and its padding; node records come after the 24-byte header
+        start = binary.index(b'LTTD') + 20
+        start += 1 + binary[start]
+        states = struct.unpack_from('<I', binary, start + 8)[0]
+        self.assertLess(node, states)
+        if node < 0:
+            node = struct.unpack_from('<I', binary, start + 4)[0]
+        at = start + 24 + 8 * node
+        if word >= 2:
+            # the destinations of the node's transitions follow the
+            # input and output symbols of its block
+            trans, size = struct.unpack_from('<iI', binary, at)
+            size &= 0x00ffffff
+            self.assertGreater(size, word - 2)
+            at += trans + 8 * size + 4 * (word - 2)
+        else:
+            at += 4 * word
+        data = bytearray(binary)
+        struct.pack_into('<i', data, at, value)
+        return bytes(data)
+
+    def runTest(self):
+        with TempDir() as tmpd:
+            self.compileDix('lr', self.procdix, ['-F'], binName=tmpd+'/full.bin')
+            with open(tmpd+'/full.bin', 'rb') as f:
+                binary = f.read()
+            # transitions far outside the image, a transition count that
+            # runs past the table, transitions that start in the middle of
+            # the node records and a transition to the middle of a node
+            for node, word, value in [(-1, 0, 0x7ffffff0), (-1, 1, 0x00ffffff),
+                                      (0, 0, 4), (-1, 2, 4)]:
+                with open(tmpd+'/bad.bin', 'wb') as f:
+                    f.write(self.corrupt(binary, node, word, value))
+                res = run([os.environ['LTTOOLBOX_PATH']+'/lt-proc', tmpd+'/bad.bin'],
+                          input=b'casa', capture_output=True)
+                self.assertEqual(res.returncode, 1)
+                self.assertIn(b'Malformed flat transducer', res.stderr)
+
+class EpsilonClosure(ProcTest):
+    procdix = "data/epsilon-closure.att"
+    procflags = ["-z", "-W"]
+    inputs = ["ab"]
+    expectedOutputs = ["^ab/azb<W:1.000000>/axc<W:1.500000>/axyb<W:1.750000>$"]
+
+class FlatBinaryEpsilonClosure(EpsilonClosure):
+    compflags = ["-F"]
+
+class EpsilonFanOut(ProcTest):
+    # 140 epsilon steps, too many to store with the node
+    procdix = "data/epsilon-fanout.att"
+    procflags = ["-z"]
+    inputs = ["ab a"]
+    expectedOutputs = ["^ab/ab$ ^a/*a$"]
+
+class FlatBinaryEpsilonFanOut(EpsilonFanOut):
+    compflags = ["-F"]
+
+class IndexedBinary(ValidInput):
+    compflags = ["-I"]
+
+class IndexedFlatBinary(ValidInput):
+    compflags = ["-I", "-F"]
+
+class ThreadedAnalysis(ValidInput):
+    procflags = ["-z", "-j", "2"]
+
+class ThreadedAnalysisNoFlush(ProcTest):
+    procflags = ["-j", "3"]
+    flushing = False
+    inputs = ["ab\n\nABC jg\n\n[<p>]y n\n"]
+    expectedOutputs = ["^ab/ab<n><ind>$\n\n^ABC/AB<n><def>$ ^jg/j<pr>+g<n>$\n\n[<p>]^y/y<n><ind>$ ^n/n<n><ind>$\n"]
+
+class ThreadedAnalysisReadError(ProcTest):
+    def runTest(self):
+        with TempDir() as tmpd:
+            self.compileDix('lr', self.procdix, binName=tmpd+'/an.bin')
+            with open(tmpd+'/in', 'wb') as f:
+                f.write(b"ab y \xc3")
+            for flags in [[], ['-j', '2'], ['-z', '-j', '4']]:
+                self.callProc('lt-proc', [tmpd+'/an.bin', tmpd+'/in', tmpd+'/out'],
+                              flags, expectFail=True)
+                with open(tmpd+'/out') as f:
+                    self.assertEqual(f.read(), "^ab/ab<n><ind>$ ^y/y<n><ind>$ ")
+
+class CachedAnalysis(ProcTest):
+    procflags = ["-z", "-k", "2"]
+    inputs = ["ab ABC ab jg",
+              "y n ab y Ab"]
+    expectedOutputs = ["^ab/ab<n><ind>$ ^ABC/AB<n><def>$ ^ab/ab<n><ind>$ ^jg/j<pr>+g<n>$",
+                       "^y/y<n><ind>$ ^n/n<n><ind>$ ^ab/ab<n><ind>$ ^y/y<n><ind>$ ^Ab/Ab<n><ind>$"]
+
+class Statistics(ProcTest):
+    def runTest(self):
+        with TempDir() as tmpd:
+            self.compileDix('lr', self.procdix, binName=tmpd+'/an.bin')
+            with open(tmpd+'/in', 'w') as f:
+                f.write("ab ABC xyz jg\n")
+            self.callProc('lt-proc', [tmpd+'/an.bin', tmpd+'/in', tmpd+'/out'],
+                          ['-T', tmpd+'/stats.json'])
+            with open(tmpd+'/stats.json') as f:
+                stats = json.load(f)
+            self.assertEqual(stats['tokens'], 4)
+            self.assertEqual(stats['unknown'], 1)
+            self.assertEqual(stats['unknown_rate'], 0.25)
+            self.assertEqual(stats['steps'], sum(stats['state_sizes'].values()))
+            self.assertIn('load', stats['seconds'])
+            self.assertIn('analysis', stats['seconds'])
+
+@unittest.skipUnless(hasattr(socket, 'AF_UNIX'), "needs Unix sockets")
+class ServerMode(ProcTest):
+    def sendFrame(self, conn, data):
+        conn.sendall(struct.pack('>I', len(data)) + data)
+
+    def recvFrame(self, conn):
+        def recvAll(n):
+            buf = b''
+            while len(buf) < n:
+                part = conn.recv(n - len(buf))
+                self.assertTrue(part)
+                buf += part
+            return buf
+        size = struct.unpack('>I', recvAll(4))[0]
+        return recvAll(size)
+
+    def request(self, conn, name, text):
+        self.sendFrame(conn, name.encode('utf-8'))
+        self.sendFrame(conn, text.encode('utf-8'))
+        return (self.recvFrame(conn).decode('utf-8'),
+                self.recvFrame(conn).decode('utf-8'))
+
+    def runTest(self):
+        with TempDir() as tmpd:
+            self.compileDix('lr', self.procdix, binName=tmpd+'/an.bin')
+            self.compileDix('rl', self.procdix, binName=tmpd+'/gen.bin')
+            with open(tmpd+'/services', 'w') as f:
+                f.write("# name file options\n")
+                f.write("morph %s/an.bin -a\n" % tmpd)
+                f.write("gen %s/gen.bin -n\n" % tmpd)
+            path = tmpd+'/lt.sock'
+            proc = self.openPipe('lt-proc', ['-S', path, '-j', '2', '-k', '10',
+                                             tmpd+'/services'])
+            try:
+                conn = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+                for _ in range(100):
+                    try:
+                        conn.connect(path)
+                        break
+                    except OSError:
+                        time.sleep(0.1)
+                self.assertEqual(self.request(conn, 'morph', 'ab ABC'),
+                                 ('ok', '^ab/ab<n><ind>$ ^ABC/AB<n><def>$'))
+                self.assertEqual(self.request(conn, 'gen', '^ab<n><ind>$ ^x<n>$'),
+                                 ('ok', 'ab x'))
+                self.assertEqual(self.request(conn, 'gen|morph', '^ab<n><ind>$ ^ABC<n><def>$'),
+                                 ('ok', '^ab/ab<n><ind>$ ^ABC/AB<n><def>$'))
+                self.assertEqual(self.request(conn, 'nope', 'ab')[0], 'error')
+                self.assertEqual(self.request(conn, 'gen|nope', 'ab')[0], 'error')
+                # the connection and the dictionaries survive an error
+                self.assertEqual(self.request(conn, 'morph', 'y'),
+                                 ('ok', '^y/y<n><ind>$'))
+                conn.close()
+            finally:
+                proc.terminate()
+                proc.communicate()
+
+class ServerManyClients(ServerMode):
+    def connect(self, path):
+        conn = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        for _ in range(100):
+            try:
+                conn.connect(path)
+                return conn
+            except OSError:
+                time.sleep(0.1)
+        self.fail("server did not start")
+
+    def runTest(self):
+        with TempDir() as tmpd:
+            self.compileDix('lr', self.procdix, binName=tmpd+'/an.bin')
+            with open(tmpd+'/services', 'w') as f:
+                f.write("morph %s/an.bin -a\n" % tmpd)
+            path = tmpd+'/lt.sock'
+            proc = self.openPipe('lt-proc', ['-S', path, '-j', '1',
+                                             tmpd+'/services'])
+            try:
+                # with one worker, clients that are connected but quiet
+                # or halfway through a request don't hold up the others
+                idle = self.connect(path)
+                partial = self.connect(path)
+                partial.sendall(struct.pack('>I', 5) + b'mor')
+                conns = [self.connect(path) for _ in range(3)]
+                for conn in conns:
+                    self.sendFrame(conn, b'morph')
+                    self.sendFrame(conn, b'ab')
+                for conn in conns:
+                    self.assertEqual(self.recvFrame(conn), b'ok')
+                    self.assertEqual(self.recvFrame(conn), b'^ab/ab<n><ind>$')
+                # requests sent back to back are answered in order
+                for text in [b'y', b'ab']:
+                    self.sendFrame(conns[0], b'morph')
+                    self.sendFrame(conns[0], text)
+                self.assertEqual(self.recvFrame(conns[0]), b'ok')
+                self.assertEqual(self.recvFrame(conns[0]), b'^y/y<n><ind>$')
+                self.assertEqual(self.recvFrame(conns[0]), b'ok')
+                self.assertEqual(self.recvFrame(conns[0]), b'^ab/ab<n><ind>$')
+                # the rest of the request arrives
+                partial.sendall(b'ph' + struct.pack('>I', 1) + b'y')
+                self.assertEqual(self.recvFrame(partial), b'ok')
+                self.assertEqual(self.recvFrame(partial), b'^y/y<n><ind>$')
+                # a frame over the limit closes the connection at once
+                big = self.connect(path)
+                big.sendall(struct.pack('>I', 1 << 30))
+                self.assertEqual(big.recv(1), b'')
+                self.assertEqual(self.request(conns[1], 'morph', 'y'),
+                                 ('ok', '^y/y<n><ind>$'))
+                for conn in [idle, partial, big] + conns:
+                    conn.close()
+            finally:
+                proc.terminate()
+                proc.communicate()
+
+class Pipeline(ProcTest):
+    inputs = ["^ab<n><ind>$ ^ABC<n><def>$ ^x<n>$",
+              "^y<n><ind>$"]
+    expectedOutputs = ["^ab/ab<n><ind>$ #^ABC/AB<n><def>$ #^x/*x$",
+                       "^y/y<n><ind>$"]
+
+    def compileTest(self, tmpd):
+        self.compileDix('rl', self.procdix, binName=tmpd+'/gen.bin')
+        self.compileDix('lr', self.procdix, binName=tmpd+'/an.bin')
+        with open(tmpd+'/pipeline', 'w') as f:
+            f.write("gen %s/gen.bin -g\n" % tmpd)
+            f.write("morph %s/an.bin -a\n" % tmpd)
+        return True
+
+    def openProc(self, tmpd):
+        return self.openPipe('lt-proc', ['-z', '-P', tmpd+'/pipeline'])
+
+class ServerStatsRejected(ProcTest):
+    def runTest(self):
+        with TempDir() as tmpd:
+            self.compileDix('lr', self.procdix, binName=tmpd+'/an.bin')
+            with open(tmpd+'/services', 'w') as f:
+                f.write("morph %s/an.bin -a\n" % tmpd)
+            self.callProc('lt-proc', [tmpd+'/services'],
+                          ['-S', tmpd+'/lt.sock', '-T', '-'], expectFail=True)
+            self.callProc('lt-proc', [tmpd+'/services'],
+                          ['-P', '-T', '-'], expectFail=True)
+
+class PipelineBinary(ProcTest):
+    # the two transfer stages pass the binary stream between them
+    inputs = ["[<p>]^ab<vblex><pres>$ [[t:b:1]]^*foo$",
+              "^d\\/e<vblex>$"]
+    expectedOutputs = ["[<p>]^ab<vblex><pres>/c<vblex><pres>$ [[t:b:1]]^*foo/*foo$",
+                       "^d\\/e<vblex>/@d\\/e<vblex>$"]
+
+    def compileTest(self, tmpd):
+        self.compileDix('lr', 'data/bidixpardef-bi.dix', binName=tmpd+'/bi.bin')
+        with open(tmpd+'/pipeline', 'w') as f:
+            f.write("bi1 %s/bi.bin -b\n" % tmpd)
+            f.write("bi2 %s/bi.bin -b\n" % tmpd)
+        return True
+
+    def openProc(self, tmpd):
+        return self.openPipe('lt-proc', ['-z', '-P', tmpd+'/pipeline'])
+
+class BinaryStream(ProcTest):
+    procdix = "data/bidixpardef-bi.dix"
+
+    def runTest(self):
+        with TempDir() as tmpd:
+            self.compileDix('lr', self.procdix, binName=tmpd+'/bi.bin')
+            with open(tmpd+'/in', 'w') as f:
+                f.write("[<p>]^ab<vblex><pres>$ [[t:b:1]]^*foo$ ^d\\/e<vblex>$\n")
+            self.callProc('lt-proc', [tmpd+'/bi.bin', tmpd+'/in', tmpd+'/out'], ['-b'])
+            self.callProc('lt-stream', [tmpd+'/in', tmpd+'/in.bin'])
+            self.callProc('lt-proc', [tmpd+'/bi.bin', tmpd+'/in.bin', tmpd+'/out.bin'],
+                          ['-b', '-y', '-Y'])
+            self.callProc('lt-stream', [tmpd+'/out.bin', tmpd+'/out.txt'], ['-t'])
+            with open(tmpd+'/out') as f:
+                expected = f.read()
+            with open(tmpd+'/out.txt') as f:
+                self.assertEqual(f.read(), expected)
+            self.assertEqual(expected, "[<p>]^ab<vblex><pres>/c<vblex><pres>$ "
+                             "[[t:b:1]]^*foo/*foo$ ^d\\/e<vblex>/@d\\/e<vblex>$\n")
+
 class PrintNAnalyses(ProcTest):
     procdix = "data/cat-weight.att"
     procflags = ["-N 1"]
     inputs = ["cat"]
     expectedOutputs = ["^cat/cat+n$"]
 
+class PrintNAnalysesPruned(ProcTest):
+    # 5^4 paths, which -N prunes on the way
+    procdix = "data/ambiguous-weights.att"
+    procflags = ["-z", "-W", "-N", "3"]
+    inputs = ["aaaa", "aaa"]
+    expectedOutputs = ["^aaaa/vvvv<W:0.000000>/wvvv<W:1.000000>/xvvv<W:2.000000>$",
+                       "^aaa/*aaa$"]
+
 class LemmaEntryWeights(ProcTest):
     procdix = "data/lemma-entry-weights.dix"
     procflags = ["-W"]
@@ -228,6 +552,14 @@ class SpaceAtEOF(ProcTest):
     procflags = []
     flushing = False
 
+class InconditionalSection(ProcTest):
+    procdix = "data/sections.dix"
+    inputs = ["X. X.X"]
+    expectedOutputs = ["^X/X<np>$^./.<sent>$ ^X/X<np>$^./.<sent>$^X/X<np>$"]
+
+class FlatBinaryInconditionalSection(InconditionalSection):
+    compflags = ["-F"]
+
 
 class NonBMPDixTest(ProcTest):
     procdix = "data/non-bmp.dix"
@@ -0,0 +1,83 @@
+# -*- coding: utf-8 -*-
+
+from basictest import ProcTest, TempDir
+from glob import glob
+import os
+import sys
+import unittest
+
+# The wrapper is only built with ENABLE_PYTHON_BINDINGS, which points
+# LTTOOLBOX_PYTHON_PATH at it; setup.py leaves the module in build/lib*
+if 'LTTOOLBOX_PYTHON_PATH' in os.environ:
+    path = os.environ['LTTOOLBOX_PYTHON_PATH']
+    sys.path[:0] = [path] + glob(path + '/build/lib*')
+    import lttoolbox
+else:
+    lttoolbox = None
+
+
+@unittest.skipIf(lttoolbox is None, 'Python wrapper not built')
+class BatchLookup(unittest.TestCase, ProcTest):
+    # several results, unknown, empty, upper case and astral plane
+    # words, whose offsets have to count code points and not UTF-16
+    words = ['house', 'zzz', '', 'abc', 'ABC', '𝒜b', '😀', 'house', '']
+
+    def load(self, tmpd, dix):
+        self.compileDix('lr', dix, binName=tmpd+'/compiled.bin')
+        return lttoolbox.FST(tmpd+'/compiled.bin')
+
+    def runTest(self):
+        with TempDir() as tmpd:
+            fst = self.load(tmpd, 'data/batch-mono.dix')
+            fst.initAnalysis()
+            batch = fst.lookup_batch(self.words)
+            self.assertEqual(len(batch[2]), len(self.words) + 1)
+            for i, word in enumerate(self.words):
+                single = fst.lookup_word(word) if word else []
+                self.assertEqual(lttoolbox.batch_results(batch, i), single)
+            self.assertEqual(lttoolbox.batch_results(batch, 0),
+                             ['house<n>', 'house<vblex>'])
+            self.assertEqual(lttoolbox.batch_results(batch, 1), [])
+            self.assertEqual(lttoolbox.batch_results(batch, 2), [])
+            self.assertEqual(lttoolbox.batch_results(batch, 5), ['𝒜b<n>'])
+            self.assertEqual(lttoolbox.batch_results(batch, 6), ['😀<n>'])
+            # the same object again gives the same answer
+            self.assertEqual(fst.lookup_batch(self.words), batch)
+            self.assertEqual(fst.lookup_batch([]), ('', [0], [0]))
+
+
+@unittest.skipIf(lttoolbox is None, 'Python wrapper not built')
+class SingleLookupCase(BatchLookup):
+    # lookup() of a word in upper case finds the lower case entry, as
+    # analysis does, and keeps the case of the input
+    def runTest(self):
+        with TempDir() as tmpd:
+            fst = self.load(tmpd, 'data/batch-mono.dix')
+            fst.initAnalysis()
+            self.assertEqual(fst.lookup_word('ABC'), ['AB<n>'])
+            self.assertEqual(fst.lookup_word('Abc'), ['Ab<n>'])
+            self.assertEqual(fst.lookup_word('abc'), ['ab<n>'])
+
+
+@unittest.skipIf(lttoolbox is None, 'Python wrapper not built')
+class BatchBiltrans(BatchLookup):
+    words = ['^house<n>$', '^house<vblex>$', '^q<n>$', '', '^*foo$',
+             '^😀<n>$', '^', '^$', '^House<n>$', '^house<n>$']
+
+    def runTest(self):
+        with TempDir() as tmpd:
+            fst = self.load(tmpd, 'data/batch-bi.dix')
+            fst.initBiltrans()
+            batch = fst.biltrans_batch(self.words)
+            self.assertEqual(batch[2], list(range(len(self.words) + 1)))
+            for i, word in enumerate(self.words):
+                single = fst.biltrans_word(word)
+                self.assertEqual(lttoolbox.batch_results(batch, i), [single])
+            self.assertEqual(lttoolbox.batch_results(batch, 0),
+                             ['^casa<n>/hogar<n>$'])
+            self.assertEqual(lttoolbox.batch_results(batch, 2), ['^@q<n>$'])
+            self.assertEqual(lttoolbox.batch_results(batch, 3), [''])
+            self.assertEqual(lttoolbox.batch_results(batch, 4), ['^*foo$'])
+            self.assertEqual(lttoolbox.batch_results(batch, 5), ['^🙂<n>$'])
+            self.assertEqual(lttoolbox.batch_results(batch, 8),
+                             ['^Casa<n>/Hogar<n>$'])